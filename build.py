@@ -150,7 +150,7 @@ def copy_dlls(args):
 	if not os.path.exists(dst_dir):
 		os.makedirs(dst_dir)
 
-	for qt_dll in ['Qt5Core.dll', 'icuin52.dll', 'icuuc52.dll', 'icudt52.dll']:
+	for qt_dll in ['Qt5Core.dll', 'Qt5Concurrent.dll', 'icuin52.dll', 'icuuc52.dll', 'icudt52.dll']:
 		fname = '{0}/{1}'.format(args.qt_dir, qt_dll);
 		print '   {0}'.format(fname)
 		shutil.copy(fname, dst_dir)
@@ -327,6 +327,7 @@ def main(argv):
 		copy_dlls(args)
 		build_qt(args, 'Hone Wireshark Shim', 'shim', 'hone_dumpcap.pro')
 		build_qt(args, 'Hone Wireshark Hook', 'hook', 'hook.pro')
+		build_qt(args, 'Hone Capture Summarizer', 'summarize', 'hone_summarize.pro')
 
 	installer_files = []
 	if 'i' in args.stage:
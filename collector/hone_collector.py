@@ -0,0 +1,130 @@
+#------------------------------------------------------------------------------
+# Stand-in collector for the hone-dumpcap --export option
+#
+# Copyright (c) 2014 Battelle Memorial Institute
+# Licensed under a modification of the 3-clause BSD license
+# See License.txt for the full text of the license and additional disclaimers
+#
+# Authors
+#   Richard L. Griswold <richard.griswold@pnnl.gov>
+#------------------------------------------------------------------------------
+
+from __future__ import print_function
+
+import argparse
+import os
+import socket
+import struct
+import threading
+import zlib
+
+HELLO_FORMAT     = '<4sIQ'
+HEADER_FORMAT    = '<4sIQII'
+FLAG_COMPRESSED  = 0x00000001
+
+sessions     = {}
+session_lock = threading.Lock()
+
+#------------------------------------------------------------------------------
+def receive(conn, length):
+	data = b''
+	while len(data) < length:
+		chunk = conn.recv(length - len(data))
+		if not chunk:
+			raise EOFError()
+		data += chunk
+	return data
+
+#------------------------------------------------------------------------------
+def serve(conn, args):
+	magic, version, session_id = struct.unpack(HELLO_FORMAT, receive(conn, struct.calcsize(HELLO_FORMAT)))
+	if magic != b'HONE' or version != 1:
+		print('Rejecting client with bad hello')
+		return
+
+	# Resume where this session left off
+	with session_lock:
+		if session_id not in sessions:
+			filename = os.path.join(args.output, 'hone_{0:016x}.pcapng'.format(session_id))
+			sessions[session_id] = {'file': open(filename, 'ab'), 'offset': 0}
+			print('Session {0:016x} writing to {1}'.format(session_id, filename))
+		session = sessions[session_id]
+	conn.sendall(struct.pack('<Q', session['offset']))
+	print('Session {0:016x} resuming at offset {1}'.format(session_id, session['offset']))
+
+	batches = 0
+	while True:
+		magic, flags, offset, raw_length, payload_length = struct.unpack(HEADER_FORMAT,
+				receive(conn, struct.calcsize(HEADER_FORMAT)))
+		if magic != b'HONB':
+			print('Session {0:016x} sent a bad batch header'.format(session_id))
+			return
+		data = receive(conn, payload_length)
+		if flags & FLAG_COMPRESSED:
+			# qCompress format: 4-byte big endian length, then a zlib stream
+			data = zlib.decompress(data[4:])
+		if len(data) != raw_length:
+			print('Session {0:016x} sent a batch with the wrong length'.format(session_id))
+			return
+
+		# Skip anything we already have, and note any data the sender dropped
+		if offset > session['offset']:
+			print('Session {0:016x} lost {1} bytes at offset {2}'.format(session_id, offset - session['offset'], session['offset']))
+		elif offset < session['offset']:
+			data = data[session['offset'] - offset:]
+		if data:
+			session['file'].write(data)
+			session['file'].flush()
+		session['offset'] = max(session['offset'], offset + raw_length)
+		conn.sendall(struct.pack('<Q', session['offset']))
+
+		batches += 1
+		if args.drop_after and batches >= args.drop_after:
+			print('Session {0:016x} dropping connection after {1} batches'.format(session_id, batches))
+			return
+
+#------------------------------------------------------------------------------
+def handle(conn, args):
+	try:
+		serve(conn, args)
+	except EOFError:
+		pass
+	except socket.error as e:
+		print('Connection error: {0}'.format(e))
+	finally:
+		conn.close()
+
+#------------------------------------------------------------------------------
+def main():
+	parser = argparse.ArgumentParser(description='Receive capture data exported by hone-dumpcap')
+	parser.add_argument('address', help='host:port or unix:path to listen on')
+	parser.add_argument('-o', '--output', default='.', help='directory for received captures')
+	parser.add_argument('--drop-after', type=int, default=0, metavar='N',
+			help='drop each connection after N batches to exercise resume')
+	args = parser.parse_args()
+
+	if args.address.startswith('unix:'):
+		path = args.address[5:]
+		if os.path.exists(path):
+			os.unlink(path)
+		listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		listener.bind(path)
+	else:
+		host, port = args.address.rsplit(':', 1)
+		listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		listener.bind((host, int(port)))
+	listener.listen(5)
+	print('Listening on {0}'.format(args.address))
+
+	while True:
+		conn, _ = listener.accept()
+		thread = threading.Thread(target=handle, args=(conn, args))
+		thread.daemon = True
+		thread.start()
+
+if __name__ == '__main__':
+	try:
+		main()
+	except KeyboardInterrupt:
+		pass
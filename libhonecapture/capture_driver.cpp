@@ -0,0 +1,325 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include "capture_driver.h"
+
+#ifdef WIN32
+
+#define IOCTL_HONE_MARK_RESTART CTL_CODE(FILE_DEVICE_UNKNOWN, 2048, \
+	METHOD_NEITHER, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+#else // #ifdef WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define HEIO_RESTART        _IO(0xE0, 0x01)
+#define HEIO_GET_AT_HEAD    _IO(0xE0, 0x03)
+#define HEIO_GET_SNAPLEN    _IOR(0xE0, 0x04, int)
+#define HEIO_SET_SNAPLEN    _IOW(0xE0, 0x05, int)
+#define HEIO_GET_RING_PAGES _IOR(0xE0, 0x06, int)
+#define HEIO_SET_RING_PAGES _IOW(0xE0, 0x07, int)
+
+#endif // #ifdef WIN32
+
+//-----------------------------------------------------------------------------
+CaptureDriver::CaptureDriver(void)
+	: m_attached(false)
+	, m_handle(InvalidFileHandle)
+{
+	// Without these, Wait only ends early for a signal
+#ifdef WIN32
+	m_interruptHandles[0] = ::CreateEventA(NULL, FALSE, FALSE, NULL);
+	if (!m_interruptHandles[0]) {
+		m_interruptHandles[0] = InvalidFileHandle;
+	}
+	m_interruptHandles[1] = InvalidFileHandle;
+#else // #ifdef WIN32
+	if (::pipe(m_interruptHandles) == -1) {
+		m_interruptHandles[0] = InvalidFileHandle;
+		m_interruptHandles[1] = InvalidFileHandle;
+	} else {
+		for (int index = 0; index < 2; index++) {
+			::fcntl(m_interruptHandles[index], F_SETFL, O_NONBLOCK);
+			::fcntl(m_interruptHandles[index], F_SETFD, FD_CLOEXEC);
+		}
+	}
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+CaptureDriver::~CaptureDriver(void)
+{
+	Close();
+	for (int index = 0; index < 2; index++) {
+		if (m_interruptHandles[index] != InvalidFileHandle) {
+#ifdef WIN32
+			::CloseHandle(m_interruptHandles[index]);
+#else // #ifdef WIN32
+			::close(m_interruptHandles[index]);
+#endif // #ifdef WIN32
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::AtHead(void) const
+{
+	// True once everything the driver has queued has been read.  Only the
+	// Linux driver can say, so elsewhere a read of nothing has to do.
+#ifdef WIN32
+	return true;
+#else // #ifdef WIN32
+	return m_attached || (::ioctl(m_handle, HEIO_GET_AT_HEAD) > 0);
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::Attach(const FileHandle handle, const std::string &name)
+{
+	// Takes over a connected socket that carries the driver's stream, such as
+	// one from a capture daemon, which only ever sends whole blocks
+	Close();
+#ifdef WIN32
+	(void) handle;
+	(void) name;
+	return SetError("Attaching to a stream is not supported on Windows", false);
+#else // #ifdef WIN32
+	m_attached = true;
+	m_fileName = name;
+	m_handle   = handle;
+	::fcntl(m_handle, F_SETFL, O_NONBLOCK);
+	return true;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+void CaptureDriver::Close(void)
+{
+	if (m_handle != InvalidFileHandle) {
+#ifdef WIN32
+		::CloseHandle(m_handle);
+#else // #ifdef WIN32
+		::close(m_handle);
+#endif // #ifdef WIN32
+		m_handle = InvalidFileHandle;
+	}
+	m_attached = false;
+}
+
+//-----------------------------------------------------------------------------
+std::string CaptureDriver::DefaultFileName(void)
+{
+#ifdef WIN32
+	return "\\\\.\\HoneOut";
+#else // #ifdef WIN32
+	return "/dev/hone";
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::HasData(void) const
+{
+	// Cheaper than a read, since nothing is copied, so it suits busy-polling
+#ifdef WIN32
+	return false;
+#else // #ifdef WIN32
+	return !m_attached && (::ioctl(m_handle, HEIO_GET_AT_HEAD) == 0);
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+void CaptureDriver::Interrupt(void)
+{
+	// Safe to call from any thread or a signal handler.  An interrupt that
+	// comes before the wait still ends it.
+#ifdef WIN32
+	if (m_interruptHandles[0] != InvalidFileHandle) {
+		::SetEvent(m_interruptHandles[0]);
+	}
+#else // #ifdef WIN32
+	if (m_interruptHandles[1] != InvalidFileHandle) {
+		const char byte = 0;
+		const int  error = errno;
+		(void) ::write(m_interruptHandles[1], &byte, sizeof(byte));
+		errno = error;
+	}
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::MarkRestart(void)
+{
+	if (m_attached) {
+		return true; // The daemon owns the driver
+	}
+#ifdef WIN32
+	DWORD bytesReturned; // Unused, but required by DeviceIoControl()
+	if (!::DeviceIoControl(m_handle, IOCTL_HONE_MARK_RESTART, NULL, 0, NULL, 0, &bytesReturned, NULL)) {
+		return SetError("Cannot send log restart IOCTL");
+	}
+#else // #ifdef WIN32
+	if (::ioctl(m_handle, HEIO_RESTART) == -1) {
+		return SetError("Cannot send log restart IOCTL");
+	}
+#endif // #ifdef WIN32
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::Open(const std::string &fileName)
+{
+	Close();
+	m_fileName = fileName;
+#ifdef WIN32
+	m_handle = ::CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, 0);
+#else // #ifdef WIN32
+	m_handle = ::open(fileName.c_str(), O_RDONLY | O_NONBLOCK, 0);
+#endif // #ifdef WIN32
+	if (m_handle == InvalidFileHandle) {
+		return SetError("Cannot open driver " + fileName);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::Read(char *data, const uint32_t size, uint32_t &bytesRead)
+{
+	// Reading nothing is not an error, since the driver doesn't block
+	bytesRead = 0;
+#ifdef WIN32
+	DWORD driverBytesRead;
+	if (!::ReadFile(m_handle, data, size, &driverBytesRead, NULL)) {
+		return SetError("Cannot read from " + m_fileName);
+	}
+	bytesRead = driverBytesRead;
+#else // #ifdef WIN32
+	const ssize_t driverBytesRead = ::read(m_handle, data, size);
+	if ((driverBytesRead == -1)) {
+		if ((errno != EINTR) && (errno != EAGAIN)) {
+			return SetError("Cannot read from " + m_fileName);
+		}
+	} else if ((driverBytesRead == 0) && m_attached) {
+		return SetError(m_fileName + " closed the connection", false);
+	} else {
+		bytesRead = driverBytesRead;
+	}
+#endif // #ifdef WIN32
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::RingPages(int &pages)
+{
+#ifdef WIN32
+	(void) pages;
+	return SetError("Driver " + m_fileName + " cannot report its ring size", false);
+#else // #ifdef WIN32
+	if (m_attached || (::ioctl(m_handle, HEIO_GET_RING_PAGES, &pages) == -1)) {
+		return SetError("Driver " + m_fileName + " cannot report its ring size", !m_attached);
+	}
+	return true;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::SetError(const std::string &msg, const bool useErrorCode)
+{
+	m_error = msg;
+	if (useErrorCode) {
+		m_error.append(": ");
+#ifdef WIN32
+		char *buffer = NULL;
+		::FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+				NULL, ::GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), reinterpret_cast<char*>(&buffer), 0, NULL);
+		if (buffer) {
+			std::string text(buffer);
+			text.erase(text.find_last_not_of("\r\n") + 1);
+			m_error.append(text);
+			::LocalFree(buffer);
+		}
+#else // #ifdef WIN32
+		m_error.append(strerror(errno));
+#endif // #ifdef WIN32
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::SetRingPages(const int pages)
+{
+#ifdef WIN32
+	(void) pages;
+	return SetError("Driver " + m_fileName + " cannot resize its ring", false);
+#else // #ifdef WIN32
+	// The driver keeps the old size if it can't allocate the pages
+	int ringPages = pages;
+	if (m_attached || (::ioctl(m_handle, HEIO_SET_RING_PAGES, &ringPages) == -1)) {
+		return SetError("Driver " + m_fileName + " cannot resize its ring", !m_attached);
+	}
+	return true;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::SetSnapLen(const int snapLen)
+{
+#ifdef WIN32
+	(void) snapLen;
+	return SetError("Driver " + m_fileName + " cannot set its snap length", false);
+#else // #ifdef WIN32
+	int driverSnapLen = snapLen;
+	if (m_attached || (::ioctl(m_handle, HEIO_SET_SNAPLEN, &driverSnapLen) == -1)) {
+		return SetError("Driver " + m_fileName + " cannot set its snap length", !m_attached);
+	}
+	return true;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDriver::Wait(bool &interrupted)
+{
+	// Blocks until there is something to read.  Interrupt or a signal ends
+	// the wait early and sets interrupted, so the caller can stop.
+	interrupted = false;
+#ifdef WIN32
+	if (m_interruptHandles[0] == InvalidFileHandle) {
+		::Sleep(500);
+	} else {
+		interrupted = (::WaitForSingleObject(m_interruptHandles[0], 500) == WAIT_OBJECT_0);
+	}
+#else // #ifdef WIN32
+	const int interruptHandle = m_interruptHandles[0];
+	fd_set    readfds;
+	FD_ZERO(&readfds);
+	FD_SET(m_handle, &readfds);
+	if (interruptHandle != InvalidFileHandle) {
+		FD_SET(interruptHandle, &readfds);
+	}
+	const int maxHandle = (interruptHandle > m_handle) ? interruptHandle : m_handle;
+	if (-1 == ::select(maxHandle+1, &readfds, NULL, NULL, NULL)) {
+		if (errno != EINTR) {
+			return SetError("Cannot check for data from " + m_fileName);
+		}
+		interrupted = true;
+	} else if ((interruptHandle != InvalidFileHandle) && FD_ISSET(interruptHandle, &readfds)) {
+		char buffer[16];
+		while (::read(interruptHandle, buffer, sizeof(buffer)) > 0) {
+		}
+		interrupted = true;
+	}
+#endif // #ifdef WIN32
+	return true;
+}
@@ -0,0 +1,73 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef CAPTURE_DRIVER_H
+#define CAPTURE_DRIVER_H
+
+#include <stdint.h>
+#include <string>
+
+#ifdef WIN32
+#include <Windows.h>
+
+typedef HANDLE FileHandle;
+#define InvalidFileHandle INVALID_HANDLE_VALUE
+
+#else // #ifdef WIN32
+
+typedef int FileHandle;
+#define InvalidFileHandle -1
+
+#endif // #ifdef WIN32
+
+//----------------------------------------------------------------------------
+// Reads the PCAP-NG stream from the Hone driver, or from anything else that
+// delivers the same stream, such as a capture daemon's socket.  The stream
+// starts with the section header and interface blocks, and a restart makes the
+// driver end the current section so a reader can stop on a block boundary.
+// Interrupt ends a Wait from another thread or a signal handler.
+class CaptureDriver
+{
+public:
+	CaptureDriver(void);
+	~CaptureDriver(void);
+
+	bool        AtHead(void) const;
+	bool        Attach(const FileHandle handle, const std::string &name);
+	void        Close(void);
+	std::string Error(void) const { return m_error; }
+	FileHandle  Handle(void) const { return m_handle; }
+	bool        HasData(void) const;
+	void        Interrupt(void);
+	FileHandle  InterruptHandle(void) const { return m_interruptHandles[0]; }
+	bool        IsAttached(void) const { return m_attached; }
+	bool        IsOpen(void) const { return m_handle != InvalidFileHandle; }
+	bool        MarkRestart(void);
+	bool        Open(const std::string &fileName);
+	bool        Read(char *data, const uint32_t size, uint32_t &bytesRead);
+	bool        RingPages(int &pages);
+	bool        SetRingPages(const int pages);
+	bool        SetSnapLen(const int snapLen);
+	bool        Wait(bool &interrupted);
+
+	static std::string DefaultFileName(void);
+
+private:
+	bool SetError(const std::string &msg, const bool useErrorCode = true);
+
+	bool        m_attached;   // Handle is a daemon's socket rather than the driver
+	std::string m_error;
+	std::string m_fileName;
+	FileHandle  m_handle;
+	FileHandle  m_interruptHandles[2];  // Self-pipe read and write ends, or an event
+};
+
+#endif // CAPTURE_DRIVER_H
@@ -0,0 +1,76 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include "capture_rotation.h"
+
+//-----------------------------------------------------------------------------
+CaptureRotation::CaptureRotation(void)
+	: m_captureStart(0)
+	, m_fileCount(0)
+	, m_fileSize(0)
+	, m_fileStart(0)
+	, m_retainedFirst(0)
+	, m_retainedSize(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+CaptureRotation::Action CaptureRotation::Check(const int64_t now, const uint64_t packetCount) const
+{
+	if (
+			(m_stop.fileCount    && (m_fileCount   >= m_stop.fileCount  )) ||
+			(m_stop.fileSize     && (m_fileSize    >= m_stop.fileSize   )) ||
+			(m_stop.packetCount  && (packetCount   >= m_stop.packetCount)) ||
+			(m_stop.milliseconds && ((now - m_captureStart) > m_stop.milliseconds))) {
+		return ActionStop;
+	}
+	if (
+			(m_rotate.fileSize     && (m_fileSize >= m_rotate.fileSize)) ||
+			(m_rotate.milliseconds && ((now - m_fileStart) > m_rotate.milliseconds))) {
+		return ActionRotate;
+	}
+	return ActionNone;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureRotation::OpenFile(const int64_t now, const int64_t openTime, RetainedFile &expired)
+{
+	// Keep the files in a fixed ring of index and time pairs rather than
+	// their names, so long retention stays small and each rotation is O(1)
+	bool haveExpired = false;
+	if (m_rotate.fileCount) {
+		if (m_retainedFiles.empty()) {
+			m_retainedFiles.resize(m_rotate.fileCount);
+		}
+		if (m_retainedSize == m_rotate.fileCount) {
+			expired         = m_retainedFiles[m_retainedFirst];
+			haveExpired     = true;
+			m_retainedFirst = (m_retainedFirst + 1) % m_rotate.fileCount;
+			m_retainedSize--;
+		}
+		RetainedFile &file = m_retainedFiles[(m_retainedFirst + m_retainedSize) % m_rotate.fileCount];
+		file.fileIndex = m_fileCount;
+		file.openTime  = openTime;
+		m_retainedSize++;
+	}
+
+	m_fileCount++;
+	m_fileSize  = 0;
+	m_fileStart = now;
+	return haveExpired;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureRotation::Start(const int64_t now)
+{
+	m_captureStart = now;
+	m_fileStart    = now;
+}
@@ -0,0 +1,71 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef CAPTURE_ROTATION_H
+#define CAPTURE_ROTATION_H
+
+#include <stdint.h>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Decides when a capture starts a new file and when it stops, and which old
+// file to delete when only the newest few are kept.  The caller owns the
+// clock, so a capture can run on the time of its packets rather than the time
+// it is read.  A condition of zero is turned off.
+class CaptureRotation
+{
+public:
+	enum Action {
+		ActionNone,
+		ActionRotate,  // Start a new file
+		ActionStop,    // End the capture
+	};
+
+	struct Conditions {
+		Conditions(void) : fileCount(0), fileSize(0), milliseconds(0), packetCount(0) {}
+
+		uint32_t fileCount;     // Files to keep when rotating, or files to stop after
+		uint64_t fileSize;      // Bytes in a file
+		int64_t  milliseconds;  // Time in a file when rotating, or in the capture
+		uint64_t packetCount;   // Packets in the capture, when stopping
+	};
+
+	// Just enough to rebuild the name of a kept file
+	struct RetainedFile {
+		uint32_t fileIndex;  // FileCount() when it was opened
+		int64_t  openTime;   // Milliseconds since the epoch when opened
+	};
+
+	CaptureRotation(void);
+
+	void        AddBytes(const uint64_t length) { m_fileSize += length; }
+	Action      Check(const int64_t now, const uint64_t packetCount) const;
+	uint32_t    FileCount(void) const { return m_fileCount; }
+	uint64_t    FileSize(void) const { return m_fileSize; }
+	bool        NeedsClock(void) const { return m_rotate.milliseconds || m_stop.milliseconds; }
+	bool        OpenFile(const int64_t now, const int64_t openTime, RetainedFile &expired);
+	Conditions &Rotate(void) { return m_rotate; }
+	void        Start(const int64_t now);
+	Conditions &Stop(void) { return m_stop; }
+
+private:
+	int64_t                   m_captureStart;
+	uint32_t                  m_fileCount;
+	uint64_t                  m_fileSize;
+	int64_t                   m_fileStart;
+	std::vector<RetainedFile> m_retainedFiles;  // Ring of the kept files, oldest at m_retainedFirst
+	uint32_t                  m_retainedFirst;
+	uint32_t                  m_retainedSize;
+	Conditions                m_rotate;
+	Conditions                m_stop;
+};
+
+#endif // CAPTURE_ROTATION_H
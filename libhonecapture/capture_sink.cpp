@@ -0,0 +1,116 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include "capture_sink.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#endif // #ifndef WIN32
+
+//-----------------------------------------------------------------------------
+FileSink::FileSink(void)
+	: m_handle(InvalidFileHandle)
+{
+}
+
+//-----------------------------------------------------------------------------
+FileSink::~FileSink(void)
+{
+	Close();
+}
+
+//-----------------------------------------------------------------------------
+bool FileSink::Close(void)
+{
+	if (m_handle == InvalidFileHandle) {
+		return true;
+	}
+#ifdef WIN32
+	const bool rc = (::CloseHandle(m_handle) != 0);
+#else // #ifdef WIN32
+	const bool rc = (::close(m_handle) == 0);
+#endif // #ifdef WIN32
+	m_handle = InvalidFileHandle;
+	if (!rc) {
+		return SetError("Cannot close " + m_fileName);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool FileSink::Open(const std::string &fileName)
+{
+	if (!Close()) {
+		return false;
+	}
+	m_fileName = fileName;
+#ifdef WIN32
+	m_handle = ::CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+#else // #ifdef WIN32
+	m_handle = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif // #ifdef WIN32
+	if (m_handle == InvalidFileHandle) {
+		return SetError("Cannot open " + fileName + " for writing");
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool FileSink::SetError(const std::string &msg)
+{
+	m_error = msg + ": ";
+#ifdef WIN32
+	char *buffer = NULL;
+	::FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+			NULL, ::GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), reinterpret_cast<char*>(&buffer), 0, NULL);
+	if (buffer) {
+		std::string text(buffer);
+		text.erase(text.find_last_not_of("\r\n") + 1);
+		m_error.append(text);
+		::LocalFree(buffer);
+	}
+#else // #ifdef WIN32
+	m_error.append(strerror(errno));
+#endif // #ifdef WIN32
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+bool FileSink::Write(const char *data, const uint32_t length, const uint32_t packetCount)
+{
+	(void) packetCount;
+
+	// Nothing is buffered, so the blocks are in the file, where a reader
+	// following it can see them, as soon as this returns
+	uint32_t written = 0;
+	while (written < length) {
+#ifdef WIN32
+		DWORD bytesWritten;
+		if (!::WriteFile(m_handle, data + written, length - written, &bytesWritten, NULL)) {
+			return SetError("Cannot write to " + m_fileName);
+		}
+#else // #ifdef WIN32
+		const ssize_t bytesWritten = ::write(m_handle, data + written, length - written);
+		if (bytesWritten == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return SetError("Cannot write to " + m_fileName);
+		}
+#endif // #ifdef WIN32
+		written += bytesWritten;
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef CAPTURE_SINK_H
+#define CAPTURE_SINK_H
+
+#include <stdint.h>
+#include <string>
+
+#include "capture_driver.h"
+
+//----------------------------------------------------------------------------
+// Where a capture's files are written.  Open starts a new file, at the start
+// of the capture and at each rotation, and Write only ever gets whole blocks.
+class CaptureSink
+{
+public:
+	virtual ~CaptureSink(void) {}
+
+	virtual bool        Close(void) = 0;
+	virtual std::string Error(void) const = 0;
+	virtual bool        Open(const std::string &fileName) = 0;
+	virtual bool        Write(const char *data, const uint32_t length, const uint32_t packetCount) = 0;
+};
+
+//----------------------------------------------------------------------------
+// Writes each file straight through to the disk from the calling thread
+class FileSink : public CaptureSink
+{
+public:
+	FileSink(void);
+	~FileSink(void);
+
+	bool        Close(void);
+	std::string Error(void) const { return m_error; }
+	bool        Open(const std::string &fileName);
+	bool        Write(const char *data, const uint32_t length, const uint32_t packetCount);
+
+private:
+	bool SetError(const std::string &msg);
+
+	std::string m_error;
+	std::string m_fileName;
+	FileHandle  m_handle;
+};
+
+#endif // CAPTURE_SINK_H
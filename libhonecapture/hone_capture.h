@@ -0,0 +1,72 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef HONE_CAPTURE_H
+#define HONE_CAPTURE_H
+
+// The capture core behind hone-dumpcap, with no dependency on Qt, so other
+// programs can capture from the Hone driver in process.  Link against the
+// honecapture static library, or include honecapture.pri in a qmake project.
+//
+//   CaptureDriver   driver;
+//   CaptureRotation rotation;
+//   FileSink        sink;
+//   if (!driver.Open(CaptureDriver::DefaultFileName())) {
+//       fprintf(stderr, "%s\n", driver.Error().c_str());
+//   }
+//   rotation.Rotate().fileSize  = 64 * 1024 * 1024;
+//   rotation.Rotate().fileCount = 10;
+//   rotation.Start(now);
+//   rotation.OpenFile(now, time(NULL) * 1000, expired);
+//   sink.Open(FileName(0));
+//   uint64_t packetCount = 0;
+//   uint32_t kept        = 0;
+//   for (;;) {
+//       uint32_t bytesRead;
+//       bool     interrupted;
+//       if (!driver.Read(buffer + kept, size - kept, bytesRead)) {
+//           break;
+//       }
+//       if (!bytesRead) {
+//           if (!driver.Wait(interrupted) || interrupted) {
+//               break;  // driver.Interrupt() or a signal ended the wait
+//           }
+//           continue;
+//       }
+//       uint32_t complete;
+//       uint32_t needed;
+//       const uint32_t count = ScanBlocks(buffer, kept + bytesRead, PacketCountStage(packetCount), complete, needed);
+//       sink.Write(buffer, complete, count);
+//       rotation.AddBytes(complete);
+//       // buffer held complete bytes of whole blocks.  Move the partial
+//       // block after them to the front, and grow the buffer to needed.
+//       if (rotation.Check(now, packetCount) == CaptureRotation::ActionRotate) {
+//           // Delete the oldest file once the ring of kept files is full,
+//           // and start the new one with the section headers
+//           if (rotation.OpenFile(now, time(NULL) * 1000, expired)) {
+//               remove(FileName(expired.fileIndex).c_str());
+//           }
+//           sink.Open(FileName(rotation.FileCount() - 1));
+//       }
+//   }
+//
+// CaptureDriver reads the driver, ScanBlocks and the block layouts in
+// pcapng_blocks.h walk the stream, CaptureRotation keeps the rotation and
+// retention bookkeeping, and CaptureSink is where the files go.  Readers of
+// the shared memory ring hone-dumpcap publishes with --shm-ring include
+// hone_ring.h on its own.
+
+#include "capture_driver.h"
+#include "capture_rotation.h"
+#include "capture_sink.h"
+#include "pcapng_blocks.h"
+
+#endif // HONE_CAPTURE_H
@@ -0,0 +1,318 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef HONE_RING_H
+#define HONE_RING_H
+
+// Reads the live capture from the shared memory ring hone-dumpcap publishes
+// with --shm-ring, without copying it.  Only this header is needed.
+//
+//   HoneRingReader reader;
+//   if (!reader.Attach("/run/hone/ring.sock")) {
+//       fprintf(stderr, "%s\n", reader.Error().c_str());
+//   }
+//   for (;;) {
+//       const char *data;
+//       uint32_t    length;
+//       while (reader.Next(data, length)) {
+//           // data holds whole PCAP-NG blocks, straight from the ring
+//           if (!reader.Valid()) {
+//               // The writer lapped us while we looked, so discard them
+//           }
+//       }
+//       reader.Wait(1000);
+//   }
+//
+// The ring has one writer and any number of readers, and the readers never
+// write to it, so a slow reader can't hold the capture up.  Instead the
+// writer overwrites the oldest records, and a reader that falls behind
+// skips to the oldest record still in the ring and counts what it lost.
+// Blocks too large for the ring, or corrupt, are never published at all;
+// the writer counts those for every reader.  Linux only.
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HONE_RING_MAGIC        0x474E5248  // "HRNG"
+#define HONE_RING_VERSION      1
+#define HONE_RING_HEADER_SIZE  4096        // The data area starts after this
+
+// Start of the mapping.  Only the writer changes it.  The section header
+// blocks the capture started with are kept here for readers that attach
+// later, with the generation odd while the writer replaces them.
+struct HoneRingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t dataSize;           // Bytes in the data area, a multiple of 8
+	uint32_t sectionGeneration;
+	uint32_t sectionLength;
+	uint64_t droppedBlocks;      // Blocks the writer couldn't publish
+	uint64_t droppedBytes;
+	char     padding1[24];
+
+	// Cursors count every byte ever written, so they never wrap.  The
+	// records from tail to head are intact.
+	uint64_t head;
+	uint64_t tail;
+	uint32_t wakeCount;          // Bumped with each record, for futex waits
+	char     padding2[44];
+};
+
+#define HONE_RING_MAX_SECTION_LENGTH  (HONE_RING_HEADER_SIZE - sizeof(HoneRingHeader))
+
+// Each record in the data area holds whole blocks, and never wraps around
+// the end of the area.  A record with no data pads out the end instead.
+struct HoneRingRecord {
+	uint32_t recordLength;       // Including this header, a multiple of 8
+	uint32_t dataLength;
+};
+
+//----------------------------------------------------------------------------
+class HoneRingReader
+{
+public:
+	HoneRingReader(void)
+		: m_cursor(0)
+		, m_data(NULL)
+		, m_header(NULL)
+		, m_lostBytes(0)
+		, m_mapLength(0)
+		, m_next(0)
+		, m_overrunCount(0)
+	{
+	}
+
+	~HoneRingReader(void)
+	{
+		Detach();
+	}
+
+	//------------------------------------------------------------------------
+	// Get the ring from hone-dumpcap's socket and map it.  Reading starts with
+	// the next record written, or the oldest one still in the ring.
+	bool Attach(const std::string &socketName, const bool fromOldest = false)
+	{
+		Detach();
+
+		struct sockaddr_un address;
+		::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socketName.size() >= sizeof(address.sun_path)) {
+			return SetError("Socket name " + socketName + " is too long", 0);
+		}
+		::strcpy(address.sun_path, socketName.c_str());
+		const int socketHandle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (socketHandle == -1) {
+			return SetError("Cannot create socket", errno);
+		}
+		if (::connect(socketHandle, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+			const int error = errno;
+			::close(socketHandle);
+			return SetError("Cannot connect to " + socketName, error);
+		}
+
+		// The ring comes as a read-only descriptor passed over the socket
+		char           byte;
+		struct iovec   iov     = { &byte, sizeof(byte) };
+		char           control[CMSG_SPACE(sizeof(int))];
+		struct msghdr  message;
+		::memset(&message, 0, sizeof(message));
+		message.msg_iov        = &iov;
+		message.msg_iovlen     = 1;
+		message.msg_control    = control;
+		message.msg_controllen = sizeof(control);
+		const ssize_t bytesRead = ::recvmsg(socketHandle, &message, 0);
+		const int     error     = errno;
+		::close(socketHandle);
+		struct cmsghdr *cmsg = (bytesRead > 0) ? CMSG_FIRSTHDR(&message) : NULL;
+		if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+			return SetError("No ring received from " + socketName, (bytesRead == -1) ? error : 0);
+		}
+		int ringHandle;
+		::memcpy(&ringHandle, CMSG_DATA(cmsg), sizeof(ringHandle));
+
+		struct stat info;
+		void       *map = MAP_FAILED;
+		if (::fstat(ringHandle, &info) == 0) {
+			map = ::mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, ringHandle, 0);
+		}
+		const int mapError = errno;
+		::close(ringHandle);
+		if (map == MAP_FAILED) {
+			return SetError("Cannot map the ring", mapError);
+		}
+		m_mapLength = info.st_size;
+		m_header    = static_cast<const HoneRingHeader*>(map);
+		m_data      = static_cast<const char*>(map) + HONE_RING_HEADER_SIZE;
+		if ((m_mapLength < HONE_RING_HEADER_SIZE) || (m_header->magic != HONE_RING_MAGIC) ||
+				(m_header->version != HONE_RING_VERSION) ||
+				(m_header->dataSize != m_mapLength - HONE_RING_HEADER_SIZE)) {
+			Detach();
+			return SetError("The ring from " + socketName + " is not a version 1 Hone ring", 0);
+		}
+
+		m_cursor       = Load(&m_header->head);
+		m_lostBytes    = 0;
+		m_overrunCount = 0;
+		if (fromOldest) {
+			m_cursor = Load(&m_header->tail);
+		}
+		m_next = m_cursor;
+		return true;
+	}
+
+	//------------------------------------------------------------------------
+	void Detach(void)
+	{
+		if (m_header) {
+			::munmap(const_cast<HoneRingHeader*>(m_header), m_mapLength);
+			m_header = NULL;
+			m_data   = NULL;
+		}
+	}
+
+	uint64_t    DroppedBlocks(void) const { return __atomic_load_n(&m_header->droppedBlocks, __ATOMIC_RELAXED); }
+	uint64_t    DroppedBytes(void) const { return __atomic_load_n(&m_header->droppedBytes, __ATOMIC_RELAXED); }
+	std::string Error(void) const { return m_error; }
+	uint64_t    LostBytes(void) const { return m_lostBytes; }
+	uint64_t    OverrunCount(void) const { return m_overrunCount; }
+
+	//------------------------------------------------------------------------
+	// Point at the next record's blocks, or return false if there are none
+	// yet.  The blocks stay in the ring, so check Valid once done with them.
+	bool Next(const char *&data, uint32_t &length)
+	{
+		m_cursor = m_next;
+		for (;;) {
+			if (m_cursor == Load(&m_header->head)) {
+				m_next = m_cursor;
+				return false;
+			}
+			if (!Valid()) {
+				Overrun();
+				continue;
+			}
+
+			// Read the record header, then make sure the writer hadn't already
+			// started on it
+			const uint64_t        offset = m_cursor % m_header->dataSize;
+			const HoneRingRecord *record = reinterpret_cast<const HoneRingRecord*>(m_data + offset);
+			const uint32_t recordLength  = record->recordLength;
+			const uint32_t dataLength    = record->dataLength;
+			if (!Valid()) {
+				Overrun();
+				continue;
+			}
+			if (!recordLength || (recordLength % 8) || (offset + recordLength > m_header->dataSize)) {
+				m_error = "The ring is corrupt";
+				Overrun();
+				continue;
+			}
+			if (!dataLength) {
+				m_cursor += recordLength;
+				continue;
+			}
+			data   = reinterpret_cast<const char*>(record + 1);
+			length = dataLength;
+			m_next = m_cursor + recordLength;
+			return true;
+		}
+	}
+
+	//------------------------------------------------------------------------
+	// Copy the section header and interface blocks the capture started with,
+	// which readers need to write the blocks out as PCAP-NG
+	std::string SectionHeaders(void) const
+	{
+		for (;;) {
+			const uint32_t generation = __atomic_load_n(&m_header->sectionGeneration, __ATOMIC_ACQUIRE);
+			if (generation & 1) {
+				continue;
+			}
+			const uint32_t    length = m_header->sectionLength;
+			const std::string headers(reinterpret_cast<const char*>(m_header + 1),
+					(length <= HONE_RING_MAX_SECTION_LENGTH) ? length : 0);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&m_header->sectionGeneration, __ATOMIC_RELAXED) == generation) {
+				return headers;
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------
+	// True if the writer hasn't started overwriting the record Next last
+	// returned
+	bool Valid(void) const
+	{
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		return Load(&m_header->tail) <= m_cursor;
+	}
+
+	//------------------------------------------------------------------------
+	// Sleep until the writer adds a record or the timeout passes.  Returns
+	// false on timeout.
+	bool Wait(const int timeoutMsecs)
+	{
+		const uint32_t wakeCount = __atomic_load_n(&m_header->wakeCount, __ATOMIC_ACQUIRE);
+		if (m_next != Load(&m_header->head)) {
+			return true;
+		}
+		struct timespec timeout;
+		timeout.tv_sec  = timeoutMsecs / 1000;
+		timeout.tv_nsec = (timeoutMsecs % 1000) * 1000000L;
+		return (::syscall(SYS_futex, &m_header->wakeCount, FUTEX_WAIT, wakeCount, &timeout, NULL, 0) == 0) ||
+				(errno != ETIMEDOUT);
+	}
+
+private:
+	static uint64_t Load(const uint64_t *cursor)
+	{
+		return __atomic_load_n(cursor, __ATOMIC_ACQUIRE);
+	}
+
+	// Skip to the oldest record still in the ring, or past everything when
+	// the cursor itself is bad
+	void Overrun(void)
+	{
+		const uint64_t tail = Load(&m_header->tail);
+		const uint64_t skip = (tail > m_cursor) ? tail : Load(&m_header->head);
+		m_lostBytes += skip - m_cursor;
+		m_cursor     = skip;
+		m_overrunCount++;
+	}
+
+	bool SetError(const std::string &msg, const int error)
+	{
+		m_error = error ? (msg + ": " + ::strerror(error)) : msg;
+		return false;
+	}
+
+	uint64_t              m_cursor;       // Start of the record Next last returned
+	const char           *m_data;
+	std::string           m_error;
+	const HoneRingHeader *m_header;
+	uint64_t              m_lostBytes;
+	size_t                m_mapLength;
+	uint64_t              m_next;
+	uint64_t              m_overrunCount;
+};
+
+#endif // HONE_RING_H
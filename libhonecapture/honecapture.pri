@@ -0,0 +1,15 @@
+# Sources of the Qt-free capture library, for projects that build it in
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+	$$PWD/capture_driver.cpp \
+	$$PWD/capture_rotation.cpp \
+	$$PWD/capture_sink.cpp
+
+HEADERS += \
+	$$PWD/capture_driver.h \
+	$$PWD/capture_rotation.h \
+	$$PWD/capture_sink.h \
+	$$PWD/hone_capture.h \
+	$$PWD/hone_ring.h \
+	$$PWD/pcapng_blocks.h
@@ -0,0 +1,12 @@
+CONFIG -= qt
+
+TARGET = honecapture
+CONFIG += staticlib
+
+TEMPLATE = lib
+
+win32 {
+	QMAKE_CFLAGS_RELEASE += /Zi
+}
+
+include(honecapture.pri)
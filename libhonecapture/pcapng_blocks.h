@@ -0,0 +1,273 @@
+//----------------------------------------------------------------------------
+// Hone capture library
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef PCAPNG_BLOCKS_H
+#define PCAPNG_BLOCKS_H
+
+#include <stdint.h>
+
+// PCAP-NG block types, including the Hone process and connection blocks
+#define PCAPNG_SECTION_HEADER_BLOCK    0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESC_BLOCK    0x00000001
+#define PCAPNG_INTERFACE_STATS_BLOCK   0x00000005
+#define PCAPNG_ENHANCED_PACKET_BLOCK   0x00000006
+#define HONE_PROCESS_EVENT_BLOCK       0x00000101
+#define HONE_CONNECTION_EVENT_BLOCK    0x00000102
+
+// Option codes
+#define PCAPNG_OPT_END_OF_OPTIONS      0
+#define PCAPNG_OPT_COMMENT             1
+#define PCAPNG_ISB_OPT_IFDROP          5
+#define HONE_PROCESS_OPT_PATH          2
+#define HONE_PROCESS_OPT_ARGV          3
+#define HONE_PACKET_OPT_CONNECTION_ID  257
+#define HONE_PACKET_OPT_PROCESS_ID     258
+
+// Every block starts with its type and total length, and the total length is
+// repeated at the end of the block
+struct PcapNgBlockHeader {
+	uint32_t blockType;
+	uint32_t blockLength;
+};
+
+// Smallest valid block: header plus trailing length
+#define PCAPNG_MIN_BLOCK_LENGTH  (sizeof(PcapNgBlockHeader) + sizeof(uint32_t))
+
+// Largest block taken as valid.  Hone's packets are far smaller, so a longer
+// one only comes from a corrupt file, and waiting for the rest of it would
+// mean buffering whatever length the file claims.
+#define PCAPNG_MAX_BLOCK_LENGTH  (16 * 1024 * 1024)
+
+// Fixed part of a Hone process event block after the block header
+struct HoneProcessEventBody {
+	uint32_t processId;
+	uint32_t timestampHigh;
+	uint32_t timestampLow;
+};
+
+// Fixed part of a Hone connection event block after the block header
+struct HoneConnectionEventBody {
+	uint32_t connectionId;
+	uint32_t processId;
+	uint32_t timestampHigh;
+	uint32_t timestampLow;
+};
+
+// Fixed part of an enhanced packet block after the block header
+struct PcapNgEnhancedPacketBody {
+	uint32_t interfaceId;
+	uint32_t timestampHigh;
+	uint32_t timestampLow;
+	uint32_t capturedLength;
+	uint32_t packetLength;
+};
+
+// Smallest enhanced packet block: no packet data and no options
+#define PCAPNG_MIN_PACKET_BLOCK_LENGTH  (sizeof(PcapNgBlockHeader) + sizeof(PcapNgEnhancedPacketBody) + sizeof(uint32_t))
+
+struct PcapNgOptionHeader {
+	uint16_t code;
+	uint16_t length;
+};
+
+//----------------------------------------------------------------------------
+// Hone reports the end of a process or the close of a connection with a block
+// that carries the negated ID
+inline bool HoneEventEnds(const uint32_t id)
+{
+	return static_cast<int32_t>(id) < 0;
+}
+
+inline uint32_t HoneEventId(const uint32_t id)
+{
+	return HoneEventEnds(id) ? 0U - id : id;
+}
+
+//----------------------------------------------------------------------------
+// Find an option in the options area of a block.  Returns false if the option
+// isn't present or the options are malformed.
+inline bool PcapNgFindOption(const char *options, const uint32_t length, const uint16_t code,
+		const char *&value, uint16_t &valueLength)
+{
+	uint32_t offset = 0;
+	while (offset + sizeof(PcapNgOptionHeader) <= length) {
+		const PcapNgOptionHeader *option = reinterpret_cast<const PcapNgOptionHeader*>(options + offset);
+		if (option->code == PCAPNG_OPT_END_OF_OPTIONS) {
+			break;
+		}
+		offset += sizeof(PcapNgOptionHeader);
+		if (offset + option->length > length) {
+			break;
+		}
+		if (option->code == code) {
+			value       = options + offset;
+			valueLength = option->length;
+			return true;
+		}
+		offset += (option->length + 3) & ~3;
+	}
+	return false;
+}
+
+//----------------------------------------------------------------------------
+// Find a 32-bit option value in the options area of a block
+inline bool PcapNgFindOption32(const char *options, const uint32_t length, const uint16_t code, uint32_t &value)
+{
+	const char *optionValue;
+	uint16_t    optionLength;
+	if (!PcapNgFindOption(options, length, code, optionValue, optionLength) || (optionLength < sizeof(uint32_t))) {
+		return false;
+	}
+	value = *reinterpret_cast<const uint32_t*>(optionValue);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// Get the options area of an enhanced packet block.  Block must be complete.
+inline void PcapNgPacketOptions(const char *block, const uint32_t blockLength, const char *&options, uint32_t &length)
+{
+	const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(block + sizeof(PcapNgBlockHeader));
+	const uint32_t start = sizeof(PcapNgBlockHeader) + sizeof(PcapNgEnhancedPacketBody) + ((packet->capturedLength + 3) & ~3);
+	const uint32_t end   = blockLength - sizeof(uint32_t);
+	options = block + start;
+	length  = (start < end) ? (end - start) : 0;
+}
+
+//----------------------------------------------------------------------------
+// Length of the block at the start of the data if all of it is there, or 0
+// if it is cut short or corrupt.  A corrupt block's length is too short, too
+// long or not a multiple of 4.  Every walk over blocks checks them with this,
+// so a bad length can't step it past the end of the data.
+inline uint32_t PcapNgBlockLength(const char *data, const uint32_t length, bool &corrupt)
+{
+	corrupt = false;
+	if (length < sizeof(PcapNgBlockHeader)) {
+		return 0;
+	}
+	const uint32_t blockLength = reinterpret_cast<const PcapNgBlockHeader*>(data)->blockLength;
+	if ((blockLength < PCAPNG_MIN_BLOCK_LENGTH) || (blockLength > PCAPNG_MAX_BLOCK_LENGTH) || (blockLength & 3)) {
+		corrupt = true;
+		return 0;
+	}
+	return (blockLength <= length) ? blockLength : 0;
+}
+
+inline uint32_t PcapNgBlockLength(const char *data, const uint32_t length)
+{
+	bool corrupt;
+	return PcapNgBlockLength(data, length, corrupt);
+}
+
+//----------------------------------------------------------------------------
+// Length of the section header and interface blocks at the start of the data,
+// which every file cut from a capture has to start with
+inline uint32_t PcapNgHeaderLength(const char *data, const uint32_t length, uint32_t &blockCount)
+{
+	uint32_t headerLength = 0;
+	blockCount = 0;
+	while (headerLength < length) {
+		const uint32_t blockLength = PcapNgBlockLength(data + headerLength, length - headerLength);
+		if (!blockLength) {
+			break;
+		}
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + headerLength);
+		if ((header->blockType != PCAPNG_SECTION_HEADER_BLOCK) && (header->blockType != PCAPNG_INTERFACE_DESC_BLOCK)) {
+			break;
+		}
+		headerLength += blockLength;
+		blockCount++;
+	}
+	return headerLength;
+}
+
+//----------------------------------------------------------------------------
+// Walks the complete blocks at the start of a buffer and hands each one to a
+// stage.  Stages are plain classes with a Block method, combined with
+// BlockStages at compile time, so the scan for a capture only does the work
+// of the features that are turned on, with no per-block tests or calls for
+// the rest.  Returns the number of complete blocks, with their total length
+// in completeLength and the length of a trailing partial block in needed.
+template <typename Stage>
+inline uint32_t ScanBlocks(const char *data, const uint32_t length, Stage stage,
+		uint32_t &completeLength, uint32_t &needed)
+{
+	uint32_t blockCount = 0;
+	uint32_t offset     = 0;
+
+	needed = 0;
+	while (offset + sizeof(PcapNgBlockHeader) <= length) {
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + offset);
+		bool           corrupt;
+		const uint32_t blockLength = PcapNgBlockLength(data + offset, length - offset, corrupt);
+		if (corrupt) {
+			// Pass the rest of the data through as is rather than waiting
+			// forever for the block to complete
+			offset = length;
+			break;
+		}
+		if (!blockLength) {
+			needed = header->blockLength;
+			break;
+		}
+		stage.Block(header);
+		blockCount++;
+		offset += blockLength;
+	}
+	completeLength = offset;
+	return blockCount;
+}
+
+//----------------------------------------------------------------------------
+// Stage for a plain capture, which only needs the blocks counted
+class NullBlockStage
+{
+public:
+	void Block(const PcapNgBlockHeader *) {}
+};
+
+//----------------------------------------------------------------------------
+// Counts the packets among the blocks
+class PacketCountStage
+{
+public:
+	explicit PacketCountStage(uint64_t &count) : m_count(&count) {}
+
+	void Block(const PcapNgBlockHeader *header)
+	{
+		if (header->blockType == PCAPNG_ENHANCED_PACKET_BLOCK) {
+			(*m_count)++;
+		}
+	}
+
+private:
+	uint64_t *m_count;
+};
+
+//----------------------------------------------------------------------------
+// Runs two stages on each block, and nests to run more
+template <typename First, typename Second>
+class BlockStages
+{
+public:
+	BlockStages(const First &first, const Second &second) : m_first(first), m_second(second) {}
+
+	void Block(const PcapNgBlockHeader *header)
+	{
+		m_first.Block(header);
+		m_second.Block(header);
+	}
+
+private:
+	First  m_first;
+	Second m_second;
+};
+
+#endif // PCAPNG_BLOCKS_H
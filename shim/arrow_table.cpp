@@ -0,0 +1,467 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QFile>
+#include <QPair>
+
+#include <string.h>
+
+#include "arrow_table.h"
+
+// Message header types, type ids and enum values from the Arrow format's
+// Message.fbs and Schema.fbs
+enum ArrowHeader {
+	ArrowHeaderSchema          = 1,
+	ArrowHeaderDictionaryBatch = 2,
+	ArrowHeaderRecordBatch     = 3,
+};
+enum ArrowTypeId {
+	ArrowTypeInt       = 2,
+	ArrowTypeUtf8      = 5,
+	ArrowTypeTimestamp = 10,
+};
+static const qint16 ArrowMetadataV5      = 4;
+static const qint16 ArrowTimeMicrosecond = 2;
+
+// Structs stored inline in the metadata, laid out as the format expects
+struct ArrowBlock {
+	qint64 offset;
+	qint32 metaDataLength;
+	qint32 padding;
+	qint64 bodyLength;
+};
+struct ArrowBuffer {
+	qint64 offset;
+	qint64 length;
+};
+struct ArrowFieldNode {
+	qint64 length;
+	qint64 nullCount;
+};
+
+//----------------------------------------------------------------------------
+// Builds a flatbuffer, the encoding of the Arrow metadata, from the back to
+// the front as the format's own builders do.  Offsets handed out are
+// distances from the end of the buffer, and children have to be built
+// before the tables that refer to them.
+class ArrowFlatBuilder
+{
+public:
+	ArrowFlatBuilder(void) : m_tableStart(0) {}
+
+	void AddOffset(const int field, const quint32 offset)
+	{
+		PushOffset(offset);
+		m_fields.append(qMakePair(field, Size()));
+	}
+
+	template <typename T>
+	void AddScalar(const int field, const T value)
+	{
+		Push(value);
+		m_fields.append(qMakePair(field, Size()));
+	}
+
+	quint32 CreateString(const QByteArray &value)
+	{
+		Align(4, value.size() + 1);
+		m_data.prepend('\0');
+		m_data.prepend(value);
+		return Push(static_cast<quint32>(value.size()));
+	}
+
+	template <typename T>
+	quint32 CreateStructVector(const QVector<T> &values)
+	{
+		Align(8, values.size() * sizeof(T));
+		m_data.prepend(reinterpret_cast<const char*>(values.constData()), values.size() * sizeof(T));
+		return Push(static_cast<quint32>(values.size()));
+	}
+
+	quint32 CreateVector(const QVector<quint32> &offsets)
+	{
+		Align(4, offsets.size() * sizeof(quint32));
+		for (int index = offsets.size() - 1; index >= 0; index--) {
+			PushOffset(offsets[index]);
+		}
+		return Push(static_cast<quint32>(offsets.size()));
+	}
+
+	quint32 EndTable(void)
+	{
+		// The table starts with the offset back to its vtable, which lists
+		// where in the table each field is, or zero for missing fields
+		Push<qint32>(0);
+		const quint32 tablePos = Size();
+		int fieldCount = 0;
+		for (int index = 0; index < m_fields.size(); index++) {
+			fieldCount = qMax(fieldCount, m_fields[index].first + 1);
+		}
+		QVector<quint16> entries(fieldCount, 0);
+		for (int index = 0; index < m_fields.size(); index++) {
+			entries[m_fields[index].first] = tablePos - m_fields[index].second;
+		}
+		for (int index = fieldCount - 1; index >= 0; index--) {
+			Push(entries[index]);
+		}
+		Push(static_cast<quint16>(tablePos - m_tableStart));
+		Push(static_cast<quint16>((fieldCount + 2) * sizeof(quint16)));
+		const qint32 vtable = Size() - tablePos;
+		::memcpy(m_data.data() + m_data.size() - tablePos, &vtable, sizeof(vtable));
+		m_fields.clear();
+		return tablePos;
+	}
+
+	QByteArray Finish(const quint32 root)
+	{
+		Align(8, sizeof(quint32));
+		PushOffset(root);
+		return m_data;
+	}
+
+	void StartTable(void)
+	{
+		m_fields.clear();
+		m_tableStart = Size();
+	}
+
+private:
+	// Pad so that once length more bytes are added, the front of the buffer
+	// is aligned to size
+	void Align(const quint32 size, const quint32 length = 0)
+	{
+		const quint32 padding = (size - ((m_data.size() + length) % size)) % size;
+		m_data.prepend(QByteArray(padding, '\0'));
+	}
+
+	template <typename T>
+	quint32 Push(const T value)
+	{
+		Align(sizeof(T));
+		m_data.prepend(reinterpret_cast<const char*>(&value), sizeof(T));
+		return Size();
+	}
+
+	void PushOffset(const quint32 offset)
+	{
+		Align(sizeof(quint32));
+		Push(static_cast<quint32>(Size() + sizeof(quint32) - offset));
+	}
+
+	quint32 Size(void) const { return m_data.size(); }
+
+	QByteArray                    m_data;
+	QVector<QPair<int, quint32> > m_fields;      // Field id and position of each field added
+	quint32                       m_tableStart;
+};
+
+//----------------------------------------------------------------------------
+// Add a buffer to a message body, keeping each buffer 8-byte aligned
+static void AddBuffer(QByteArray &body, QVector<ArrowBuffer> &buffers, const QByteArray &data)
+{
+	ArrowBuffer buffer;
+	buffer.offset = body.size();
+	buffer.length = data.size();
+	buffers.append(buffer);
+	body.append(data);
+	body.append(QByteArray((8 - (body.size() % 8)) % 8, '\0'));
+}
+
+//----------------------------------------------------------------------------
+// Append an encapsulated message: a continuation marker, the length of the
+// metadata, the metadata padded to 8 bytes, then the body
+static ArrowBlock AppendMessage(QByteArray &file, const QByteArray &metadata, const QByteArray &body)
+{
+	const qint32 paddedLength = (metadata.size() + 7) & ~7;
+	const qint32 prefix[2]    = { -1, paddedLength };
+
+	ArrowBlock block;
+	block.offset         = file.size();
+	block.metaDataLength = sizeof(prefix) + paddedLength;
+	block.padding        = 0;
+	block.bodyLength     = body.size();
+	file.append(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+	file.append(metadata);
+	file.append(QByteArray(paddedLength - metadata.size(), '\0'));
+	file.append(body);
+	return block;
+}
+
+//----------------------------------------------------------------------------
+static quint32 BuildIntType(ArrowFlatBuilder &builder, const qint32 bitWidth, const bool isSigned)
+{
+	builder.StartTable();
+	builder.AddScalar<qint32>(0, bitWidth);
+	builder.AddScalar<quint8>(1, isSigned);
+	return builder.EndTable();
+}
+
+//----------------------------------------------------------------------------
+static QByteArray BuildMessage(ArrowFlatBuilder &builder, const quint8 headerType, const quint32 header,
+		const qint64 bodyLength)
+{
+	builder.StartTable();
+	builder.AddScalar<qint64>(3, bodyLength);
+	builder.AddOffset(2, header);
+	builder.AddScalar<qint16>(0, ArrowMetadataV5);
+	builder.AddScalar<quint8>(1, headerType);
+	return builder.Finish(builder.EndTable());
+}
+
+//----------------------------------------------------------------------------
+static quint32 BuildRecordBatch(ArrowFlatBuilder &builder, const qint64 length,
+		const QVector<ArrowFieldNode> &nodes, const QVector<ArrowBuffer> &buffers)
+{
+	const quint32 nodeVector   = builder.CreateStructVector(nodes);
+	const quint32 bufferVector = builder.CreateStructVector(buffers);
+	builder.StartTable();
+	builder.AddScalar<qint64>(0, length);
+	builder.AddOffset(1, nodeVector);
+	builder.AddOffset(2, bufferVector);
+	return builder.EndTable();
+}
+
+//----------------------------------------------------------------------------
+static ArrowFieldNode FieldNode(const quint32 length)
+{
+	ArrowFieldNode node;
+	node.length    = length;
+	node.nullCount = 0;
+	return node;
+}
+
+//-----------------------------------------------------------------------------
+ArrowTable::ArrowTable(void)
+{
+}
+
+//-----------------------------------------------------------------------------
+int ArrowTable::AddColumn(const QByteArray &name, const ColumnType type)
+{
+	Column column;
+	column.name     = name;
+	column.rowCount = 0;
+	column.type     = type;
+	if (type == ColumnDictionary) {
+		column.dictionaryOffsets = QByteArray(sizeof(qint32), '\0');
+	} else if (type == ColumnString) {
+		column.offsets = QByteArray(sizeof(qint32), '\0');
+	}
+	m_columns.append(column);
+	return m_columns.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+void ArrowTable::Append(const int column, const quint64 value)
+{
+	Column &entry = m_columns[column];
+	if (entry.type == ColumnUInt32) {
+		const quint32 value32 = static_cast<quint32>(value);
+		entry.values.append(reinterpret_cast<const char*>(&value32), sizeof(value32));
+	} else {
+		entry.values.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+	entry.rowCount++;
+}
+
+//-----------------------------------------------------------------------------
+void ArrowTable::Append(const int column, const QByteArray &value)
+{
+	// Strings are stored back to back, with the offsets marking where each
+	// one ends.  Dictionary columns store each distinct string once and
+	// index it from the rows.
+	Column &entry = m_columns[column];
+	if (entry.type == ColumnDictionary) {
+		QHash<QByteArray, qint32>::const_iterator iter = entry.dictionaryIndex.constFind(value);
+		qint32 index;
+		if (iter == entry.dictionaryIndex.constEnd()) {
+			index = entry.dictionaryIndex.size();
+			entry.dictionaryIndex.insert(value, index);
+			entry.dictionary.append(value);
+			const qint32 end = entry.dictionary.size();
+			entry.dictionaryOffsets.append(reinterpret_cast<const char*>(&end), sizeof(end));
+		} else {
+			index = *iter;
+		}
+		entry.values.append(reinterpret_cast<const char*>(&index), sizeof(index));
+	} else {
+		entry.values.append(value);
+		const qint32 end = entry.values.size();
+		entry.offsets.append(reinterpret_cast<const char*>(&end), sizeof(end));
+	}
+	entry.rowCount++;
+}
+
+//-----------------------------------------------------------------------------
+quint32 ArrowTable::BuildSchema(ArrowFlatBuilder &builder) const
+{
+	QVector<quint32> fields;
+	for (int index = 0; index < m_columns.size(); index++) {
+		const Column &column = m_columns[index];
+		const quint32 name   = builder.CreateString(column.name);
+
+		// Dictionary columns are typed by their values, with the encoding
+		// naming the dictionary by its column index
+		quint8  typeType;
+		quint32 type;
+		quint32 dictionary = 0;
+		switch (column.type) {
+		case ColumnDictionary:
+		case ColumnString:
+			typeType = ArrowTypeUtf8;
+			builder.StartTable();
+			type = builder.EndTable();
+			if (column.type == ColumnDictionary) {
+				const quint32 indexType = BuildIntType(builder, 32, true);
+				builder.StartTable();
+				builder.AddScalar<qint64>(0, index);
+				builder.AddOffset(1, indexType);
+				dictionary = builder.EndTable();
+			}
+			break;
+		case ColumnTimestamp: {
+			typeType = ArrowTypeTimestamp;
+			const quint32 timezone = builder.CreateString("UTC");
+			builder.StartTable();
+			builder.AddOffset(1, timezone);
+			builder.AddScalar<qint16>(0, ArrowTimeMicrosecond);
+			type = builder.EndTable();
+			break;
+		}
+		case ColumnUInt32:
+		default:
+			typeType = ArrowTypeInt;
+			type     = BuildIntType(builder, (column.type == ColumnUInt32) ? 32 : 64, false);
+			break;
+		}
+		const quint32 children = builder.CreateVector(QVector<quint32>());
+
+		builder.StartTable();
+		builder.AddOffset(0, name);
+		builder.AddOffset(3, type);
+		if (dictionary) {
+			builder.AddOffset(4, dictionary);
+		}
+		builder.AddOffset(5, children);
+		builder.AddScalar<quint8>(1, false);
+		builder.AddScalar<quint8>(2, typeType);
+		fields.append(builder.EndTable());
+	}
+	const quint32 fieldVector = builder.CreateVector(fields);
+
+	builder.StartTable();
+	builder.AddOffset(1, fieldVector);
+	return builder.EndTable();
+}
+
+//-----------------------------------------------------------------------------
+void ArrowTable::Clear(void)
+{
+	for (int index = 0; index < m_columns.size(); index++) {
+		Column &column = m_columns[index];
+		column.dictionary.clear();
+		column.dictionaryIndex.clear();
+		column.rowCount = 0;
+		column.values.clear();
+		if (column.type == ColumnDictionary) {
+			column.dictionaryOffsets = QByteArray(sizeof(qint32), '\0');
+		} else if (column.type == ColumnString) {
+			column.offsets = QByteArray(sizeof(qint32), '\0');
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+quint32 ArrowTable::RowCount(void) const
+{
+	return m_columns.isEmpty() ? 0 : m_columns[0].rowCount;
+}
+
+//-----------------------------------------------------------------------------
+bool ArrowTable::Write(const QString &fileName)
+{
+	// The file is the schema, a dictionary batch for each dictionary column
+	// and one record batch with every column, followed by a footer listing
+	// where the batches are.  No column has nulls, so every validity buffer
+	// is left empty.
+	QByteArray file("ARROW1\0\0", 8);
+	{
+		ArrowFlatBuilder builder;
+		const quint32 schema = BuildSchema(builder);
+		AppendMessage(file, BuildMessage(builder, ArrowHeaderSchema, schema, 0), QByteArray());
+	}
+
+	QVector<ArrowBlock> dictionaryBlocks;
+	for (int index = 0; index < m_columns.size(); index++) {
+		const Column &column = m_columns[index];
+		if (column.type != ColumnDictionary) {
+			continue;
+		}
+		QByteArray              body;
+		QVector<ArrowBuffer>    buffers;
+		QVector<ArrowFieldNode> nodes;
+		nodes.append(FieldNode(column.dictionaryIndex.size()));
+		AddBuffer(body, buffers, QByteArray());
+		AddBuffer(body, buffers, column.dictionaryOffsets);
+		AddBuffer(body, buffers, column.dictionary);
+
+		ArrowFlatBuilder builder;
+		const quint32 data = BuildRecordBatch(builder, column.dictionaryIndex.size(), nodes, buffers);
+		builder.StartTable();
+		builder.AddScalar<qint64>(0, index);
+		builder.AddOffset(1, data);
+		builder.AddScalar<quint8>(2, false);
+		const quint32 batch = builder.EndTable();
+		dictionaryBlocks.append(AppendMessage(file,
+				BuildMessage(builder, ArrowHeaderDictionaryBatch, batch, body.size()), body));
+	}
+
+	QByteArray              body;
+	QVector<ArrowBuffer>    buffers;
+	QVector<ArrowFieldNode> nodes;
+	for (int index = 0; index < m_columns.size(); index++) {
+		const Column &column = m_columns[index];
+		nodes.append(FieldNode(column.rowCount));
+		AddBuffer(body, buffers, QByteArray());
+		if (column.type == ColumnString) {
+			AddBuffer(body, buffers, column.offsets);
+		}
+		AddBuffer(body, buffers, column.values);
+	}
+	QVector<ArrowBlock> batchBlocks;
+	{
+		ArrowFlatBuilder builder;
+		const quint32 batch = BuildRecordBatch(builder, RowCount(), nodes, buffers);
+		batchBlocks.append(AppendMessage(file, BuildMessage(builder, ArrowHeaderRecordBatch, batch, body.size()), body));
+	}
+
+	ArrowFlatBuilder builder;
+	const quint32 schema       = BuildSchema(builder);
+	const quint32 dictionaries = builder.CreateStructVector(dictionaryBlocks);
+	const quint32 batches      = builder.CreateStructVector(batchBlocks);
+	builder.StartTable();
+	builder.AddOffset(1, schema);
+	builder.AddOffset(2, dictionaries);
+	builder.AddOffset(3, batches);
+	builder.AddScalar<qint16>(0, ArrowMetadataV5);
+	const QByteArray footer       = builder.Finish(builder.EndTable());
+	const qint32     footerLength = footer.size();
+	file.append(footer);
+	file.append(reinterpret_cast<const char*>(&footerLength), sizeof(footerLength));
+	file.append("ARROW1", 6);
+
+	QFile output(fileName);
+	if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate) || (output.write(file) != file.size())) {
+		m_error = QString("Cannot write %1: %2").arg(fileName, output.errorString());
+		return false;
+	}
+	return true;
+}
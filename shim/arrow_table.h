@@ -0,0 +1,67 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef ARROW_TABLE_H
+#define ARROW_TABLE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class ArrowFlatBuilder;
+
+//----------------------------------------------------------------------------
+// Builds a table a row at a time and writes it as an Apache Arrow IPC file,
+// which pandas, DuckDB, Spark and the Arrow libraries read directly.  Only
+// the few column types the shim needs are supported, none of them nullable,
+// and the whole table is written as a single record batch, so the format's
+// metadata is encoded here rather than pulling in the Arrow libraries.
+class ArrowTable
+{
+public:
+	enum ColumnType {
+		ColumnDictionary,  // UTF-8 strings, dictionary encoded
+		ColumnString,      // UTF-8 strings
+		ColumnTimestamp,   // Microseconds since the epoch, in UTC
+		ColumnUInt32,
+		ColumnUInt64,
+	};
+
+	ArrowTable(void);
+
+	int     AddColumn(const QByteArray &name, const ColumnType type);
+	void    Append(const int column, const quint64 value);
+	void    Append(const int column, const QByteArray &value);
+	void    Clear(void);
+	QString Error(void) const { return m_error; }
+	quint32 RowCount(void) const;
+	bool    Write(const QString &fileName);
+
+private:
+	struct Column {
+		QByteArray                dictionary;     // Dictionary values, back to back
+		QHash<QByteArray, qint32> dictionaryIndex;
+		QByteArray                dictionaryOffsets;
+		QByteArray                name;
+		QByteArray                offsets;        // Start of each string, then the end
+		quint32                   rowCount;
+		ColumnType                type;
+		QByteArray                values;         // Fixed width values, indices or string data
+	};
+
+	quint32 BuildSchema(ArrowFlatBuilder &builder) const;
+
+	QVector<Column> m_columns;
+	QString         m_error;
+};
+
+#endif // ARROW_TABLE_H
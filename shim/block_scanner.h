@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef BLOCK_SCANNER_H
+#define BLOCK_SCANNER_H
+
+#include <QVector>
+
+#include "hone_pcapng.h"
+#include "traffic_top.h"
+
+// ScanBlocks, and the stages that need nothing from the shim, come from the
+// capture library's pcapng_blocks.h.  These stages work on the shim's state.
+
+//----------------------------------------------------------------------------
+// Follows the time of the packets, in microseconds, when reading saved
+// captures
+class ClockBlockStage
+{
+public:
+	explicit ClockBlockStage(quint64 &clock) : m_clock(&clock) {}
+
+	void Block(const PcapNgBlockHeader *header)
+	{
+		if ((header->blockType == PCAPNG_ENHANCED_PACKET_BLOCK) &&
+				(header->blockLength >= sizeof(PcapNgBlockHeader) + sizeof(PcapNgEnhancedPacketBody))) {
+			const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(header + 1);
+			*m_clock = (static_cast<quint64>(packet->timestampHigh) << 32) | packet->timestampLow;
+		}
+	}
+
+private:
+	quint64 *m_clock;
+};
+
+//----------------------------------------------------------------------------
+// Notes the timestamp of each packet, for tracking how long packets take to
+// reach the file
+class LatencyBlockStage
+{
+public:
+	LatencyBlockStage(QVector<quint64> &timestamps, int &count)
+		: m_count(&count), m_size(timestamps.size()), m_timestamps(timestamps.data()) {}
+
+	void Block(const PcapNgBlockHeader *header)
+	{
+		if ((header->blockType == PCAPNG_ENHANCED_PACKET_BLOCK) &&
+				(header->blockLength >= sizeof(PcapNgBlockHeader) + sizeof(PcapNgEnhancedPacketBody)) &&
+				(*m_count < m_size)) {
+			const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(header + 1);
+			m_timestamps[(*m_count)++] = (static_cast<quint64>(packet->timestampHigh) << 32) | packet->timestampLow;
+		}
+	}
+
+private:
+	int     *m_count;
+	int      m_size;
+	quint64 *m_timestamps;
+};
+
+//----------------------------------------------------------------------------
+// Totals the traffic of each process for --top
+class TopBlockStage
+{
+public:
+	explicit TopBlockStage(TrafficTop &trafficTop) : m_trafficTop(&trafficTop) {}
+
+	void Block(const PcapNgBlockHeader *header)
+	{
+		m_trafficTop->Add(reinterpret_cast<const char*>(header), header->blockLength);
+	}
+
+private:
+	TrafficTop *m_trafficTop;
+};
+
+#endif // BLOCK_SCANNER_H
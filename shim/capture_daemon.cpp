@@ -0,0 +1,255 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "capture_daemon.h"
+#include "hone_pcapng.h"
+
+// Drop a client that falls this far behind rather than stalling the others
+const int CaptureDaemon::m_maxPendingBytes = 64 * 1024 * 1024;
+
+//-----------------------------------------------------------------------------
+CaptureDaemon::CaptureDaemon(const qint64 maxBacklogBytes)
+	: m_backlogBytes(0)
+	, m_listenHandle(-1)
+	, m_maxBacklogBytes(maxBacklogBytes)
+{
+}
+
+//-----------------------------------------------------------------------------
+CaptureDaemon::~CaptureDaemon(void)
+{
+	while (!m_clients.isEmpty()) {
+		Drop(0);
+	}
+	if (m_listenHandle != -1) {
+		::close(m_listenHandle);
+		::unlink(m_socketName.toLocal8Bit().data());
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDaemon::Accept(void)
+{
+	const int handle = ::accept(m_listenHandle, NULL, NULL);
+	if (handle == -1) {
+		if ((errno == EAGAIN) || (errno == EINTR) || (errno == ECONNABORTED)) {
+			return true;
+		}
+		m_error = QString("Cannot accept client on %1: %2").arg(m_socketName, strerror(errno));
+		return false;
+	}
+
+	// Wait watches the clients with select, which can't take this handle, so
+	// turn the client away rather than overrun the descriptor sets
+	if (handle >= FD_SETSIZE) {
+		::close(handle);
+		return true;
+	}
+	::fcntl(handle, F_SETFL, O_NONBLOCK);
+
+	// Describe everything the client missed, then catch it up on the backlog
+	Client client;
+	client.handle  = handle;
+	client.pending = m_sectionHeaders;
+	QByteArray snapshot;
+	m_processTable.Snapshot(snapshot);
+	client.pending.append(snapshot);
+	foreach (const QByteArray &chunk, m_backlog) {
+		client.pending.append(chunk);
+	}
+	m_clients.append(client);
+	Flush(m_clients.size() - 1);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureDaemon::Drop(const int index)
+{
+	::close(m_clients.at(index).handle);
+	m_clients.removeAt(index);
+}
+
+//-----------------------------------------------------------------------------
+QString CaptureDaemon::Error(void) const
+{
+	return m_error;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureDaemon::Flush(const int index)
+{
+	Client &client = m_clients[index];
+	if (client.pending.isEmpty()) {
+		return;
+	}
+	const ssize_t bytesSent = ::send(client.handle, client.pending.constData(), client.pending.size(), MSG_NOSIGNAL);
+	if (bytesSent > 0) {
+		client.pending.remove(0, bytesSent);
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDaemon::Listen(const QString &socketName, const QString &groupName)
+{
+	struct sockaddr_un address;
+	const QByteArray   path = socketName.toLocal8Bit();
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= static_cast<int>(sizeof(address.sun_path))) {
+		m_error = QString("Socket name %1 is too long").arg(socketName);
+		return false;
+	}
+	strcpy(address.sun_path, path.data());
+
+	gid_t groupId = static_cast<gid_t>(-1);
+	if (!groupName.isEmpty()) {
+		const struct group *group = ::getgrnam(groupName.toLocal8Bit().data());
+		if (!group) {
+			m_error = QString("Unknown group %1").arg(groupName);
+			return false;
+		}
+		groupId = group->gr_gid;
+	}
+
+	m_listenHandle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listenHandle == -1) {
+		m_error = QString("Cannot create socket: %1").arg(strerror(errno));
+		return false;
+	}
+
+	// The capture shows every process's traffic, so only the daemon's user,
+	// and the group if one is given, may connect.  Bind leaves the socket
+	// with whatever mode the umask allows, so it is narrowed before listen,
+	// while connecting is still refused.
+	::unlink(path.data()); // Remove a stale socket from an earlier daemon
+	if ((::bind(m_listenHandle, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) ||
+			(::chown(path.data(), static_cast<uid_t>(-1), groupId) == -1) ||
+			(::chmod(path.data(), groupName.isEmpty() ? 0600 : 0660) == -1) ||
+			(::listen(m_listenHandle, 16) == -1)) {
+		m_error = QString("Cannot listen on %1: %2").arg(socketName, strerror(errno));
+		::close(m_listenHandle);
+		m_listenHandle = -1;
+		return false;
+	}
+	::fcntl(m_listenHandle, F_SETFL, O_NONBLOCK);
+	m_socketName = socketName;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureDaemon::Publish(const char *data, const quint32 length)
+{
+	// The data must hold only complete blocks.  Section headers are kept aside
+	// for new clients, and everything else goes into the backlog.
+	quint32 offset = 0;
+	while (offset < length) {
+		const PcapNgBlockHeader *header      = reinterpret_cast<const PcapNgBlockHeader*>(data + offset);
+		const quint32            blockLength = PcapNgBlockLength(data + offset, length - offset);
+		if (!blockLength) {
+			break;
+		}
+		if (header->blockType == PCAPNG_SECTION_HEADER_BLOCK) {
+			m_sectionHeaders = QByteArray(data + offset, blockLength);
+		} else if (header->blockType == PCAPNG_INTERFACE_DESC_BLOCK) {
+			m_sectionHeaders.append(data + offset, blockLength);
+		} else {
+			break;
+		}
+		offset += blockLength;
+	}
+	if (offset < length) {
+		m_backlog.enqueue(QByteArray(data + offset, length - offset));
+		m_backlogBytes += length - offset;
+	}
+
+	// Fold the oldest backlog into the process table, so the snapshot for a
+	// new client plus the backlog still describe everything
+	while (m_backlogBytes > m_maxBacklogBytes) {
+		const QByteArray chunk = m_backlog.dequeue();
+		m_processTable.Update(chunk.constData(), chunk.size());
+		m_backlogBytes -= chunk.size();
+	}
+
+	for (int index = m_clients.size() - 1; index >= 0; index--) {
+		if (m_clients.at(index).pending.size() > m_maxPendingBytes) {
+			Drop(index);
+			continue;
+		}
+		m_clients[index].pending.append(data, length);
+		Flush(index);
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDaemon::Wait(const int driverHandle, const int interruptHandle, const bool block)
+{
+	fd_set readfds;
+	fd_set writefds;
+	int    maxHandle = qMax(qMax(driverHandle, interruptHandle), m_listenHandle);
+
+	// The interrupt handle only has to end the wait, so the caller can see
+	// that it is time to stop
+	FD_ZERO(&readfds);
+	FD_ZERO(&writefds);
+	FD_SET(driverHandle, &readfds);
+	FD_SET(m_listenHandle, &readfds);
+	if (interruptHandle != -1) {
+		FD_SET(interruptHandle, &readfds);
+	}
+	foreach (const Client &client, m_clients) {
+		FD_SET(client.handle, &readfds);
+		if (!client.pending.isEmpty()) {
+			FD_SET(client.handle, &writefds);
+		}
+		maxHandle = qMax(maxHandle, client.handle);
+	}
+
+	struct timeval noWait = { 0, 0 };
+	if (-1 == ::select(maxHandle + 1, &readfds, &writefds, NULL, block ? NULL : &noWait)) {
+		if (errno == EINTR) {
+			return true;
+		}
+		m_error = QString("Cannot wait for the driver or clients: %1").arg(strerror(errno));
+		return false;
+	}
+
+	for (int index = m_clients.size() - 1; index >= 0; index--) {
+		const int handle = m_clients.at(index).handle;
+		if (FD_ISSET(handle, &readfds)) {
+			// Clients never send data, so this is a disconnect
+			char    buffer[64];
+			const ssize_t bytesRead = ::recv(handle, buffer, sizeof(buffer), 0);
+			if ((bytesRead == 0) || ((bytesRead == -1) && (errno != EAGAIN) && (errno != EINTR))) {
+				Drop(index);
+				continue;
+			}
+		}
+		if (FD_ISSET(handle, &writefds)) {
+			Flush(index);
+		}
+	}
+
+	if (FD_ISSET(m_listenHandle, &readfds)) {
+		return Accept();
+	}
+	return true;
+}
@@ -0,0 +1,59 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef CAPTURE_DAEMON_H
+#define CAPTURE_DAEMON_H
+
+#include <QByteArray>
+#include <QList>
+#include <QQueue>
+#include <QString>
+
+#include "process_table.h"
+
+//----------------------------------------------------------------------------
+// Shares one driver reader with any number of local clients over a Unix
+// socket.  New clients get the section headers, the known processes and
+// connections, and the recent backlog, followed by the live stream.
+class CaptureDaemon
+{
+public:
+	CaptureDaemon(const qint64 maxBacklogBytes);
+	~CaptureDaemon(void);
+
+	QString Error(void) const;
+	bool    Listen(const QString &socketName, const QString &groupName);
+	void    Publish(const char *data, const quint32 length);
+	bool    Wait(const int driverHandle, const int interruptHandle, const bool block);
+
+private:
+	struct Client {
+		int        handle;
+		QByteArray pending;
+	};
+
+	bool Accept(void);
+	void Drop(const int index);
+	void Flush(const int index);
+
+	QQueue<QByteArray>    m_backlog;
+	qint64                m_backlogBytes;
+	QList<Client>         m_clients;
+	QString               m_error;
+	int                   m_listenHandle;
+	static const int      m_maxPendingBytes;
+	const qint64          m_maxBacklogBytes;
+	ProcessTable          m_processTable;
+	QByteArray            m_sectionHeaders;
+	QString               m_socketName;
+};
+
+#endif // CAPTURE_DAEMON_H
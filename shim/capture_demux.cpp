@@ -0,0 +1,242 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QDir>
+
+#include "capture_demux.h"
+#include "hone_pcapng.h"
+
+// Write each file's blocks once this much has built up
+const int CaptureDemux::m_maxBufferSize = 64 * 1024;
+
+// Well under the usual limit of 1024 open files per process
+const int CaptureDemux::m_maxOpenFiles = 256;
+
+//-----------------------------------------------------------------------------
+CaptureDemux::CaptureDemux(void)
+	: m_mode(ModeProcess)
+	, m_useCount(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+CaptureDemux::~CaptureDemux(void)
+{
+	Close();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Announce(const quint32 key, const quint32 processId, const quint32 connectionId)
+{
+	// A new file starts with the section headers, the process and the
+	// connection of its first packet
+	QSet<quint32> &files = (m_mode == ModeProcess) ? m_announcedProcesses : m_announcedConnections;
+	if (!files.contains(key)) {
+		QByteArray blocks = m_sectionHeaders;
+		blocks.append(m_processTable.Process(processId));
+		if (connectionId) {
+			blocks.append(m_processTable.Connection(connectionId));
+		}
+		if (!Append(key, blocks.constData(), blocks.size())) {
+			return false;
+		}
+		files.insert(key);
+		if (connectionId) {
+			m_announcedConnections.insert(connectionId);
+		}
+		return true;
+	}
+
+	// Each later connection of a process is described before its first packet
+	if (connectionId && !m_announcedConnections.contains(connectionId)) {
+		const QByteArray connection = m_processTable.Connection(connectionId);
+		if (!Append(key, connection.constData(), connection.size())) {
+			return false;
+		}
+		m_announcedConnections.insert(connectionId);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Append(const quint32 key, const char *block, const quint32 length)
+{
+	OutputHash::iterator iter = m_outputs.find(key);
+	if (iter == m_outputs.end()) {
+		if ((m_outputs.size() >= m_maxOpenFiles) && !Evict()) {
+			return false;
+		}
+
+		// Files that were closed to make room are reopened where they left off
+		const QSet<quint32> &files = (m_mode == ModeProcess) ? m_announcedProcesses : m_announcedConnections;
+		Output output;
+		output.file    = new QFile(QString("%1/%2_%3.pcapng").arg(m_dirName,
+				(m_mode == ModeProcess) ? "pid" : "connection").arg(key));
+		output.lastUse = 0;
+		if (!output.file->open(QIODevice::WriteOnly | QIODevice::Unbuffered |
+				(files.contains(key) ? QIODevice::Append : QIODevice::Truncate))) {
+			m_error = QString("Cannot open %1 for writing: %2").arg(output.file->fileName(), output.file->errorString());
+			delete output.file;
+			return false;
+		}
+		iter = m_outputs.insert(key, output);
+	}
+
+	iter->lastUse = m_useCount++;
+	iter->buffer.append(block, length);
+	if (iter->buffer.size() >= m_maxBufferSize) {
+		return Flush(*iter);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Close(void)
+{
+	bool rc = true;
+	for (OutputHash::iterator iter = m_outputs.begin(); iter != m_outputs.end(); ++iter) {
+		if (!Flush(*iter)) {
+			rc = false;
+		}
+		delete iter->file;
+	}
+	m_outputs.clear();
+	return rc;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Evict(void)
+{
+	// Close the least recently used file.  Only done when a file has to be
+	// opened, which costs far more than the scan.
+	OutputHash::iterator oldest = m_outputs.begin();
+	for (OutputHash::iterator iter = m_outputs.begin(); iter != m_outputs.end(); ++iter) {
+		if (iter->lastUse < oldest->lastUse) {
+			oldest = iter;
+		}
+	}
+	const bool rc = Flush(*oldest);
+	delete oldest->file;
+	m_outputs.erase(oldest);
+	return rc;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Flush(Output &output)
+{
+	if (output.buffer.isEmpty()) {
+		return true;
+	}
+	if (output.file->write(output.buffer) != output.buffer.size()) {
+		m_error = QString("Cannot write %L1 bytes to %2: %3").arg(output.buffer.size())
+				.arg(output.file->fileName(), output.file->errorString());
+		return false;
+	}
+	output.buffer.resize(0);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Open(const Mode mode, const QString &dirName)
+{
+	m_mode    = mode;
+	m_dirName = dirName;
+	if (!QDir().mkpath(dirName)) {
+		m_error = QString("Cannot create directory %1").arg(dirName);
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::Write(const char *data, const quint32 length)
+{
+	// The data must hold only complete blocks
+	quint32 offset = 0;
+	while (offset < length) {
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + offset);
+		if (!PcapNgBlockLength(data + offset, length - offset)) {
+			break;
+		}
+
+		// Process and connection blocks are kept for files that don't exist
+		// yet, and passed on to the files that already describe them.  End
+		// events carry the negated ID, and go to the same file as the start.
+		const char *block = data + offset;
+		const char *body  = block + sizeof(PcapNgBlockHeader);
+		switch (header->blockType) {
+		case PCAPNG_SECTION_HEADER_BLOCK:
+			m_sectionHeaders = QByteArray(block, header->blockLength);
+			break;
+		case PCAPNG_INTERFACE_DESC_BLOCK:
+			m_sectionHeaders.append(block, header->blockLength);
+			break;
+		case HONE_PROCESS_EVENT_BLOCK:
+			m_processTable.Update(block, header->blockLength);
+			if ((m_mode == ModeProcess) && (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneProcessEventBody))) {
+				const HoneProcessEventBody *process   = reinterpret_cast<const HoneProcessEventBody*>(body);
+				const quint32               processId = HoneEventId(process->processId);
+				if (m_announcedProcesses.contains(processId) && !Append(processId, block, header->blockLength)) {
+					return false;
+				}
+			}
+			break;
+		case HONE_CONNECTION_EVENT_BLOCK:
+			m_processTable.Update(block, header->blockLength);
+			if (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneConnectionEventBody)) {
+				const HoneConnectionEventBody *connection   = reinterpret_cast<const HoneConnectionEventBody*>(body);
+				const quint32                  connectionId = HoneEventId(connection->connectionId);
+				if (m_announcedConnections.contains(connectionId) &&
+						!Append((m_mode == ModeProcess) ? HoneEventId(connection->processId) : connectionId,
+						block, header->blockLength)) {
+					return false;
+				}
+			}
+			break;
+		case PCAPNG_ENHANCED_PACKET_BLOCK:
+			if ((header->blockLength >= PCAPNG_MIN_PACKET_BLOCK_LENGTH) && !WritePacket(block, header->blockLength)) {
+				return false;
+			}
+			break;
+		default:
+			break;
+		}
+		offset += header->blockLength;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureDemux::WritePacket(const char *block, const quint32 length)
+{
+	const char *options;
+	quint32     optionsLength;
+	quint32     connectionId = 0;
+	quint32     processId    = 0;
+	PcapNgPacketOptions(block, length, options, optionsLength);
+	PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_CONNECTION_ID, connectionId);
+	PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_PROCESS_ID, processId);
+
+	// A connection's packets belong to the process that opened it
+	if (!processId && connectionId) {
+		const QByteArray connection = m_processTable.Connection(connectionId);
+		if (connection.size() >= static_cast<int>(PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneConnectionEventBody))) {
+			processId = reinterpret_cast<const HoneConnectionEventBody*>(connection.constData() + sizeof(PcapNgBlockHeader))->processId;
+		}
+	}
+
+	// Packets the driver couldn't attribute have no file to go to
+	const quint32 key = (m_mode == ModeProcess) ? processId : connectionId;
+	if (!key) {
+		return true;
+	}
+	return Announce(key, processId, connectionId) && Append(key, block, length);
+}
@@ -0,0 +1,73 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef CAPTURE_DEMUX_H
+#define CAPTURE_DEMUX_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+#include "process_table.h"
+
+//----------------------------------------------------------------------------
+// Splits the capture into a file for each process or each connection as it
+// is written.  A file is created when its first packet arrives, and starts
+// with the section headers and the process and connection blocks that
+// describe its packets.  Only a limited number of files are kept open,
+// closing the least recently used one to make room, and each open file
+// buffers its blocks so they reach the disk in large writes.
+class CaptureDemux
+{
+public:
+	enum Mode {
+		ModeConnection,  // One file per Hone connection
+		ModeProcess,     // One file per process
+	};
+
+	CaptureDemux(void);
+	~CaptureDemux(void);
+
+	bool    Close(void);
+	QString Error(void) const { return m_error; }
+	bool    Open(const Mode mode, const QString &dirName);
+	bool    Write(const char *data, const quint32 length);
+
+private:
+	struct Output {
+		QByteArray buffer;
+		QFile     *file;
+		quint64    lastUse;
+	};
+	typedef QHash<quint32, Output> OutputHash;
+
+	bool Announce(const quint32 key, const quint32 processId, const quint32 connectionId);
+	bool Append(const quint32 key, const char *block, const quint32 length);
+	bool Evict(void);
+	bool Flush(Output &output);
+	bool WritePacket(const char *block, const quint32 length);
+
+	QSet<quint32>        m_announcedConnections;
+	QSet<quint32>        m_announcedProcesses;
+	QString              m_dirName;
+	QString              m_error;
+	static const int     m_maxBufferSize;
+	static const int     m_maxOpenFiles;
+	Mode                 m_mode;
+	OutputHash           m_outputs;
+	ProcessTable         m_processTable;
+	QByteArray           m_sectionHeaders;
+	quint64              m_useCount;
+};
+
+#endif // CAPTURE_DEMUX_H
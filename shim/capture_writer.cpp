@@ -0,0 +1,195 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "capture_writer.h"
+#include "hone_probes.h"
+
+// Block the capture loop once this much data is waiting for the disk
+const quint32 CaptureWriter::m_maxQueuedBytes = 64 * 1024 * 1024;
+
+//-----------------------------------------------------------------------------
+CaptureWriter::CaptureWriter(QObject *parent)
+	: QThread(parent)
+	, m_busy(false)
+	, m_latency(NULL)
+	, m_queuedBytes(0)
+	, m_stop(false)
+{
+}
+
+//-----------------------------------------------------------------------------
+CaptureWriter::~CaptureWriter(void)
+{
+	Stop();
+	qDeleteAll(m_freeChunks);
+	qDeleteAll(m_queue);
+}
+
+//-----------------------------------------------------------------------------
+quint32 CaptureWriter::Backlog(void)
+{
+	// Percentage of the queue that is full
+	QMutexLocker locker(&m_mutex);
+	return static_cast<quint64>(m_queuedBytes) * 100 / m_maxQueuedBytes;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureWriter::Close(void)
+{
+	QMutexLocker locker(&m_mutex);
+	if (!WaitForIdle()) {
+		return false;
+	}
+	m_file.close();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+std::string CaptureWriter::Error(void) const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_error.toStdString();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureWriter::Open(const std::string &fileName)
+{
+	QMutexLocker locker(&m_mutex);
+
+	// Finish the previous file first, which normally completed long ago since
+	// the other writers took their turns in the meantime
+	if (!WaitForIdle()) {
+		return false;
+	}
+	m_file.close();
+	m_file.setFileName(QFile::decodeName(fileName.c_str()));
+	if (!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Unbuffered)) {
+		m_error = QString("Cannot open %1 for writing: %2").arg(m_file.fileName(), m_file.errorString());
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::run(void)
+{
+	QMutexLocker locker(&m_mutex);
+	for (;;) {
+		while (m_queue.isEmpty() && !m_stop) {
+			m_chunkQueued.wait(&m_mutex);
+		}
+		if (m_queue.isEmpty()) {
+			break;
+		}
+
+		Chunk *chunk = m_queue.dequeue();
+		m_busy = true;
+		locker.unlock();
+
+		QString error;
+		HONE_PROBE1(file_write_start, chunk->length);
+		const qint64 bytesWritten = m_file.write(chunk->data.constData(), chunk->length);
+		HONE_PROBE1(file_write_done, chunk->length);
+		if (bytesWritten == -1) {
+			error = QString("Cannot write %L1 bytes to %2: %3").arg(chunk->length)
+					.arg(m_file.fileName(), m_file.errorString());
+		} else if (bytesWritten != chunk->length) {
+			error = QString("Only wrote %L1 of %L2 bytes to %3").arg(bytesWritten).arg(chunk->length)
+					.arg(m_file.fileName());
+		} else {
+			HONE_PROBE0(file_flush_start);
+			const bool flushed = m_file.flush();
+			HONE_PROBE0(file_flush_done);
+			if (!flushed) {
+				error = QString("Cannot flush %1: %2").arg(m_file.fileName(), m_file.errorString());
+			} else {
+				// Only tell Wireshark about the packets once they are in the file
+				if (m_latency && chunk->timestampCount) {
+					m_latency->Record(chunk->timestamps.constData(), chunk->timestampCount, LatencyHistogram::Now());
+				}
+				emit Written(chunk->packetCount);
+			}
+		}
+
+		locker.relock();
+		m_busy         = false;
+		m_queuedBytes -= chunk->length;
+		m_freeChunks.append(chunk);
+		if (!error.isEmpty() && m_error.isEmpty()) {
+			m_error = error;
+		}
+		m_chunkWritten.wakeAll();
+	}
+}
+
+//-----------------------------------------------------------------------------
+void CaptureWriter::Stop(void)
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		m_stop = true;
+		m_chunkQueued.wakeAll();
+	}
+	wait();
+	m_file.close();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureWriter::WaitForIdle(void)
+{
+	// Caller must hold m_mutex
+	while ((m_busy || !m_queue.isEmpty()) && m_error.isEmpty()) {
+		m_chunkWritten.wait(&m_mutex);
+	}
+	return m_error.isEmpty();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureWriter::Write(const char *data, const quint32 length, const quint32 packetCount)
+{
+	return Write(data, length, packetCount, NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureWriter::Write(const char *data, const quint32 length, const quint32 packetCount,
+		const quint64 *timestamps, const int timestampCount)
+{
+	QMutexLocker locker(&m_mutex);
+	while ((m_queuedBytes >= m_maxQueuedBytes) && m_error.isEmpty()) {
+		m_chunkWritten.wait(&m_mutex);
+	}
+	if (!m_error.isEmpty()) {
+		return false;
+	}
+
+	// The caller reuses its buffer, so the data still has to be copied, but
+	// into a chunk that already has room for it
+	Chunk *chunk = m_freeChunks.isEmpty() ? new Chunk : m_freeChunks.takeLast();
+	if (static_cast<quint32>(chunk->data.size()) < length) {
+		chunk->data.resize(length);
+	}
+	::memcpy(chunk->data.data(), data, length);
+	chunk->length         = length;
+	chunk->packetCount    = packetCount;
+	chunk->timestampCount = timestampCount;
+	if (chunk->timestamps.size() < timestampCount) {
+		chunk->timestamps.resize(timestampCount);
+	}
+	if (timestampCount) {
+		::memcpy(chunk->timestamps.data(), timestamps, timestampCount * sizeof(quint64));
+	}
+	m_queue.enqueue(chunk);
+	m_queuedBytes += length;
+	m_chunkQueued.wakeOne();
+	return true;
+}
@@ -0,0 +1,79 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef CAPTURE_WRITER_H
+#define CAPTURE_WRITER_H
+
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "capture_sink.h"
+#include "latency_histogram.h"
+
+//----------------------------------------------------------------------------
+// Writes capture data for one output directory on its own thread, so a slow
+// disk only stalls the files that live on it
+class CaptureWriter : public QThread, public CaptureSink
+{
+	Q_OBJECT
+
+public:
+	explicit CaptureWriter(QObject *parent = 0);
+	~CaptureWriter(void);
+
+	quint32 Backlog(void);
+	bool Close(void);
+	std::string Error(void) const;
+	bool Open(const std::string &fileName);
+	void SetLatencyHistogram(LatencyHistogram *latency) { m_latency = latency; }
+	void Stop(void);
+	bool Write(const char *data, const quint32 length, const quint32 packetCount);
+	bool Write(const char *data, const quint32 length, const quint32 packetCount,
+			const quint64 *timestamps, const int timestampCount);
+
+signals:
+	void Written(quint32 packetCount);
+
+protected:
+	void run(void);
+
+private:
+	// Chunks are recycled once written, and keep their buffers, so the
+	// capture loop stops allocating once enough of them are in flight
+	struct Chunk {
+		QByteArray       data;           // Sized to the largest write so far
+		quint32          length;
+		quint32          packetCount;
+		int              timestampCount;
+		QVector<quint64> timestamps;
+	};
+
+	bool WaitForIdle(void);
+
+	bool                 m_busy;
+	QWaitCondition       m_chunkQueued;
+	QWaitCondition       m_chunkWritten;
+	QFile                m_file;
+	QString              m_error;
+	QList<Chunk*>        m_freeChunks;
+	LatencyHistogram    *m_latency;
+	static const quint32 m_maxQueuedBytes;
+	mutable QMutex       m_mutex;
+	QQueue<Chunk*>       m_queue;
+	quint32              m_queuedBytes;
+	bool                 m_stop;
+};
+
+#endif // CAPTURE_WRITER_H
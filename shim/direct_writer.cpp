@@ -0,0 +1,263 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QFile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "direct_writer.h"
+#include "hone_probes.h"
+
+// O_DIRECT needs the buffer address, file offset and length to be multiples
+// of the logical block size, which is at most 4 KiB on current disks
+const quint32 DirectWriter::m_alignment  = 4096;
+const quint32 DirectWriter::m_bufferSize = 1024 * 1024;
+
+//-----------------------------------------------------------------------------
+DirectWriter::DirectWriter(QObject *parent)
+	: QThread(parent)
+	, m_directHandle(-1)
+	, m_fill(0)
+	, m_inFlight(-1)
+	, m_stop(false)
+{
+	for (int index = 0; index < 2; index++) {
+		void *data = NULL;
+		if (::posix_memalign(&data, m_alignment, m_bufferSize) != 0) {
+			data = NULL;
+		}
+		m_buffers[index].data        = static_cast<char*>(data);
+		m_buffers[index].length      = 0;
+		m_buffers[index].offset      = 0;
+		m_buffers[index].packetCount = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+DirectWriter::~DirectWriter(void)
+{
+	Stop();
+	::free(m_buffers[0].data);
+	::free(m_buffers[1].data);
+}
+
+//-----------------------------------------------------------------------------
+bool DirectWriter::Close(void)
+{
+	if (m_directHandle == -1) {
+		return true;
+	}
+
+	const bool rc = WriteTail();
+	::close(m_directHandle);
+	m_directHandle = -1;
+	return rc;
+}
+
+//-----------------------------------------------------------------------------
+std::string DirectWriter::Error(void) const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_error.toStdString();
+}
+
+//-----------------------------------------------------------------------------
+bool DirectWriter::Open(const std::string &fileName)
+{
+	if (!Close()) {
+		return false;
+	}
+
+	QMutexLocker locker(&m_mutex);
+	if (!m_buffers[0].data || !m_buffers[1].data) {
+		m_error = "Cannot allocate aligned buffers for direct I/O";
+		return false;
+	}
+
+	// Not every file system supports O_DIRECT (tmpfs doesn't), so fall back
+	// to ordinary writes of the same aligned buffers
+	m_fileName     = QFile::decodeName(fileName.c_str());
+	m_directHandle = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if ((m_directHandle == -1) && (errno == EINVAL)) {
+		m_directHandle = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (m_directHandle == -1) {
+		m_error = QString("Cannot open %1 for writing: %2").arg(m_fileName, strerror(errno));
+		return false;
+	}
+
+	m_fill = 0;
+	for (int index = 0; index < 2; index++) {
+		m_buffers[index].length      = 0;
+		m_buffers[index].offset      = 0;
+		m_buffers[index].packetCount = 0;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void DirectWriter::run(void)
+{
+	QMutexLocker locker(&m_mutex);
+	for (;;) {
+		while ((m_inFlight == -1) && !m_stop) {
+			m_submitted.wait(&m_mutex);
+		}
+		if (m_inFlight == -1) {
+			break;
+		}
+
+		Buffer &buffer = m_buffers[m_inFlight];
+		locker.unlock();
+
+		// Full buffers only, so the length is always aligned
+		QString error;
+		quint32 written = 0;
+		HONE_PROBE1(file_write_start, buffer.length);
+		while (written < buffer.length) {
+			const ssize_t bytesWritten = ::pwrite(m_directHandle, buffer.data + written,
+					buffer.length - written, buffer.offset + written);
+			if (bytesWritten == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				error = QString("Cannot write %L1 bytes to %2: %3").arg(buffer.length - written)
+						.arg(m_fileName, strerror(errno));
+				break;
+			}
+			written += bytesWritten;
+		}
+		HONE_PROBE1(file_write_done, written);
+		if (error.isEmpty()) {
+			emit Written(buffer.packetCount);
+		}
+
+		locker.relock();
+		if (!error.isEmpty() && m_error.isEmpty()) {
+			m_error = error;
+		}
+		m_inFlight = -1;
+		m_written.wakeAll();
+	}
+}
+
+//-----------------------------------------------------------------------------
+void DirectWriter::Stop(void)
+{
+	Close();
+	{
+		QMutexLocker locker(&m_mutex);
+		m_stop = true;
+		m_submitted.wakeAll();
+	}
+	wait();
+}
+
+//-----------------------------------------------------------------------------
+bool DirectWriter::Submit(void)
+{
+	QMutexLocker locker(&m_mutex);
+
+	// Only one write in flight, so this waits when the disk falls behind
+	if (!WaitForIdle()) {
+		return false;
+	}
+	m_inFlight = m_fill;
+	m_submitted.wakeOne();
+
+	const Buffer &full = m_buffers[m_fill];
+	m_fill = 1 - m_fill;
+	m_buffers[m_fill].length      = 0;
+	m_buffers[m_fill].offset      = full.offset + full.length;
+	m_buffers[m_fill].packetCount = 0;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool DirectWriter::WaitForIdle(void)
+{
+	// Caller must hold m_mutex
+	while ((m_inFlight != -1) && m_error.isEmpty()) {
+		m_written.wait(&m_mutex);
+	}
+	return m_error.isEmpty();
+}
+
+//-----------------------------------------------------------------------------
+bool DirectWriter::Write(const char *data, const quint32 length, const quint32 packetCount)
+{
+	// Packets are reported with the buffer that holds the end of their data
+	quint32 remaining = length;
+	while (remaining) {
+		Buffer       &buffer = m_buffers[m_fill];
+		const quint32 count  = qMin(remaining, m_bufferSize - buffer.length);
+		::memcpy(buffer.data + buffer.length, data, count);
+		buffer.length += count;
+		data          += count;
+		remaining     -= count;
+		if (!remaining) {
+			buffer.packetCount += packetCount;
+		}
+		if ((buffer.length == m_bufferSize) && !Submit()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool DirectWriter::WriteTail(void)
+{
+	QMutexLocker locker(&m_mutex);
+	if (!WaitForIdle()) {
+		return false;
+	}
+
+	// O_DIRECT can only write whole blocks, so pad the partly filled buffer
+	// out to one and cut the padding off again afterwards
+	Buffer &buffer = m_buffers[m_fill];
+	if (!buffer.length) {
+		return true;
+	}
+	const quint32 paddedLength = (buffer.length + m_alignment - 1) & ~(m_alignment - 1);
+	::memset(buffer.data + buffer.length, 0, paddedLength - buffer.length);
+	quint32 written = 0;
+	HONE_PROBE1(file_write_start, paddedLength);
+	while (written < paddedLength) {
+		const ssize_t bytesWritten = ::pwrite(m_directHandle, buffer.data + written,
+				paddedLength - written, buffer.offset + written);
+		if (bytesWritten == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			m_error = QString("Cannot write %L1 bytes to %2: %3").arg(paddedLength - written)
+					.arg(m_fileName, strerror(errno));
+			return false;
+		}
+		written += bytesWritten;
+	}
+	HONE_PROBE1(file_write_done, written);
+	if (::ftruncate(m_directHandle, buffer.offset + buffer.length) == -1) {
+		m_error = QString("Cannot truncate %1: %2").arg(m_fileName, strerror(errno));
+		return false;
+	}
+
+	const quint32 packetCount = buffer.packetCount;
+	buffer.length      = 0;
+	buffer.packetCount = 0;
+	locker.unlock();
+	emit Written(packetCount);
+	return true;
+}
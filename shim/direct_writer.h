@@ -0,0 +1,75 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef DIRECT_WRITER_H
+#define DIRECT_WRITER_H
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "capture_sink.h"
+
+//----------------------------------------------------------------------------
+// Writes the capture file with O_DIRECT so long captures don't push useful
+// data out of the page cache.  Blocks are gathered into aligned buffers, and
+// while the writer thread writes one buffer the capture loop fills the
+// other.  Only full buffers are written until the file is closed, when the
+// last one is padded out to the block size and the file is then truncated
+// to its real length, so Wireshark sees the packets a buffer at a time.
+class DirectWriter : public QThread, public CaptureSink
+{
+	Q_OBJECT
+
+public:
+	explicit DirectWriter(QObject *parent = 0);
+	~DirectWriter(void);
+
+	bool        Close(void);
+	std::string Error(void) const;
+	bool        Open(const std::string &fileName);
+	void        Stop(void);
+	bool        Write(const char *data, const quint32 length, const quint32 packetCount);
+
+signals:
+	void Written(quint32 packetCount);
+
+protected:
+	void run(void);
+
+private:
+	struct Buffer {
+		char   *data;
+		quint32 length;
+		qint64  offset;
+		quint32 packetCount;
+	};
+
+	bool Submit(void);
+	bool WaitForIdle(void);
+	bool WriteTail(void);
+
+	static const quint32 m_alignment;
+	Buffer               m_buffers[2];
+	static const quint32 m_bufferSize;
+	int                  m_directHandle;
+	QString              m_error;
+	QString              m_fileName;
+	int                  m_fill;
+	int                  m_inFlight;
+	mutable QMutex       m_mutex;
+	bool                 m_stop;
+	QWaitCondition       m_submitted;
+	QWaitCondition       m_written;
+};
+
+#endif // DIRECT_WRITER_H
@@ -0,0 +1,410 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "export_sink.h"
+
+// Cut the stream into batches of about this size
+const quint32 ExportSink::m_maxBatchBytes = 256 * 1024;
+
+// Drop new data rather than stall the capture once this much is waiting to
+// be sent or acked
+const quint32 ExportSink::m_maxQueuedBytes = 64 * 1024 * 1024;
+
+//-----------------------------------------------------------------------------
+ExportSink::ExportSink(const QString &target, const bool compress, QObject *parent)
+	: QThread(parent)
+	, m_ackedOffset(0)
+	, m_ackBufferLength(0)
+	, m_bytesDropped(0)
+	, m_compress(compress)
+	, m_queuedBytes(0)
+	, m_sendIndex(0)
+	, m_sendPartial(0)
+	, m_sessionId((static_cast<quint64>(QDateTime::currentMSecsSinceEpoch()) << 16) ^ ::getpid())
+	, m_socket(-1)
+	, m_stop(false)
+	, m_stopTimeout(0)
+	, m_target(target)
+	, m_writeOffset(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+ExportSink::~ExportSink(void)
+{
+	Stop(0);
+}
+
+//-----------------------------------------------------------------------------
+void ExportSink::Acknowledge(const quint64 offset)
+{
+	// Release every batch the collector has stored
+	quint32 released = 0;
+	while (!m_batches.isEmpty() && (m_batches.first().offset + m_batches.first().rawLength <= offset)) {
+		released += m_batches.first().rawLength;
+		m_batches.removeFirst();
+		if (m_sendIndex) {
+			m_sendIndex--;
+		} else {
+			m_sendPartial = 0;
+		}
+	}
+
+	QMutexLocker locker(&m_mutex);
+	m_ackedOffset  = qMax(m_ackedOffset, offset);
+	m_queuedBytes -= released;
+}
+
+//-----------------------------------------------------------------------------
+quint64 ExportSink::BytesAcked(void)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_ackedOffset;
+}
+
+//-----------------------------------------------------------------------------
+quint64 ExportSink::BytesDropped(void)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_bytesDropped;
+}
+
+//-----------------------------------------------------------------------------
+bool ExportSink::Connect(void)
+{
+	if (m_target.startsWith("unix:")) {
+		struct sockaddr_un address;
+		const QByteArray   path = m_target.mid(5).toLocal8Bit();
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= static_cast<int>(sizeof(address.sun_path))) {
+			return SetError(QString("Socket name %1 is too long").arg(m_target.mid(5)));
+		}
+		strcpy(address.sun_path, path.data());
+
+		m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((m_socket == -1) || (::connect(m_socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1)) {
+			const int error = errno;
+			Disconnect();
+			return SetError(QString("Cannot connect to %1: %2").arg(m_target, strerror(error)));
+		}
+	} else {
+		const int        colon = m_target.lastIndexOf(':');
+		const QByteArray host  = m_target.left(colon).toLocal8Bit();
+		const QByteArray port  = m_target.mid(colon + 1).toLocal8Bit();
+		struct addrinfo  hints;
+		struct addrinfo *addresses;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family   = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		const int rc = ::getaddrinfo(host.data(), port.data(), &hints, &addresses);
+		if (rc != 0) {
+			return SetError(QString("Cannot resolve %1: %2").arg(m_target, gai_strerror(rc)));
+		}
+
+		// Connect without blocking, so an unreachable collector can't hold up
+		// a stop for the full TCP timeout
+		int error = 0;
+		for (struct addrinfo *address = addresses; address && (m_socket == -1); address = address->ai_next) {
+			m_socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (m_socket == -1) {
+				error = errno;
+				continue;
+			}
+			::fcntl(m_socket, F_SETFL, O_NONBLOCK);
+			if (::connect(m_socket, address->ai_addr, address->ai_addrlen) == -1) {
+				struct pollfd pfd = { m_socket, POLLOUT, 0 };
+				socklen_t     errorLength = sizeof(error);
+				error = errno;
+				if ((error != EINPROGRESS) || (::poll(&pfd, 1, 2000) != 1) ||
+						(::getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &errorLength) == -1) || error) {
+					if (error == EINPROGRESS) {
+						error = ETIMEDOUT;
+					}
+					Disconnect();
+				}
+			}
+		}
+		::freeaddrinfo(addresses);
+		if (m_socket == -1) {
+			return SetError(QString("Cannot connect to %1: %2").arg(m_target, strerror(error)));
+		}
+	}
+	::fcntl(m_socket, F_SETFL, O_NONBLOCK);
+
+	// Introduce ourselves and find out where the collector wants us to resume
+	ExportHello hello;
+	memcpy(hello.magic, "HONE", sizeof(hello.magic));
+	hello.version   = EXPORT_VERSION;
+	hello.sessionId = m_sessionId;
+	if (::send(m_socket, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+		Disconnect();
+		return SetError(QString("Cannot send the session to %1").arg(m_target));
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	m_ackBufferLength = 0;
+	while (m_ackBufferLength < sizeof(m_ackBuffer)) {
+		struct pollfd pfd = { m_socket, POLLIN, 0 };
+		const int remaining = 5000 - timer.elapsed();
+		if ((remaining <= 0) || (::poll(&pfd, 1, remaining) != 1) || !ReadAcks()) {
+			Disconnect();
+			return SetError(QString("No resume offset from %1").arg(m_target));
+		}
+		if (!m_ackBufferLength) {
+			break; // ReadAcks consumed the resume offset
+		}
+	}
+
+	// Send everything the collector doesn't already have
+	m_sendIndex   = 0;
+	m_sendPartial = 0;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void ExportSink::Disconnect(void)
+{
+	if (m_socket != -1) {
+		::close(m_socket);
+		m_socket = -1;
+	}
+	m_ackBufferLength = 0;
+}
+
+//-----------------------------------------------------------------------------
+QString ExportSink::Error(void)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_error;
+}
+
+//-----------------------------------------------------------------------------
+void ExportSink::Frame(Batch &batch)
+{
+	ExportBatchHeader header;
+	QByteArray        payload = batch.data;
+	memcpy(header.magic, "HONB", sizeof(header.magic));
+	header.flags     = 0;
+	header.offset    = batch.offset;
+	header.rawLength = batch.rawLength;
+
+	// Only keep the compressed payload if compression helped
+	if (m_compress) {
+		const QByteArray compressed = qCompress(batch.data);
+		if (compressed.isEmpty()) {
+			SetError("Cannot compress a batch, so sending it uncompressed");
+		} else if (compressed.size() < payload.size()) {
+			header.flags |= EXPORT_FLAG_COMPRESSED;
+			payload       = compressed;
+		}
+	}
+
+	header.payloadLength = payload.size();
+	batch.data = QByteArray(reinterpret_cast<const char*>(&header), sizeof(header));
+	batch.data.append(payload);
+}
+
+//-----------------------------------------------------------------------------
+bool ExportSink::ReadAcks(void)
+{
+	for (;;) {
+		const ssize_t bytesRead = ::recv(m_socket, m_ackBuffer + m_ackBufferLength,
+				sizeof(m_ackBuffer) - m_ackBufferLength, 0);
+		if (bytesRead == 0) {
+			return false;
+		}
+		if (bytesRead == -1) {
+			return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+		}
+		m_ackBufferLength += bytesRead;
+		if (m_ackBufferLength == sizeof(m_ackBuffer)) {
+			quint64 offset;
+			memcpy(&offset, m_ackBuffer, sizeof(offset));
+			Acknowledge(offset);
+			m_ackBufferLength = 0;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void ExportSink::run(void)
+{
+	QElapsedTimer retryTimer;
+	QElapsedTimer stopTimer;
+	qint64        retryMsecs = 0;
+
+	QMutexLocker locker(&m_mutex);
+	for (;;) {
+		// Frame new data outside the lock so compression doesn't hold up the
+		// capture loop
+		QList<Batch> pending = m_pending;
+		const bool   stop    = m_stop;
+		m_pending.clear();
+		locker.unlock();
+
+		for (int index = 0; index < pending.size(); index++) {
+			Frame(pending[index]);
+			m_batches.append(pending[index]);
+		}
+
+		if (stop) {
+			if (!stopTimer.isValid()) {
+				stopTimer.start();
+			}
+			if (m_batches.isEmpty() || (stopTimer.elapsed() >= m_stopTimeout)) {
+				break;
+			}
+		}
+
+		// Reconnect with a growing delay while the collector is away
+		if ((m_socket == -1) && (!retryTimer.isValid() || (retryTimer.elapsed() >= retryMsecs))) {
+			if (Connect()) {
+				retryMsecs = 0;
+			} else {
+				retryMsecs = qBound(static_cast<qint64>(500), retryMsecs * 2, static_cast<qint64>(30000));
+			}
+			retryTimer.start();
+		}
+
+		bool idle = true;
+		if ((m_socket != -1) && !m_batches.isEmpty()) {
+			struct pollfd pfd = { m_socket, POLLIN, 0 };
+			if (m_sendIndex < m_batches.size()) {
+				pfd.events |= POLLOUT;
+			}
+			if (::poll(&pfd, 1, 100) > 0) {
+				bool ok = !(pfd.revents & (POLLERR | POLLNVAL));
+				if (ok && (pfd.revents & (POLLIN | POLLHUP))) {
+					ok = ReadAcks();
+				}
+				if (ok && (pfd.revents & POLLOUT)) {
+					ok = SendBatches();
+				}
+				if (!ok) {
+					SetError(QString("Lost the connection to %1").arg(m_target));
+					Disconnect();
+				}
+			}
+			idle = false;
+		}
+
+		locker.relock();
+		if (idle && m_pending.isEmpty()) {
+			m_dataQueued.wait(&m_mutex, 100);
+		}
+	}
+	Disconnect();
+}
+
+//-----------------------------------------------------------------------------
+bool ExportSink::SendBatches(void)
+{
+	// Gather as many batches as we can into each call
+	while (m_sendIndex < m_batches.size()) {
+		struct iovec vectors[64];
+		int          count = 0;
+		for (int index = m_sendIndex; (index < m_batches.size()) && (count < 64); index++, count++) {
+			const QByteArray &data = m_batches.at(index).data;
+			const quint32     skip = (index == m_sendIndex) ? m_sendPartial : 0;
+			vectors[count].iov_base = const_cast<char*>(data.constData()) + skip;
+			vectors[count].iov_len  = data.size() - skip;
+		}
+
+		// Same as writev, but without raising SIGPIPE if the collector is gone
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov    = vectors;
+		message.msg_iovlen = count;
+		ssize_t sent = ::sendmsg(m_socket, &message, MSG_NOSIGNAL);
+		if (sent == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+		}
+
+		while (sent > 0) {
+			const quint32 remaining = m_batches.at(m_sendIndex).data.size() - m_sendPartial;
+			if (static_cast<quint32>(sent) >= remaining) {
+				sent         -= remaining;
+				m_sendIndex++;
+				m_sendPartial = 0;
+			} else {
+				m_sendPartial += sent;
+				sent           = 0;
+			}
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool ExportSink::SetError(const QString &error)
+{
+	// Failures are retried, so this is only the most recent one
+	QMutexLocker locker(&m_mutex);
+	m_error = error;
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+void ExportSink::Stop(const int timeoutMsecs)
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		if (!m_stop) {
+			m_stop        = true;
+			m_stopTimeout = timeoutMsecs;
+		}
+		m_dataQueued.wakeAll();
+	}
+	wait();
+}
+
+//-----------------------------------------------------------------------------
+void ExportSink::Write(const char *data, const quint32 length)
+{
+	QMutexLocker locker(&m_mutex);
+	if (m_queuedBytes + length > m_maxQueuedBytes) {
+		// Leave a gap in the stream offsets so the collector can see the loss
+		m_bytesDropped += length;
+		m_writeOffset  += length;
+		return;
+	}
+
+	if (m_pending.isEmpty() || (m_pending.last().offset + m_pending.last().rawLength != m_writeOffset) ||
+			(m_pending.last().rawLength >= m_maxBatchBytes)) {
+		Batch batch;
+		batch.offset    = m_writeOffset;
+		batch.rawLength = 0;
+		m_pending.append(batch);
+	}
+	m_pending.last().data.append(data, length);
+	m_pending.last().rawLength += length;
+	m_queuedBytes              += length;
+	m_writeOffset              += length;
+	m_dataQueued.wakeOne();
+}
@@ -0,0 +1,103 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef EXPORT_SINK_H
+#define EXPORT_SINK_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+//----------------------------------------------------------------------------
+// Streams the capture data to a remote collector over TCP or a Unix socket.
+//
+// The stream starts with a hello carrying a session ID, which the collector
+// answers with the offset it already has for that session.  The data then
+// follows in batches, each with an ExportBatchHeader, and the collector acks
+// the stream offset it has stored after each batch.  Batches are kept until
+// they are acked, so a dropped connection resumes where the collector left
+// off.  All values are little endian.
+class ExportSink : public QThread
+{
+	Q_OBJECT
+
+public:
+	ExportSink(const QString &target, const bool compress, QObject *parent = 0);
+	~ExportSink(void);
+
+	quint64 BytesAcked(void);
+	quint64 BytesDropped(void);
+	QString Error(void);
+	void    Stop(const int timeoutMsecs);
+	void    Write(const char *data, const quint32 length);
+
+protected:
+	void run(void);
+
+private:
+	struct Batch {
+		QByteArray data;
+		quint64    offset;
+		quint32    rawLength;
+	};
+
+	void Acknowledge(const quint64 offset);
+	bool Connect(void);
+	void Disconnect(void);
+	void Frame(Batch &batch);
+	bool ReadAcks(void);
+	bool SendBatches(void);
+	bool SetError(const QString &error);
+
+	quint64              m_ackedOffset;
+	char                 m_ackBuffer[sizeof(quint64)];
+	quint32              m_ackBufferLength;
+	QList<Batch>         m_batches;
+	quint64              m_bytesDropped;
+	bool                 m_compress;
+	QWaitCondition       m_dataQueued;
+	QString              m_error;
+	static const quint32 m_maxBatchBytes;
+	static const quint32 m_maxQueuedBytes;
+	QMutex               m_mutex;
+	QList<Batch>         m_pending;
+	quint32              m_queuedBytes;
+	int                  m_sendIndex;
+	quint32              m_sendPartial;
+	quint64              m_sessionId;
+	int                  m_socket;
+	bool                 m_stop;
+	int                  m_stopTimeout;
+	QString              m_target;
+	quint64              m_writeOffset;
+};
+
+// Protocol structures
+struct ExportHello {
+	char    magic[4];   // "HONE"
+	quint32 version;
+	quint64 sessionId;
+};
+
+struct ExportBatchHeader {
+	char    magic[4];   // "HONB"
+	quint32 flags;
+	quint64 offset;     // Offset of the batch in the uncompressed stream
+	quint32 rawLength;
+	quint32 payloadLength;
+};
+
+#define EXPORT_VERSION          1
+#define EXPORT_FLAG_COMPRESSED  0x00000001  // Payload is in qCompress format
+
+#endif // EXPORT_SINK_H
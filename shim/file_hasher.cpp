@@ -0,0 +1,187 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "file_hasher.h"
+
+// Small writes are merged into chunks of up to this size
+const quint32 FileHasher::m_maxChunkSize = 1024 * 1024;
+
+// Block the capture loop once this much data is waiting to be hashed
+const quint32 FileHasher::m_maxQueuedBytes = 64 * 1024 * 1024;
+
+//-----------------------------------------------------------------------------
+FileHasher::FileHasher(QObject *parent)
+	: QThread(parent)
+	, m_blockCount(0)
+	, m_hash(QCryptographicHash::Sha256)
+	, m_queuedBytes(0)
+	, m_size(0)
+	, m_stop(false)
+{
+}
+
+//-----------------------------------------------------------------------------
+FileHasher::~FileHasher(void)
+{
+	Stop();
+	qDeleteAll(m_freeChunks);
+	qDeleteAll(m_queue);
+}
+
+//-----------------------------------------------------------------------------
+bool FileHasher::Add(const char *data, const quint32 length, const quint32 blockCount)
+{
+	QMutexLocker locker(&m_mutex);
+	while ((m_queuedBytes >= m_maxQueuedBytes) && m_error.isEmpty()) {
+		m_chunkHashed.wait(&m_mutex);
+	}
+	if (!m_error.isEmpty()) {
+		return false;
+	}
+
+	// Most writes are a single read from the driver, so add to the last chunk
+	// while the hashing thread hasn't taken it yet
+	Chunk *chunk = m_queue.isEmpty() ? NULL : m_queue.last();
+	if (!chunk || !chunk->fileName.isEmpty() || (chunk->length + length > m_maxChunkSize)) {
+		chunk = NewChunk();
+		m_queue.enqueue(chunk);
+	}
+	if (static_cast<quint32>(chunk->data.size()) < chunk->length + length) {
+		chunk->data.resize(chunk->length + length);
+	}
+	::memcpy(chunk->data.data() + chunk->length, data, length);
+	chunk->blockCount += blockCount;
+	chunk->length     += length;
+	m_queuedBytes += length;
+	m_chunkQueued.wakeOne();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool FileHasher::Begin(const QString &fileName)
+{
+	// Finishes the previous file once its data has been hashed
+	QMutexLocker locker(&m_mutex);
+	if (!m_error.isEmpty()) {
+		return false;
+	}
+	Chunk *chunk = NewChunk();
+	chunk->fileName = fileName;
+	m_queue.enqueue(chunk);
+	m_chunkQueued.wakeOne();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+QString FileHasher::Error(void)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_error;
+}
+
+//-----------------------------------------------------------------------------
+QString FileHasher::Finish(void)
+{
+	// Only called from the hashing thread
+	if (m_fileName.isEmpty()) {
+		return QString();
+	}
+	const QByteArray line = QString("%1  %2  %3  %4\n").arg(QString(m_hash.result().toHex()))
+			.arg(m_size).arg(m_blockCount).arg(m_fileName).toLocal8Bit();
+	m_fileName.clear();
+	if ((m_manifest.write(line) != line.size()) || !m_manifest.flush()) {
+		return QString("Cannot write to manifest %1: %2").arg(m_manifest.fileName(), m_manifest.errorString());
+	}
+	return QString();
+}
+
+//-----------------------------------------------------------------------------
+FileHasher::Chunk *FileHasher::NewChunk(void)
+{
+	// Caller must hold m_mutex
+	Chunk *chunk = m_freeChunks.isEmpty() ? new Chunk : m_freeChunks.takeLast();
+	chunk->blockCount = 0;
+	chunk->length     = 0;
+	return chunk;
+}
+
+//-----------------------------------------------------------------------------
+bool FileHasher::OpenManifest(const QString &fileName)
+{
+	m_manifest.setFileName(fileName);
+	if (!m_manifest.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		m_error = QString("Cannot open manifest %1: %2").arg(fileName, m_manifest.errorString());
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void FileHasher::run(void)
+{
+	QMutexLocker locker(&m_mutex);
+	for (;;) {
+		while (m_queue.isEmpty() && !m_stop) {
+			m_chunkQueued.wait(&m_mutex);
+		}
+		if (m_queue.isEmpty()) {
+			break;
+		}
+
+		Chunk *chunk = m_queue.dequeue();
+		locker.unlock();
+
+		QString error;
+		if (chunk->fileName.isEmpty()) {
+			m_hash.addData(chunk->data.constData(), chunk->length);
+			m_blockCount += chunk->blockCount;
+			m_size       += chunk->length;
+		} else {
+			error = Finish();
+			m_blockCount = 0;
+			m_fileName   = chunk->fileName;
+			m_hash.reset();
+			m_size       = 0;
+			chunk->fileName.clear();
+		}
+
+		locker.relock();
+		m_queuedBytes -= chunk->length;
+		m_freeChunks.append(chunk);
+		if (!error.isEmpty() && m_error.isEmpty()) {
+			m_error = error;
+		}
+		m_chunkHashed.wakeAll();
+	}
+
+	// Stopping finishes the last file
+	locker.unlock();
+	const QString error = Finish();
+	locker.relock();
+	if (!error.isEmpty() && m_error.isEmpty()) {
+		m_error = error;
+	}
+	m_chunkHashed.wakeAll();
+}
+
+//-----------------------------------------------------------------------------
+void FileHasher::Stop(void)
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		m_stop = true;
+		m_chunkQueued.wakeAll();
+	}
+	wait();
+	m_manifest.close();
+}
@@ -0,0 +1,74 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef FILE_HASHER_H
+#define FILE_HASHER_H
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+
+//----------------------------------------------------------------------------
+// Hashes each capture file with SHA-256 on its own thread as it is written,
+// and appends the file's name, size, block count and digest to a manifest
+// when the file is finished, so the file never has to be read back
+class FileHasher : public QThread
+{
+	Q_OBJECT
+
+public:
+	explicit FileHasher(QObject *parent = 0);
+	~FileHasher(void);
+
+	bool    Add(const char *data, const quint32 length, const quint32 blockCount);
+	bool    Begin(const QString &fileName);
+	QString Error(void);
+	bool    OpenManifest(const QString &fileName);
+	void    Stop(void);
+
+protected:
+	void run(void);
+
+private:
+	// Chunks go back on the free list once hashed and keep their buffers,
+	// so the capture loop stops allocating for them once it has warmed up
+	struct Chunk {
+		quint32    blockCount;
+		QByteArray data;       // Sized to the most it has held so far
+		QString    fileName;   // Set on the chunk that starts a file
+		quint32    length;
+	};
+
+	Chunk *NewChunk(void);
+
+	QString Finish(void);
+
+	quint64              m_blockCount;
+	QWaitCondition       m_chunkHashed;
+	QWaitCondition       m_chunkQueued;
+	QString              m_error;
+	QString              m_fileName;
+	QList<Chunk*>        m_freeChunks;
+	QCryptographicHash   m_hash;
+	QFile                m_manifest;
+	static const quint32 m_maxChunkSize;
+	static const quint32 m_maxQueuedBytes;
+	QMutex               m_mutex;
+	QQueue<Chunk*>       m_queue;
+	quint32              m_queuedBytes;
+	quint64              m_size;
+	bool                 m_stop;
+};
+
+#endif // FILE_HASHER_H
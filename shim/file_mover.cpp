@@ -0,0 +1,192 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QFile>
+#include <QFileInfo>
+
+#include "file_mover.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif // #ifndef WIN32
+
+//-----------------------------------------------------------------------------
+FileMover::FileMover(QObject *parent)
+	: QThread(parent)
+	, m_stagedBytes(0)
+	, m_stop(false)
+{
+}
+
+//-----------------------------------------------------------------------------
+FileMover::~FileMover(void)
+{
+	Stop();
+}
+
+//-----------------------------------------------------------------------------
+bool FileMover::Copy(const QString &source, const QString &destination, QString &error)
+{
+#ifdef WIN32
+	QFile::remove(destination);
+	if (!QFile::copy(source, destination)) {
+		error = QString("Cannot copy %1 to %2").arg(source, destination);
+		return false;
+	}
+	return true;
+#else // #ifdef WIN32
+	const int sourceHandle = ::open(source.toLocal8Bit().data(), O_RDONLY);
+	if (sourceHandle == -1) {
+		error = QString("Cannot open %1: %2").arg(source, strerror(errno));
+		return false;
+	}
+	const int destinationHandle = ::open(destination.toLocal8Bit().data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (destinationHandle == -1) {
+		error = QString("Cannot open %1 for writing: %2").arg(destination, strerror(errno));
+		::close(sourceHandle);
+		return false;
+	}
+
+	// Let the kernel copy the data where it can, falling back to a plain
+	// read and write loop
+	bool    rc     = true;
+	ssize_t copied = 0;
+	do {
+#ifdef __linux__
+		copied = ::sendfile(destinationHandle, sourceHandle, NULL, 1024 * 1024 * 1024);
+		if ((copied == -1) && ((errno == EINVAL) || (errno == ENOSYS))) {
+#else
+		{
+#endif
+			char buffer[64 * 1024];
+			copied = ::read(sourceHandle, buffer, sizeof(buffer));
+			for (ssize_t offset = 0; (copied > 0) && (offset < copied); ) {
+				const ssize_t written = ::write(destinationHandle, buffer + offset, copied - offset);
+				if (written == -1) {
+					copied = -1;
+					break;
+				}
+				offset += written;
+			}
+		}
+	} while ((copied > 0) || ((copied == -1) && (errno == EINTR)));
+
+	if (copied == -1) {
+		error = QString("Cannot copy %1 to %2: %3").arg(source, destination, strerror(errno));
+		rc    = false;
+	} else if (::fsync(destinationHandle) == -1) {
+		error = QString("Cannot sync %1: %2").arg(destination, strerror(errno));
+		rc    = false;
+	}
+	::close(destinationHandle);
+	::close(sourceHandle);
+	return rc;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+QString FileMover::Error(void)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_error;
+}
+
+//-----------------------------------------------------------------------------
+void FileMover::Move(const QString &source, const QString &destination)
+{
+	Job job;
+	job.destination = destination;
+	job.size        = QFileInfo(source).size();
+	job.source      = source;
+
+	QMutexLocker locker(&m_mutex);
+	m_jobs.enqueue(job);
+	m_stagedBytes += job.size;
+	m_jobQueued.wakeOne();
+}
+
+//-----------------------------------------------------------------------------
+bool FileMover::Remove(const QString &destination)
+{
+	QMutexLocker locker(&m_mutex);
+
+	// A file that hasn't been moved yet only needs its staged copy removed
+	for (int index = 0; index < m_jobs.size(); index++) {
+		if (m_jobs.at(index).destination == destination) {
+			const Job job = m_jobs.at(index);
+			m_jobs.removeAt(index);
+			m_stagedBytes -= job.size;
+			return QFile::remove(job.source);
+		}
+	}
+	if (m_current == destination) {
+		m_removeAfterMove.append(destination);
+		return true;
+	}
+	return QFile::remove(destination);
+}
+
+//-----------------------------------------------------------------------------
+void FileMover::run(void)
+{
+	QMutexLocker locker(&m_mutex);
+	for (;;) {
+		while (m_jobs.isEmpty() && !m_stop) {
+			m_jobQueued.wait(&m_mutex);
+		}
+		if (m_jobs.isEmpty()) {
+			break;
+		}
+
+		const Job job = m_jobs.dequeue();
+		m_current = job.destination;
+		locker.unlock();
+
+		QString error;
+		if (Copy(job.source, job.destination, error) && !QFile::remove(job.source)) {
+			error = QString("Cannot remove staged file %1").arg(job.source);
+		}
+
+		locker.relock();
+		m_current.clear();
+		m_stagedBytes -= job.size;
+		if (m_removeAfterMove.removeAll(job.destination)) {
+			QFile::remove(job.destination);
+		}
+		if (!error.isEmpty() && m_error.isEmpty()) {
+			m_error = error;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+qint64 FileMover::StagedBytes(void)
+{
+	QMutexLocker locker(&m_mutex);
+	return m_stagedBytes;
+}
+
+//-----------------------------------------------------------------------------
+void FileMover::Stop(void)
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		m_stop = true;
+		m_jobQueued.wakeAll();
+	}
+	wait();
+}
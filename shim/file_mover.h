@@ -0,0 +1,60 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef FILE_MOVER_H
+#define FILE_MOVER_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+//----------------------------------------------------------------------------
+// Moves finished capture files from the staging area to persistent storage
+// in the background, so the capture loop never waits on the destination disk
+class FileMover : public QThread
+{
+	Q_OBJECT
+
+public:
+	explicit FileMover(QObject *parent = 0);
+	~FileMover(void);
+
+	QString Error(void);
+	void    Move(const QString &source, const QString &destination);
+	bool    Remove(const QString &destination);
+	qint64  StagedBytes(void);
+	void    Stop(void);
+
+protected:
+	void run(void);
+
+private:
+	struct Job {
+		QString destination;
+		qint64  size;
+		QString source;
+	};
+
+	bool Copy(const QString &source, const QString &destination, QString &error);
+
+	QString         m_current;
+	QString         m_error;
+	QWaitCondition  m_jobQueued;
+	QQueue<Job>     m_jobs;
+	QMutex          m_mutex;
+	QStringList     m_removeAfterMove;
+	qint64          m_stagedBytes;
+	bool            m_stop;
+};
+
+#endif // FILE_MOVER_H
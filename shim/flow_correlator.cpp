@@ -0,0 +1,430 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+
+#include "flow_correlator.h"
+#include "hone_pcapng.h"
+
+// Link types we can find the IP header in
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_IPV6       229
+#define LINKTYPE_LINUX_SLL2 276
+
+// Processes to keep executable paths for, and slots to search for a flow
+const quint32 FlowCorrelator::m_maxPaths  = 32768;
+const quint32 FlowCorrelator::m_maxProbes = 32;
+
+// Flow table starts at 4 MB, and grows to at most 64 MB
+static const int g_initialSlots = 64 * 1024;
+static const int g_maxSlots     = 1024 * 1024;
+
+//-----------------------------------------------------------------------------
+static inline quint16 BigEndian16(const char *data)
+{
+	const quint8 *bytes = reinterpret_cast<const quint8*>(data);
+	return (bytes[0] << 8) | bytes[1];
+}
+
+//-----------------------------------------------------------------------------
+FlowCorrelator::FlowCorrelator(void)
+	: m_now(0)
+	, m_rebuildTime(0)
+	, m_timeToLive(120)
+	, m_usedSlots(0)
+{
+	Q_ASSERT(sizeof(Slot) == 64);
+}
+
+//-----------------------------------------------------------------------------
+quint32 FlowCorrelator::Annotate(const char *data, const quint32 length, QByteArray &annotated)
+{
+	// Reserve first so shrinking the array keeps the allocation
+	if (annotated.capacity() < static_cast<int>(length + length / 2)) {
+		annotated.reserve(length + length / 2);
+	}
+	annotated.resize(0);
+
+	// The data must hold only complete blocks
+	quint32 annotatedCount = 0;
+	quint32 offset         = 0;
+	while (offset < length) {
+		const char              *block  = data + offset;
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(block);
+		if (!PcapNgBlockLength(block, length - offset)) {
+			break;
+		}
+		offset += header->blockLength;
+
+		FlowKey     key;
+		const Slot *slot = NULL;
+		if (NoteInterface(block, header->blockLength, m_nicLinkTypes) ||
+				!ParseFlow(block, header->blockLength, m_nicLinkTypes, key) ||
+				!(slot = Find(key, Hash(key)))) {
+			annotated.append(block, header->blockLength);
+			continue;
+		}
+
+		// Find where the options end, leaving out any end of options marker
+		const char *options;
+		quint32     optionsLength;
+		PcapNgPacketOptions(block, header->blockLength, options, optionsLength);
+		quint32 usedLength = 0;
+		while (usedLength + sizeof(PcapNgOptionHeader) <= optionsLength) {
+			const PcapNgOptionHeader *option = reinterpret_cast<const PcapNgOptionHeader*>(options + usedLength);
+			if ((option->code == PCAPNG_OPT_END_OF_OPTIONS) ||
+					(usedLength + sizeof(PcapNgOptionHeader) + ((option->length + 3) & ~3) > optionsLength)) {
+				break;
+			}
+			usedLength += sizeof(PcapNgOptionHeader) + ((option->length + 3) & ~3);
+		}
+
+		// Add the process ID option that Hone captures carry, and a comment
+		// naming the process for everything else
+		char          prefix[32];
+		const QByteArray path     = m_paths.value(slot->processId);
+		const int     prefixLength = qsnprintf(prefix, sizeof(prefix), path.isEmpty() ? "PID %u" : "PID %u: ", slot->processId);
+		const quint16 commentLength = qMin(prefixLength + path.size(), 0xFFFC);
+		const quint32 keptLength    = (options - block) + usedLength;
+		const quint32 blockLength   = keptLength +
+				sizeof(PcapNgOptionHeader) + sizeof(quint32) +
+				sizeof(PcapNgOptionHeader) + ((commentLength + 3) & ~3) +
+				sizeof(PcapNgOptionHeader) + sizeof(quint32);
+
+		const int start = annotated.size();
+		annotated.resize(start + blockLength);
+		char *out = annotated.data() + start;
+		::memcpy(out, block, keptLength);
+		reinterpret_cast<PcapNgBlockHeader*>(out)->blockLength = blockLength;
+		out += keptLength;
+
+		PcapNgOptionHeader *option = reinterpret_cast<PcapNgOptionHeader*>(out);
+		option->code   = HONE_PACKET_OPT_PROCESS_ID;
+		option->length = sizeof(quint32);
+		::memcpy(out + sizeof(PcapNgOptionHeader), &slot->processId, sizeof(quint32));
+		out += sizeof(PcapNgOptionHeader) + sizeof(quint32);
+
+		option = reinterpret_cast<PcapNgOptionHeader*>(out);
+		option->code   = PCAPNG_OPT_COMMENT;
+		option->length = commentLength;
+		out += sizeof(PcapNgOptionHeader);
+		::memcpy(out, prefix, prefixLength);
+		::memcpy(out + prefixLength, path.constData(), commentLength - prefixLength);
+		::memset(out + commentLength, 0, ((commentLength + 3) & ~3) - commentLength);
+		out += (commentLength + 3) & ~3;
+
+		::memset(out, 0, sizeof(PcapNgOptionHeader)); // End of options
+		out += sizeof(PcapNgOptionHeader);
+		::memcpy(out, &blockLength, sizeof(quint32));
+		annotatedCount++;
+	}
+
+	// Pass along anything we couldn't make sense of
+	annotated.append(data + offset, length - offset);
+	return annotatedCount;
+}
+
+//-----------------------------------------------------------------------------
+const FlowCorrelator::Slot *FlowCorrelator::Find(const FlowKey &key, const quint32 hash) const
+{
+	if (m_slots.isEmpty()) {
+		return NULL;
+	}
+	const quint32 mask = m_slots.size() - 1;
+	for (quint32 probe = 0, index = hash & mask; probe < m_maxProbes; probe++, index = (index + 1) & mask) {
+		const Slot &slot = m_slots.at(index);
+		if (!slot.hash) {
+			break;
+		}
+		if ((slot.hash == hash) && (slot.expires > m_now) && (slot.protocol == key.protocol) &&
+				(::memcmp(slot.port, key.port, sizeof(key.port)) == 0) &&
+				(::memcmp(slot.address, key.address, sizeof(key.address)) == 0)) {
+			return &slot;
+		}
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+quint32 FlowCorrelator::Hash(const FlowKey &key)
+{
+	// FNV-1a, which is quick for short keys.  Zero marks an unused slot.
+	const quint8 *bytes = reinterpret_cast<const quint8*>(&key);
+	quint32       hash  = 2166136261U;
+	for (size_t index = 0; index < sizeof(FlowKey); index++) {
+		hash = (hash ^ bytes[index]) * 16777619U;
+	}
+	return hash ? hash : 1;
+}
+
+//-----------------------------------------------------------------------------
+void FlowCorrelator::Insert(const FlowKey &key, const quint32 processId)
+{
+	// The table is only allocated for the first flow, so runs that never
+	// correlate don't pay for clearing it
+	if (m_slots.isEmpty()) {
+		m_slots = QVector<Slot>(g_initialSlots);
+		::memset(m_slots.data(), 0, m_slots.size() * sizeof(Slot));
+	}
+
+	// Long probe chains of expired flows slow every lookup, so rebuild the
+	// table well before it fills.  Once it can't grow, inserts reuse expired
+	// slots, so only sweep it once per time to live.
+	const quint32 rebuildInterval = (m_slots.size() < g_maxSlots) ? 1 : m_timeToLive;
+	if ((m_usedSlots >= static_cast<quint32>(m_slots.size()) / 4 * 3) && (m_now - m_rebuildTime >= rebuildInterval)) {
+		Rebuild();
+	}
+
+	// Probes are bounded so a full table stays fast.  If the flow isn't
+	// already there, take an unused or expired slot, or failing that evict
+	// the flow closest to expiring.
+	const quint32 hash   = Hash(key);
+	const quint32 mask   = m_slots.size() - 1;
+	Slot         *target = NULL;
+	for (quint32 probe = 0, index = hash & mask; probe < m_maxProbes; probe++, index = (index + 1) & mask) {
+		Slot &slot = m_slots[index];
+		if (!slot.hash) {
+			if (!target || (target->expires > m_now)) {
+				target = &slot;
+				m_usedSlots++;
+			}
+			break;
+		}
+		if ((slot.hash == hash) && (slot.protocol == key.protocol) &&
+				(::memcmp(slot.port, key.port, sizeof(key.port)) == 0) &&
+				(::memcmp(slot.address, key.address, sizeof(key.address)) == 0)) {
+			target = &slot;
+			break;
+		}
+		if (!target || ((target->expires > m_now) && (slot.expires < target->expires))) {
+			target = &slot;
+		}
+	}
+
+	target->hash      = hash;
+	target->expires   = m_now + m_timeToLive;
+	target->processId = processId;
+	target->protocol  = key.protocol;
+	::memcpy(target->port,    key.port,    sizeof(key.port));
+	::memcpy(target->address, key.address, sizeof(key.address));
+}
+
+//-----------------------------------------------------------------------------
+void FlowCorrelator::Learn(const char *data, const quint32 length, const quint32 now)
+{
+	m_now = now;
+	m_honePending.append(data, length);
+
+	quint32 offset = 0;
+	while (offset < static_cast<quint32>(m_honePending.size())) {
+		const char              *block  = m_honePending.constData() + offset;
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(block);
+		bool                     corrupt;
+		if (!PcapNgBlockLength(block, m_honePending.size() - offset, corrupt)) {
+			if (corrupt) {
+				// Start over with the next read
+				offset = m_honePending.size();
+			}
+			break;
+		}
+		offset += header->blockLength;
+
+		if (NoteInterface(block, header->blockLength, m_honeLinkTypes)) {
+			continue;
+		}
+		if (header->blockType == HONE_PROCESS_EVENT_BLOCK) {
+			if (header->blockLength < PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneProcessEventBody)) {
+				continue;
+			}
+			const HoneProcessEventBody *process = reinterpret_cast<const HoneProcessEventBody*>(header + 1);
+			const char *path;
+			quint16     pathLength;
+			if (PcapNgFindOption(block + sizeof(PcapNgBlockHeader) + sizeof(HoneProcessEventBody),
+					header->blockLength - PCAPNG_MIN_BLOCK_LENGTH - sizeof(HoneProcessEventBody),
+					HONE_PROCESS_OPT_PATH, path, pathLength)) {
+				if ((static_cast<quint32>(m_paths.size()) >= m_maxPaths) && !m_paths.contains(process->processId)) {
+					m_paths.clear();
+				}
+				m_paths.insert(process->processId, QByteArray(path, pathLength));
+			}
+		} else if (header->blockType == PCAPNG_ENHANCED_PACKET_BLOCK) {
+			const char *options;
+			quint32     optionsLength;
+			quint32     processId;
+			FlowKey     key;
+			if (!ParseFlow(block, header->blockLength, m_honeLinkTypes, key)) {
+				continue;
+			}
+			PcapNgPacketOptions(block, header->blockLength, options, optionsLength);
+			if (PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_PROCESS_ID, processId) && processId) {
+				Insert(key, processId);
+			}
+		}
+	}
+	m_honePending.remove(0, offset);
+}
+
+//-----------------------------------------------------------------------------
+bool FlowCorrelator::NoteInterface(const char *block, const quint32 blockLength, LinkTypes &linkTypes)
+{
+	const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(block);
+	if (header->blockType == PCAPNG_SECTION_HEADER_BLOCK) {
+		linkTypes.clear();
+		return true;
+	}
+	if (header->blockType == PCAPNG_INTERFACE_DESC_BLOCK) {
+		if (blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(quint32)) {
+			linkTypes.append(*reinterpret_cast<const quint16*>(header + 1));
+		}
+		return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+bool FlowCorrelator::ParseFlow(const char *block, const quint32 blockLength, const LinkTypes &linkTypes, FlowKey &key)
+{
+	const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(block);
+	if ((header->blockType != PCAPNG_ENHANCED_PACKET_BLOCK) || (blockLength < PCAPNG_MIN_PACKET_BLOCK_LENGTH)) {
+		return false;
+	}
+	const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(header + 1);
+	if (packet->interfaceId >= static_cast<quint32>(linkTypes.size()) ||
+			(((packet->capturedLength + 3) & ~3) > blockLength - PCAPNG_MIN_PACKET_BLOCK_LENGTH)) {
+		return false;
+	}
+	const char   *data   = reinterpret_cast<const char*>(packet + 1);
+	const quint32 length = packet->capturedLength;
+
+	// Find the network layer
+	quint32 offset    = 0;
+	quint16 etherType = 0;
+	switch (linkTypes.at(packet->interfaceId)) {
+	case LINKTYPE_ETHERNET:
+		if (length < 14) {
+			return false;
+		}
+		etherType = BigEndian16(data + 12);
+		offset    = 14;
+		if (((etherType == 0x8100) || (etherType == 0x88A8)) && (length >= 18)) {
+			etherType = BigEndian16(data + 16);
+			offset    = 18;
+		}
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (length < 16) {
+			return false;
+		}
+		etherType = BigEndian16(data + 14);
+		offset    = 16;
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (length < 20) {
+			return false;
+		}
+		etherType = BigEndian16(data);
+		offset    = 20;
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		if (length < 1) {
+			return false;
+		}
+		etherType = ((data[0] & 0xF0) == 0x60) ? 0x86DD : 0x0800;
+		break;
+	default:
+		return false;
+	}
+
+	::memset(&key, 0, sizeof(key));
+	quint32 transport;
+	if (etherType == 0x0800) {
+		// Only the first fragment has the ports
+		if ((length < offset + 20) || ((data[offset] & 0xF0) != 0x40) || (BigEndian16(data + offset + 6) & 0x1FFF)) {
+			return false;
+		}
+		key.protocol = data[offset + 9];
+		key.address[0][10] = key.address[0][11] = 0xFF;
+		key.address[1][10] = key.address[1][11] = 0xFF;
+		::memcpy(&key.address[0][12], data + offset + 12, 4);
+		::memcpy(&key.address[1][12], data + offset + 16, 4);
+		transport = offset + (data[offset] & 0x0F) * 4;
+	} else if (etherType == 0x86DD) {
+		if (length < offset + 40) {
+			return false;
+		}
+		key.protocol = data[offset + 6];
+		::memcpy(key.address[0], data + offset + 8,  16);
+		::memcpy(key.address[1], data + offset + 24, 16);
+		transport = offset + 40;
+	} else {
+		return false;
+	}
+
+	// TCP, UDP and SCTP all start with the ports
+	if (((key.protocol != 6) && (key.protocol != 17) && (key.protocol != 132)) || (length < transport + 4)) {
+		return false;
+	}
+	key.port[0] = BigEndian16(data + transport);
+	key.port[1] = BigEndian16(data + transport + 2);
+
+	// Put the endpoints in a fixed order, so both directions match
+	const int order = ::memcmp(key.address[0], key.address[1], sizeof(key.address[0]));
+	if ((order > 0) || ((order == 0) && (key.port[0] > key.port[1]))) {
+		quint8 address[16];
+		::memcpy(address,        key.address[0], sizeof(address));
+		::memcpy(key.address[0], key.address[1], sizeof(address));
+		::memcpy(key.address[1], address,        sizeof(address));
+		qSwap(key.port[0], key.port[1]);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void FlowCorrelator::Rebuild(void)
+{
+	// Keep the live flows, and grow the table if they fill much of it
+	QVector<Slot> live;
+	live.reserve(m_usedSlots);
+	for (int index = 0; index < m_slots.size(); index++) {
+		if (m_slots.at(index).hash && (m_slots.at(index).expires > m_now)) {
+			live.append(m_slots.at(index));
+		}
+	}
+	int slotCount = m_slots.size();
+	if ((live.size() > slotCount / 2) && (slotCount < g_maxSlots)) {
+		slotCount *= 2;
+	}
+	m_slots = QVector<Slot>(slotCount);
+	::memset(m_slots.data(), 0, m_slots.size() * sizeof(Slot));
+	m_rebuildTime = m_now;
+	m_usedSlots   = 0;
+
+	// Drop any flow that can't be placed within the probe limit
+	const quint32 mask = m_slots.size() - 1;
+	for (int index = 0; index < live.size(); index++) {
+		quint32 slot  = live.at(index).hash & mask;
+		quint32 probe = 0;
+		while (m_slots.at(slot).hash && (probe < m_maxProbes)) {
+			slot = (slot + 1) & mask;
+			probe++;
+		}
+		if (probe < m_maxProbes) {
+			m_slots[slot] = live.at(index);
+			m_usedSlots++;
+		}
+	}
+}
@@ -0,0 +1,76 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef FLOW_CORRELATOR_H
+#define FLOW_CORRELATOR_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+//----------------------------------------------------------------------------
+// Learns which process owns each flow from the packets in the Hone capture,
+// and adds the process to matching packets in a capture of a regular network
+// interface.  Flows live in an open-addressing table with one cache line per
+// slot, keyed on the 5-tuple with the endpoints in a fixed order so both
+// directions find the same slot.  Flows that go quiet for the time to live
+// are treated as empty and dropped when the table is rebuilt.
+class FlowCorrelator
+{
+public:
+	FlowCorrelator(void);
+
+	quint32 Annotate(const char *data, const quint32 length, QByteArray &annotated);
+	void    Learn(const char *data, const quint32 length, const quint32 now);
+	void    SetTimeToLive(const quint32 seconds) { m_timeToLive = seconds; }
+
+private:
+	struct FlowKey {
+		quint8  address[2][16];
+		quint16 port[2];
+		quint8  protocol;
+	};
+
+	struct Slot {
+		quint32 hash;       // Zero for a slot that was never used
+		quint32 expires;
+		quint32 processId;
+		quint16 port[2];
+		quint8  protocol;
+		quint8  reserved[3];
+		quint8  address[2][16];
+		quint8  padding[12];
+	};
+
+	// Link types of the interfaces in the current section of a stream
+	typedef QVector<quint16> LinkTypes;
+
+	static quint32 Hash(const FlowKey &key);
+	const Slot    *Find(const FlowKey &key, const quint32 hash) const;
+	void           Insert(const FlowKey &key, const quint32 processId);
+	static bool    NoteInterface(const char *block, const quint32 blockLength, LinkTypes &linkTypes);
+	static bool    ParseFlow(const char *block, const quint32 blockLength, const LinkTypes &linkTypes, FlowKey &key);
+	void           Rebuild(void);
+
+	LinkTypes                  m_honeLinkTypes;
+	QByteArray                 m_honePending;
+	static const quint32       m_maxPaths;
+	static const quint32       m_maxProbes;
+	LinkTypes                  m_nicLinkTypes;
+	quint32                    m_now;
+	QHash<quint32, QByteArray> m_paths;
+	quint32                    m_rebuildTime;
+	QVector<Slot>              m_slots;
+	quint32                    m_timeToLive;
+	quint32                    m_usedSlots;
+};
+
+#endif // FLOW_CORRELATOR_H
@@ -10,14 +10,24 @@
 //----------------------------------------------------------------------------
 
 #include "hone_dumpcap.h"
+#include "block_scanner.h"
+#include "hone_pcapng.h"
+#include "hone_probes.h"
 
 #ifdef WIN32
 const int     HoneDumpcap::m_captureDataSize = 75000;
-const QString HoneDumpcap::m_driverFileName("\\\\.\\HoneOut");
 #else
 const int     HoneDumpcap::m_captureDataSize = 8192;
-const QString HoneDumpcap::m_driverFileName("/dev/hone");
 #endif
+const QString HoneDumpcap::m_driverFileName(QString::fromStdString(CaptureDriver::DefaultFileName()));
+
+// Saved captures are mapped a window at a time, so large files fit in a
+// 32-bit address space, and copied in much larger pieces than the driver
+// returns
+const qint64 HoneDumpcap::m_inputMapSize  = 256 * 1024 * 1024;
+const int    HoneDumpcap::m_inputReadSize = 1024 * 1024;
+
+const QString HoneDumpcap::m_defaultDaemonSocketName("/var/run/hone-dumpcap.sock");
 
 const QRegExp HoneDumpcap::m_newlineRegex("[\r\n]");
 
@@ -25,32 +35,72 @@ const QRegExp HoneDumpcap::m_newlineRegex("[\r\n]");
 HoneDumpcap::HoneDumpcap(QObject *parent)
 	: QObject(parent)
 	, m_autoRotateFiles(0)
-	, m_autoRotateFileCount(0)
-	, m_autoRotateFileSize(0)
-	, m_autoRotateMilliseconds(0)
-	, m_autoStopFileCount(0)
-	, m_autoStopFileSize(0)
-	, m_autoStopMilliseconds(0)
-	, m_autoStopPacketCount(0)
-	, m_captureData(m_captureDataSize, 0)
-	, m_captureFileCount(0)
-	, m_captureFileSize(0)
-	, m_captureStart(0)
+	, m_blockTimestampCount(0)
+	, m_busyPollSpin(0)
+	, m_busyPollUsec(0)
+	, m_captureDataLength(0)
+	, m_captureSink(NULL)
 	, m_captureState(CaptureStateNormal)
-	, m_cout(stdout, QIODevice::WriteOnly)
-	, m_driverHandle(InvalidFileHandle)
-	, m_dumpcapProcess(this)
+	, m_captureWriter(NULL)
+	, m_correlateFlows(false)
+#ifndef WIN32
+	, m_captureDaemon(NULL)
+#endif
+	, m_daemonBacklogSize(4 * 1024 * 1024)
+	, m_daemonClient(false)
+	, m_daemonSocketName(m_defaultDaemonSocketName)
+	, m_daemonSocketRequired(false)
+	, m_demux(false)
+	, m_demuxMode(CaptureDemux::ModeProcess)
+	, m_directIo(false)
+#ifndef WIN32
+	, m_directWriter(NULL)
+#endif
+#ifndef WIN32
+	, m_driverNotifier(NULL)
+#endif
+	, m_dumpcapProcess(NULL)
+	, m_exportCompress(false)
+#ifndef WIN32
+	, m_exportSink(NULL)
+#endif
+	, m_fileHasher(NULL)
+	, m_fileMover(NULL)
 	, m_haveHoneInterface(false)
+	, m_inputClock(0)
+	, m_inputData(NULL)
+	, m_inputIndex(0)
+	, m_inputOffset(0)
+	, m_inputSize(0)
+	, m_jobCount(1)
 	, m_lastLogHadAutoNewline(true)
 	, m_machineReadable(false)
 	, m_markCleanup(false)
 	, m_markRotate(false)
+	, m_metadata(false)
+	, m_metadataBucket(60)
+	, m_metadataSink(NULL)
 	, m_needEventLoop(false)
 	, m_operation(OperationCapture)
 	, m_packetCount(0)
-	, m_partialPacketHeader(false)
-	, m_partialPacketOffset(0)
+	, m_packetsReported(0)
+	, m_replayState(false)
+	, m_replayStatePending(false)
+	, m_rotateCut(false)
+	, m_sectionHeaderCount(0)
+	, m_sectionHeadersComplete(false)
+#ifndef WIN32
+	, m_sharedRing(NULL)
+#endif
+	, m_sharedRingSize(64)
+	, m_shedLoad(false)
+	, m_sizeRing(false)
 	, m_snapLen(65535)
+	, m_stagingBudget(256 * 1024 * 1024)
+	, m_topCount(0)
+	, m_topInterval(5)
+	, m_topReportTime(0)
+	, m_trackLatency(false)
 #ifdef WIN32
 	, m_signalPipeHandle(InvalidFileHandle)
 #endif
@@ -62,23 +112,55 @@ HoneDumpcap::HoneDumpcap(QObject *parent)
 //-----------------------------------------------------------------------------
 HoneDumpcap::~HoneDumpcap(void)
 {
-#ifdef WIN32
-	if (m_driverHandle != InvalidFileHandle) {
-		::CloseHandle(m_driverHandle);
-		m_driverHandle = InvalidFileHandle;
+	// Stop the writers before they can report packets to a dead object
+	foreach (CaptureWriter *writer, m_captureWriters) {
+		writer->Stop();
+	}
+#ifndef WIN32
+	if (m_directWriter) {
+		m_directWriter->Stop();
 	}
+#endif
+	delete m_fileHasher;
+	delete m_fileMover;
+	delete m_metadataSink;
+
+#ifdef WIN32
 	if (m_signalPipeHandle != InvalidFileHandle) {
 		::CloseHandle(m_signalPipeHandle);
 		m_signalPipeHandle = InvalidFileHandle;
 	}
 #else // #ifdef WIN32
-	if (m_driverHandle != InvalidFileHandle) {
-		::close(m_driverHandle);
-		m_driverHandle = InvalidFileHandle;
-	}
+	delete m_captureDaemon;
 #endif // #ifdef WIN32
 }
 
+//-----------------------------------------------------------------------------
+QString HoneDumpcap::CaptureFileName(const quint32 fileIndex, const qint64 openTime) const
+{
+	// Take the targets in turn when striping, and put each file in the shard
+	// for the time it was opened
+	const QDateTime openDateTime = QDateTime::fromMSecsSinceEpoch(openTime);
+	const QFileInfo fileInfo(m_captureTargets.at(fileIndex % m_captureTargets.size()));
+	QString dir = fileInfo.absolutePath();
+	if (!m_shardFormat.isEmpty()) {
+		dir = QString("%1/%2").arg(dir, openDateTime.toString(m_shardFormat));
+	}
+	return QString("%2/%3_%1_%4.%5").arg(fileIndex).arg(dir, fileInfo.completeBaseName(),
+			openDateTime.toString("yyyyMMddhhmmss"), fileInfo.suffix());
+}
+
+//-----------------------------------------------------------------------------
+qint64 HoneDumpcap::CaptureMsecs(void)
+{
+	// Saved captures keep the time of their packets rather than the time they
+	// are read
+	if (!m_inputFileNames.isEmpty()) {
+		return static_cast<qint64>(m_inputClock / 1000);
+	}
+	return MonotonicMsecs();
+}
+
 //-----------------------------------------------------------------------------
 bool HoneDumpcap::CapturePackets(void)
 {
@@ -93,99 +175,133 @@ bool HoneDumpcap::CapturePackets(void)
 				m_markCleanup = true;
 			}
 		}
-#else // #ifdef WIN32
-		fd_set readfds;
 #endif // #ifdef WIN32
 
 		if (m_markCleanup && (m_captureState != CaptureStateCleanUp)) {
 			if (!MarkRestart()) {
 				return false;
 			}
-			m_captureState = CaptureStateCleanUp;
+			// The daemon only sends complete blocks, and saved captures have
+			// been read to the end or don't need to be, so there is nothing to
+			// drain
+			m_captureState = (m_daemonClient || !m_inputFileNames.isEmpty()) ? CaptureStateDone : CaptureStateCleanUp;
 			m_markCleanup  = false;
 		}
 		if (m_markRotate && (m_captureState == CaptureStateNormal)) {
-			if (!MarkRestart()) {
-				return false;
+			HONE_PROBE1(file_rotate, m_rotation.FileCount());
+			if (m_daemonClient || !m_inputFileNames.isEmpty() || (m_rotateCut && m_sectionHeadersComplete)) {
+				// Only whole blocks have been written, so cut the file here and
+				// start the new one with the section headers the capture started
+				// with, rather than waiting for the driver to drain and restart
+				if (!WriteShedStatistics() || !WriteLatencyStatistics() || !OpenCaptureFile() || !WriteSectionHeaders()) {
+					return false;
+				}
+			} else {
+				if (!MarkRestart()) {
+					return false;
+				}
+				m_captureState = CaptureStateRotate;
 			}
-			m_captureState = CaptureStateRotate;
-			m_markRotate       = false;
+			m_markRotate = false;
 		}
 
-		quint32 bytesRead;
+		quint32       bytesRead;
+		const quint32 readSpace = m_captureData.size() - m_captureDataLength;
 		if (!ReadDriver(bytesRead)) {
 			return false;
 		}
 
+		// Judge how far behind we are by how full the reads come back and how
+		// much the writer has queued
+		bool shedLevelChanged = false;
+		if (m_shedLoad) {
+			const quint32 fill = static_cast<quint64>(bytesRead) * 100 / readSpace;
+			shedLevelChanged = m_loadShedder.Update(m_captureWriter ? qMax(fill, m_captureWriter->Backlog()) : fill);
+			if (shedLevelChanged && m_parentPid.isEmpty()) {
+				Log(QString("Load shedding level %1").arg(m_loadShedder.Level()));
+			}
+		}
+		if (m_topCount) {
+			const qint64 now = MonotonicMsecs();
+			m_trafficTop.Advance(now);
+			if ((now - m_topReportTime) >= m_topInterval * 1000) {
+				if (m_topReportTime) {
+					Log(m_trafficTop.Report(m_topCount, m_topInterval));
+				}
+				m_topReportTime = now;
+			}
+		}
+		if (m_sizeRing && !m_daemonClient) {
+			const quint32 ringPages = m_ringSizer.Update(bytesRead, bytesRead == readSpace, MonotonicMsecs());
+			if (ringPages != m_ringSizer.Pages()) {
+				ResizeDriverRing(ringPages);
+			}
+		}
+
 		if (bytesRead) {
-			const qint32 packetCount  = CountPackets(bytesRead);
-			const qint64 bytesWritten = m_captureFile.write(m_captureData.data(), bytesRead);
-			if (bytesWritten == -1) {
-				return LogError(QString("Cannot write %L1 bytes to %2: %3").arg(bytesRead)
-						.arg(m_captureFile.fileName(), m_captureFile.errorString()));
+			// Only write complete blocks, keeping any partial block at the end
+			// of the buffer until the rest of it arrives
+			const quint32 length = m_captureDataLength + bytesRead;
+			quint32 completeLength;
+			quint32 packetCount = CountPackets(length, completeLength);
+			quint32 keptLength  = completeLength;
+			if (!m_inputFileNames.isEmpty() && (m_rotation.NeedsClock() || m_autoRotateFiles)) {
+				// Time saved captures by their packets, so durations and file
+				// names mean the same as they did when the packets were captured
+				const bool started = (m_inputClock != 0);
+				quint32    scannedLength;
+				quint32    needed;
+				ScanBlocks(m_captureData.constData(), completeLength, ClockBlockStage(m_inputClock), scannedLength, needed);
+				if (!started && m_inputClock) {
+					m_rotation.Start(CaptureMsecs());
+				}
+			}
+			if (m_shedLoad) {
+				keptLength = m_loadShedder.Shed(m_captureData.data(), completeLength, packetCount);
 			}
-			if (bytesRead != bytesWritten) {
-				return LogError(QString("Only wrote %L1 of %L2 bytes to %3").arg(bytesWritten).arg(bytesRead)
-						.arg(m_captureFile.fileName()));
+			if (keptLength && !WriteBlocks(keptLength, packetCount)) {
+				return false;
+			}
+			if (shedLevelChanged && keptLength && !WriteShedStatistics()) {
+				return false;
 			}
-			if (!m_captureFile.flush()) {
-				return LogError(QString("Cannot flush %1: %2").arg(m_captureFile.fileName(),m_captureFile.errorString()));
+			m_captureDataLength = length - completeLength;
+			if (m_captureDataLength) {
+				::memmove(m_captureData.data(), m_captureData.constData() + completeLength, m_captureDataLength);
 			}
 
-			m_captureFileSize    += bytesWritten;
+			m_rotation.AddBytes(keptLength);
 			m_packetCount += packetCount;
-			if (m_parentPid.isEmpty()) {
-				Log(QString("\rPackets: %1").arg(m_packetCount), false);
-			} else {
-				WriteCommand('P', QString::number(packetCount));
-			}
 
-			// Handle stop and rotate conditions
-			if (
-					(m_autoStopFileCount    && (m_captureFileCount   >= m_autoStopFileCount  )) ||
-					(m_autoStopFileSize     && (m_captureFileSize    >= m_autoStopFileSize   )) ||
-					(m_autoStopPacketCount  && (m_packetCount >= m_autoStopPacketCount)) ||
-					(m_autoStopMilliseconds && ((QDateTime::currentMSecsSinceEpoch() - m_captureStart) > m_autoStopMilliseconds))) {
+			// Handle stop and rotate conditions, only reading the clock when a
+			// duration needs it
+			const CaptureRotation::Action action = m_rotation.Check(m_rotation.NeedsClock() ? CaptureMsecs() : 0, m_packetCount);
+			if (action == CaptureRotation::ActionStop) {
 				m_markCleanup = true;
-			} else if (
-					(m_autoRotateFileSize     && (m_captureFileSize >= m_autoRotateFileSize)) ||
-					(m_autoRotateMilliseconds && ((QDateTime::currentMSecsSinceEpoch() - m_captureStart) > m_autoRotateMilliseconds))) {
+			} else if ((action == CaptureRotation::ActionRotate) ||
+					(!m_stagedFileName.isEmpty() && ((m_fileMover->StagedBytes() + m_rotation.FileSize()) >= m_stagingBudget))) {
 				m_markRotate = true;
 			}
 		} else { // No data to read
 			switch (m_captureState) {
 			case CaptureStateCleanUp:
-#ifndef WIN32
-				if (::ioctl(m_driverHandle, HEIO_GET_AT_HEAD) <= 0) {
+				if (!m_driver.AtHead()) {
 					break;
 				}
-#endif // #ifdef WIN32
 				m_captureState = CaptureStateDone;
 				break;
 			case CaptureStateDone:
 				break;
 			case CaptureStateNormal:
-#ifdef WIN32
-				::Sleep(500);
-#else // #ifdef WIN32
-				FD_ZERO(&readfds);
-				FD_SET(m_driverHandle, &readfds);
-				if (-1 == ::select(m_driverHandle+1, &readfds, NULL, NULL, NULL)) {
-					if (errno == EINTR) {
-						m_markCleanup = true;
-					} else {
-						return LogError("Cannot check for data from the driver", true);
-					}
+				if (!WaitForDriver()) {
+					return false;
 				}
-#endif // #ifdef WIN32
 				break;
 			case CaptureStateRotate:
-#ifndef WIN32
-				if (::ioctl(m_driverHandle, HEIO_GET_AT_HEAD) <= 0) {
+				if (!m_driver.AtHead()) {
 					break;
 				}
-#endif // #ifdef WIN32
-				if (!OpenCaptureFile()) {
+				if (!WriteShedStatistics() || !WriteLatencyStatistics() || !OpenCaptureFile()) {
 					return false;
 				}
 				m_captureState = CaptureStateNormal;
@@ -194,74 +310,172 @@ bool HoneDumpcap::CapturePackets(void)
 		}
 	}
 
-	return true;
+	if (!WriteShedStatistics() || !WriteLatencyStatistics()) {
+		return false;
+	}
+
+	return FinishCapture();
 }
 
 //-----------------------------------------------------------------------------
 void HoneDumpcap::Cleanup(void)
 {
 	m_markCleanup = true;
-	if (m_dumpcapProcess.state() != QProcess::NotRunning) {
+	m_driver.Interrupt();
+	if (m_dumpcapProcess && (m_dumpcapProcess->state() != QProcess::NotRunning)) {
 #ifdef WIN32
-		m_dumpcapProcess.kill();
+		m_dumpcapProcess->kill();
 #else
-		m_dumpcapProcess.terminate();
+		m_dumpcapProcess->terminate();
 #endif
 	}
 }
 
 //-----------------------------------------------------------------------------
-quint32 HoneDumpcap::CountPackets(const quint32 length)
+bool HoneDumpcap::ConnectDaemon(void)
 {
-	struct PcapNgHeader {
-		quint32 blockType;
-		quint32 blockLength;
-	};
+#ifdef WIN32
+	return false;
+#else // #ifdef WIN32
+	struct sockaddr_un address;
+	const QByteArray   path = m_daemonSocketName.toLocal8Bit();
 
-	quint32 packetCount = 0;
-	quint32 offset      = 0;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= static_cast<int>(sizeof(address.sun_path))) {
+		return false;
+	}
+	strcpy(address.sun_path, path.data());
 
-	// Adjust offset if in middle of packet
-	if (m_partialPacketHeader) {
-		// The block type was at the end of the last buffer
-		const quint32 blockLength = *reinterpret_cast<const quint32*>(m_captureData.data());
-		offset = blockLength - sizeof(quint32); // Subtract block type
-		m_partialPacketHeader = false;
-	} else if (m_partialPacketOffset) {
-		offset = m_partialPacketOffset;
-		m_partialPacketOffset = 0;
+	const int handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (handle == -1) {
+		return false;
 	}
+	if (::connect(handle, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+		::close(handle);
+		return false;
+	}
+	m_driver.Attach(handle, QString("Capture daemon on %1").arg(m_daemonSocketName).toStdString());
+
+	// Spinning relies on driver IOCTLs
+	m_busyPollSpin = 0;
+	m_busyPollUsec = 0;
+	m_daemonClient = true;
+	return true;
+#endif // #ifdef WIN32
+}
 
-	// Handle case where the partial packet continues past end of this buffer
-	if (offset > length) {
-		m_partialPacketOffset = offset - length;
-		return 0;
+//-----------------------------------------------------------------------------
+quint32 HoneDumpcap::CountPackets(const quint32 length, quint32 &completeLength)
+{
+	const char *data = m_captureData.constData();
+	quint32     packetCount;
+	quint32     needed;
+
+	// Choose the scan for the features in use once per read, rather than
+	// testing for each feature on every block
+	m_blockTimestampCount = 0;
+	if (m_trackLatency && m_topCount) {
+		packetCount = ScanBlocks(data, length, BlockStages<LatencyBlockStage, TopBlockStage>(
+				LatencyBlockStage(m_blockTimestamps, m_blockTimestampCount), TopBlockStage(m_trafficTop)),
+				completeLength, needed);
+	} else if (m_trackLatency) {
+		packetCount = ScanBlocks(data, length, LatencyBlockStage(m_blockTimestamps, m_blockTimestampCount),
+				completeLength, needed);
+	} else if (m_topCount) {
+		packetCount = ScanBlocks(data, length, TopBlockStage(m_trafficTop), completeLength, needed);
+	} else {
+		packetCount = ScanBlocks(data, length, NullBlockStage(), completeLength, needed);
+	}
+	HONE_PROBE3(blocks_scanned, length, completeLength, packetCount);
+
+	// Make room for a partial block that is larger than the buffer.  The scan
+	// takes longer blocks than PCAPNG_MAX_BLOCK_LENGTH as corrupt, so this
+	// never grows past that.
+	if (needed > static_cast<quint32>(m_captureData.size())) {
+		m_captureData.resize((needed + 3) & ~3);
+		if (m_trackLatency) {
+			m_blockTimestamps.resize(m_captureData.size() / PCAPNG_MIN_PACKET_BLOCK_LENGTH);
+		}
 	}
 
-	// We're at the end of the partial packet, so count it
-	if (offset > 0) {
-		packetCount++;
+	return packetCount;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::FinishCapture(void)
+{
+	// Wait for the writers to drain before reporting that we're done
+	foreach (CaptureWriter *writer, m_captureWriters) {
+		writer->Stop();
+		if (!writer->Error().empty()) {
+			return LogError(QString::fromStdString(writer->Error()));
+		}
+	}
+	if (m_captureSink && !m_captureWriter && !m_captureSink->Close()) {
+		return LogError(QString::fromStdString(m_captureSink->Error()));
 	}
 
-	// Count packets
-	while (offset + sizeof(PcapNgHeader) <= length) {
-		const struct PcapNgHeader *header = reinterpret_cast<const struct PcapNgHeader*>(m_captureData.data() + offset);
-		if (offset + header->blockLength > length) {
-			// Calculate offset to the start of the next packet
-			const quint32 bytesRemaining = length - offset;
-			m_partialPacketOffset = header->blockLength - bytesRemaining;
-			break;
+#ifndef WIN32
+
+	// Give the collector a little while to catch up
+	if (m_exportSink) {
+		m_exportSink->Stop(5000);
+		if (m_parentPid.isEmpty()) {
+			Log(QString("Exported up to offset %L1, dropped %L2 bytes")
+					.arg(m_exportSink->BytesAcked()).arg(m_exportSink->BytesDropped()));
+			if (!m_exportSink->Error().isEmpty()) {
+				Log(QString("Last export error: %1").arg(m_exportSink->Error()));
+			}
 		}
-		packetCount++;
-		offset += header->blockLength;
 	}
 
-	// Handle case where last partial packet is too small to hold full header
-	if ((offset < length) && (m_partialPacketOffset == 0)) {
-		m_partialPacketHeader = true;
+	// Readers that already have the ring keep it, but no more can attach
+	if (m_sharedRing) {
+		m_sharedRing->Stop();
 	}
+#endif
 
-	return packetCount;
+	// Write out what the split files still have buffered
+	if (m_demux && !m_captureDemux.Close()) {
+		return LogError(m_captureDemux.Error());
+	}
+
+	// Export the last file's metadata
+	if (m_metadataSink && !m_metadataFileName.isEmpty()) {
+		if (!m_metadataSink->Flush(m_metadataFileName)) {
+			return LogError(m_metadataSink->Error());
+		}
+		m_metadataFileName.clear();
+	}
+
+	// Record the digest of the last file
+	if (m_fileHasher) {
+		m_fileHasher->Stop();
+		if (!m_fileHasher->Error().isEmpty()) {
+			return LogError(m_fileHasher->Error());
+		}
+	}
+
+	// Likewise wait for the last staged file to reach persistent storage
+	if (m_fileMover) {
+		const QString finalFileName = m_spillFileName;
+		if (!SpillCaptureFile()) {
+			return false;
+		}
+		m_fileMover->Stop();
+		if (!m_fileMover->Error().isEmpty()) {
+			return LogError(m_fileMover->Error());
+		}
+
+		// Wireshark keeps the last file it was told about, and the staged copy
+		// is gone, so point it at the moved file now that the move is done
+		if (!finalFileName.isEmpty() && !m_parentPid.isEmpty()) {
+			WriteCommand('F', finalFileName);
+		}
+	}
+
+	return true;
 }
 
 //-----------------------------------------------------------------------------
@@ -296,39 +510,163 @@ bool HoneDumpcap::Initialize(QStringList args, QString appPath)
 	m_dumpcapFileName = QString("%1/dumpcap_orig").arg(appPath);
 #endif
 
-	if (m_operation == OperationCapture) {
+	if (m_operation == OperationDaemon) {
+#ifndef WIN32
+		m_captureDaemon = new CaptureDaemon(m_daemonBacklogSize);
+		m_captureData.resize(m_captureDataSize);
+		if (!OpenDriver()) {
+			return false;
+		}
+		if (!m_captureDaemon->Listen(m_daemonSocketName, m_daemonGroup)) {
+			return LogError(m_captureDaemon->Error());
+		}
+		Log(QString("Sharing 'Hone' on %1").arg(m_daemonSocketName));
+#endif // #ifndef WIN32
+	} else if (m_operation == OperationCapture) {
+		if (!m_manifestFileName.isEmpty()) {
+			m_fileHasher = new FileHasher(this);
+			if (!m_fileHasher->OpenManifest(m_manifestFileName)) {
+				return LogError(m_fileHasher->Error());
+			}
+			m_fileHasher->start();
+		}
 		if (m_haveHoneInterface) {
-			m_captureStart = QDateTime::currentMSecsSinceEpoch();
-			if (m_parentPid.isEmpty()) {
+			m_rotation.Start(CaptureMsecs());
+			m_captureData.resize(m_inputFileNames.isEmpty() ? m_captureDataSize : m_inputReadSize);
+			if (!m_inputFileNames.isEmpty()) {
+				Log(QString("Reprocessing %1 saved capture(s)").arg(m_inputFileNames.size()));
+			} else if (m_parentPid.isEmpty()) {
 				Log("Capturing on 'Hone'");
 			}
-			if (!OpenDriver() || !OpenCaptureFile()) {
+			if (m_demux) {
+				// Keep each capture's split files together next to its first file
+				const QFileInfo target(m_captureTargets.first());
+				const QString   dirName = QString("%1/%2_%3_%4").arg(target.absolutePath(), target.completeBaseName(),
+						QDateTime::currentDateTime().toString("yyyyMMddhhmmss"),
+						(m_demuxMode == CaptureDemux::ModeProcess) ? "pid" : "connection");
+				if (!m_captureDemux.Open(m_demuxMode, dirName)) {
+					return LogError(m_captureDemux.Error());
+				}
+			}
+			if (m_metadata) {
+				m_metadataSink = new MetadataSink(m_metadataBucket);
+			}
+			// Give each output directory its own writer when striping
+			if (m_captureTargets.size() > 1) {
+				for (int target = 0; target < m_captureTargets.size(); target++) {
+					CaptureWriter *writer = new CaptureWriter(this);
+					connect(writer, SIGNAL(Written(quint32)), this, SLOT(OnWritten(quint32)), Qt::DirectConnection);
+					writer->SetLatencyHistogram(m_trackLatency ? &m_latency : NULL);
+					writer->start();
+					m_captureWriters.append(writer);
+				}
+			}
+#ifndef WIN32
+			if (m_directIo) {
+				m_directWriter = new DirectWriter(this);
+				connect(m_directWriter, SIGNAL(Written(quint32)), this, SLOT(OnWritten(quint32)), Qt::DirectConnection);
+				m_directWriter->start();
+			}
+#endif
+			if (m_trackLatency) {
+				m_blockTimestamps.resize(m_captureData.size() / PCAPNG_MIN_PACKET_BLOCK_LENGTH);
+			}
+			if (!m_stagingDir.isEmpty()) {
+				m_fileMover = new FileMover(this);
+				m_fileMover->start();
+			}
+#ifndef WIN32
+			if (!m_exportTarget.isEmpty()) {
+				m_exportSink = new ExportSink(m_exportTarget, m_exportCompress, this);
+				m_exportSink->start();
+			}
+			if (!m_sharedRingName.isEmpty()) {
+				m_sharedRing = new SharedRing(this);
+				if (!m_sharedRing->Open(m_sharedRingName, m_sharedRingSize * 1024 * 1024)) {
+					return LogError(m_sharedRing->Error());
+				}
+				m_sharedRing->start();
+			}
+#endif
+			if (!(m_inputFileNames.isEmpty() ? OpenDriver() : OpenInput(m_inputFileNames.at(m_inputIndex++))) || !OpenCaptureFile()) {
 				return false;
 			}
 		} else {
-			connect(&m_dumpcapProcess, SIGNAL(error(QProcess::ProcessError)),      this, SLOT(OnError(QProcess::ProcessError)));
-			connect(&m_dumpcapProcess, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(OnFinished(int,QProcess::ExitStatus)));
-			connect(&m_dumpcapProcess, SIGNAL(readyReadStandardError()),           this, SLOT(OnReadyReadStandardError()));
-			connect(&m_dumpcapProcess, SIGNAL(readyReadStandardOutput()),          this, SLOT(OnReadyReadStandardOutput()));
-			m_dumpcapProcess.start(m_dumpcapFileName, m_args);
+			QStringList dumpcapArgs = m_args;
+#ifndef WIN32
+			if (m_correlateFlows) {
+				// Read the Hone packets alongside the capture, and have dumpcap
+				// send the capture to us so we can add the processes to it
+				if (!OpenDriver() || !OpenCaptureFile()) {
+					return false;
+				}
+				if (!m_daemonClient) {
+					// Only the packet headers are needed to find the flows
+					m_driver.SetSnapLen(128);
+				}
+				m_captureData.resize(m_captureDataSize);
+				m_driverData.resize(m_captureDataSize);
+				m_driverNotifier = new QSocketNotifier(m_driver.Handle(), QSocketNotifier::Read, this);
+				connect(m_driverNotifier, SIGNAL(activated(int)), this, SLOT(OnDriverReadyRead()));
+
+				for (int index = 1; index < dumpcapArgs.size(); index++) {
+					if ((dumpcapArgs.at(index) == "-w") || (dumpcapArgs.at(index) == "-Z") || (dumpcapArgs.at(index) == "--correlate-ttl")) {
+						dumpcapArgs.erase(dumpcapArgs.begin() + index, dumpcapArgs.begin() + qMin(index + 2, dumpcapArgs.size()));
+						index--;
+					} else if (dumpcapArgs.at(index) == "--correlate") {
+						dumpcapArgs.removeAt(index);
+						index--;
+					}
+				}
+				dumpcapArgs << "-w" << "-" << "-n" << "-q";
+			}
+#endif
+			m_dumpcapProcess = new QProcess(this);
+			connect(m_dumpcapProcess, SIGNAL(error(QProcess::ProcessError)),      this, SLOT(OnError(QProcess::ProcessError)));
+			connect(m_dumpcapProcess, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(OnFinished(int,QProcess::ExitStatus)));
+			connect(m_dumpcapProcess, SIGNAL(readyReadStandardError()),           this, SLOT(OnReadyReadStandardError()));
+			connect(m_dumpcapProcess, SIGNAL(readyReadStandardOutput()),          this, SLOT(OnReadyReadStandardOutput()));
+			m_dumpcapProcess->start(m_dumpcapFileName, dumpcapArgs);
 			m_needEventLoop = true;
 		}
 	}
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::IsInputFile(const QString &fileName) const
+{
+	// Compare resolved paths, so links and relative names can't hide a match.
+	// A file that doesn't exist yet can't be an input.
+	const QString canonicalName = QFileInfo(fileName).canonicalFilePath();
+	if (canonicalName.isEmpty()) {
+		return false;
+	}
+	foreach (const QString &input, m_inputFileNames) {
+		if (QFileInfo(input).canonicalFilePath() == canonicalName) {
+			return true;
+		}
+	}
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 void HoneDumpcap::Log(const QString &msg, const bool autoNewLine)
 {
+	// Written straight to stdout, since a QTextStream would look up the
+	// locale's codec on every start, even for -D and -L
+	QMutexLocker locker(&m_outputMutex);
+	QByteArray   out;
 	if (autoNewLine && !m_lastLogHadAutoNewline) {
 		// Add a newline since the last log message didn't
-		m_cout << '\n';
+		out.append('\n');
 	}
-	m_cout << msg;
+	out.append(msg.toLocal8Bit());
 	if (autoNewLine) {
-		m_cout << '\n';
+		out.append('\n');
 	}
-	m_cout.flush();
+	::fwrite(out.constData(), out.size(), 1, stdout);
+	::fflush(stdout);
 	m_lastLogHadAutoNewline = autoNewLine;
 }
 
@@ -351,25 +689,66 @@ bool HoneDumpcap::LogError(QString msg, const bool useErrorCode, const bool auto
 //--------------------------------------------------------------------------
 bool HoneDumpcap::MarkRestart(void)
 {
-#ifdef WIN32
-	DWORD bytesReturned; // Unused, but required by DeviceIoControl()
-	if (!::DeviceIoControl(m_driverHandle, IOCTL_HONE_MARK_RESTART, NULL, 0, NULL, 0, &bytesReturned, NULL)) {
-		return LogError("Cannot send log restart IOCTL", true);
+	HONE_PROBE0(mark_restart);
+	if (!m_inputFileNames.isEmpty()) {
+		return true; // Reading saved captures, so there is no driver
 	}
-#else // #ifdef WIN32
-	if (::ioctl(m_driverHandle, HEIO_RESTART) == -1) {
-		return LogError("Cannot send log restart IOCTL", true);
+	if (!m_driver.MarkRestart()) {
+		return LogError(QString::fromStdString(m_driver.Error()));
 	}
-#endif // #ifdef WIN32
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+qint64 HoneDumpcap::MonotonicMsecs(void)
+{
+	// A coarse clock is plenty for the duration conditions and is much
+	// cheaper to read on every pass through the capture loop
+#ifdef WIN32
+	return ::GetTickCount64();
+#else // #ifdef WIN32
+	struct timespec now;
+#ifdef CLOCK_MONOTONIC_COARSE
+	::clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+#else
+	::clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+	return static_cast<qint64>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+#endif // #ifdef WIN32
+}
+
 //-----------------------------------------------------------------------------
 bool HoneDumpcap::NeedEventLoop(void)
 {
 	return m_needEventLoop;
 }
 
+//-----------------------------------------------------------------------------
+void HoneDumpcap::OnDriverReadyRead(void)
+{
+#ifndef WIN32
+	if (!m_driverNotifier->isEnabled()) {
+		return;
+	}
+
+	// Drain everything queued, so the flows are known before their packets
+	// come through from dumpcap
+	for (;;) {
+		quint32 bytesRead;
+		if (!m_driver.Read(m_driverData.data(), m_driverData.size(), bytesRead)) {
+			// Keep capturing without the process information
+			LogError(QString::fromStdString(m_driver.Error()));
+			m_driverNotifier->setEnabled(false);
+			break;
+		}
+		if (!bytesRead) {
+			break;
+		}
+		m_flowCorrelator.Learn(m_driverData.constData(), bytesRead, MonotonicMsecs() / 1000);
+	}
+#endif // #ifndef WIN32
+}
+
 //-----------------------------------------------------------------------------
 void HoneDumpcap::OnError(QProcess::ProcessError error)
 {
@@ -404,6 +783,17 @@ void HoneDumpcap::OnError(QProcess::ProcessError error)
 //-----------------------------------------------------------------------------
 void HoneDumpcap::OnFinished(int exitCode, QProcess::ExitStatus exitStatus)
 {
+	if (m_correlateFlows) {
+		// Write out the last of the capture, and pass on why dumpcap failed
+		// now that Wireshark can't hear it directly
+		OnReadyReadStandardOutput();
+		if (!FinishCapture() && !exitCode) {
+			exitCode = 1;
+		}
+		if (exitCode && !m_parentPid.isEmpty() && !m_dumpcapErrors.isEmpty()) {
+			LogError(QString::fromLocal8Bit(m_dumpcapErrors.constData(), m_dumpcapErrors.size()).trimmed());
+		}
+	}
 	if (!m_markCleanup) {
 		Log(QString("Dumpcap %1 with exit code %2").arg((exitStatus == QProcess::CrashExit) ? "crashed" : "exited").arg(exitCode));
 	}
@@ -413,8 +803,12 @@ void HoneDumpcap::OnFinished(int exitCode, QProcess::ExitStatus exitStatus)
 //-----------------------------------------------------------------------------
 void HoneDumpcap::OnReadyReadStandardError(void)
 {
-	const QByteArray err = m_dumpcapProcess.readAllStandardError();
-	if (!err.isEmpty()) {
+	const QByteArray err = m_dumpcapProcess->readAllStandardError();
+	if (m_correlateFlows && !m_parentPid.isEmpty()) {
+		// Dumpcap isn't talking Wireshark's protocol, so keep its last words
+		m_dumpcapErrors.append(err);
+		m_dumpcapErrors = m_dumpcapErrors.right(4096);
+	} else if (!err.isEmpty()) {
 		::fwrite(err.data(), err.length(), 1, stderr);
 		::fflush(stderr);
 	}
@@ -423,61 +817,127 @@ void HoneDumpcap::OnReadyReadStandardError(void)
 //-----------------------------------------------------------------------------
 void HoneDumpcap::OnReadyReadStandardOutput(void)
 {
-	const QByteArray out = m_dumpcapProcess.readAllStandardOutput();
-	if (!out.isEmpty()) {
+	const QByteArray out = m_dumpcapProcess->readAllStandardOutput();
+	if (m_correlateFlows) {
+		// Catch up on the Hone packets first, so new flows are known
+		OnDriverReadyRead();
+
+		// Only annotate complete blocks, keeping any partial block at the end
+		// of the buffer until the rest of it arrives
+		int consumed = 0;
+		while (consumed < out.size()) {
+			const quint32 copyLength = qMin(static_cast<quint32>(out.size() - consumed), m_captureData.size() - m_captureDataLength);
+			::memcpy(m_captureData.data() + m_captureDataLength, out.constData() + consumed, copyLength);
+			consumed += copyLength;
+
+			const quint32 length = m_captureDataLength + copyLength;
+			quint32 completeLength;
+			const quint32 packetCount = CountPackets(length, completeLength);
+			m_flowCorrelator.Annotate(m_captureData.constData(), completeLength, m_flowBlocks);
+			if (!WriteCaptureData(m_flowBlocks.constData(), m_flowBlocks.size(), packetCount)) {
+				m_dumpcapProcess->terminate();
+				return;
+			}
+			m_rotation.AddBytes(m_flowBlocks.size());
+			m_packetCount     += packetCount;
+			m_captureDataLength = length - completeLength;
+			if (m_captureDataLength) {
+				::memmove(m_captureData.data(), m_captureData.constData() + completeLength, m_captureDataLength);
+			}
+		}
+	} else if (!out.isEmpty()) {
 		::fwrite(out.data(), out.length(), 1, stdout);
 		::fflush(stdout);
 	}
 }
 
+//-----------------------------------------------------------------------------
+void HoneDumpcap::OnWritten(quint32 packetCount)
+{
+	ReportPackets(packetCount);
+}
+
 //--------------------------------------------------------------------------
 bool HoneDumpcap::OpenCaptureFile(void)
 {
-	const QString timestamp = QDateTime::currentDateTime().toString("yyyyMMddhhmmss");
+	// Saved captures name their files by the time of their packets
+	const qint64 openTime = (!m_inputFileNames.isEmpty() && m_inputClock) ? CaptureMsecs() :
+			QDateTime::currentMSecsSinceEpoch();
 	QString filename;
 
-	if (m_captureFileName.isEmpty()) {
+	// The previous file is complete, so its metadata can be exported
+	if (m_metadataSink && !m_metadataFileName.isEmpty() && !m_metadataSink->Flush(m_metadataFileName)) {
+		return LogError(m_metadataSink->Error());
+	}
+
+	if (m_captureTargets.isEmpty()) {
 		// Format temporary file name
+		const QString timestamp = QDateTime::fromMSecsSinceEpoch(openTime).toString("yyyyMMddhhmmss");
 		filename = QString("%1/hone_dumpcap_%2_XXXXXX.pcapng").arg(QDir::tempPath(), timestamp);
 		QTemporaryFile tempFile(filename);
 		if (!tempFile.open()) {
-			return LogError(QString("Cannot create temporary file with template %1: %2").arg(filename, m_captureFile.errorString()));
+			return LogError(QString("Cannot create temporary file with template %1: %2").arg(filename, tempFile.errorString()));
 		}
 		filename = tempFile.fileName();
 		tempFile.close();
-	} else {
-		// Format file name
-		if (m_autoRotateFiles) {
-			QFileInfo fileInfo(m_captureFileName);
-			filename = QString("%2/%3_%1_%4.%5").arg(m_captureFileCount).arg(fileInfo.filePath(),
-					fileInfo.completeBaseName(), timestamp, fileInfo.suffix());
-		} else {
-			filename = m_captureFileName;
+	} else if (m_autoRotateFiles) {
+		filename = CaptureFileName(m_rotation.FileCount(), openTime);
+		if (!m_shardFormat.isEmpty() && !QDir().mkpath(QFileInfo(filename).absolutePath())) {
+			return LogError(QString("Cannot create directory %1").arg(QFileInfo(filename).absolutePath()));
 		}
+	} else {
+		filename = m_captureTargets.first();
+	}
+
+	// Write to the staging area while it has room, and straight to the
+	// target once the mover falls too far behind
+	QString openFilename = filename;
+	if (!SpillCaptureFile()) {
+		return false;
+	}
+	if (m_fileMover && ((m_fileMover->StagedBytes() + m_rotation.Rotate().fileSize) < m_stagingBudget)) {
+		openFilename     = QString("%1/%2").arg(m_stagingDir, QFileInfo(filename).fileName());
+		m_spillFileName  = filename;
+		m_stagedFileName = openFilename;
 	}
 
-	m_captureFile.setFileName(filename);
-	if (!m_captureFile.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Unbuffered)) {
-		return LogError(QString("Cannot open %1 for writing: %2").arg(filename, m_captureFile.errorString()));
+#ifndef WIN32
+	if (m_directWriter) {
+		m_captureSink = m_directWriter;
+	} else
+#endif
+	if (m_captureWriters.isEmpty()) {
+		m_captureSink = &m_fileSink;
+	} else {
+		m_captureWriter = m_captureWriters.at(m_rotation.FileCount() % m_captureWriters.size());
+		m_captureSink   = m_captureWriter;
+	}
+	if (!m_captureSink->Open(QFile::encodeName(openFilename).constData())) {
+		return LogError(QString::fromStdString(m_captureSink->Error()));
 	}
 
-	m_captureFileNames.enqueue(filename);
-	if (m_autoRotateFileCount) {
-		while (m_captureFileNames.size() > static_cast<qint32>(m_autoRotateFileCount)) {
-			const QString removeFilename = m_captureFileNames.dequeue();
-			if (!QFile::remove(removeFilename)) {
-				return LogError(QString("Cannot remove %1").arg(removeFilename));
-			}
-		}
+	if (m_fileHasher && !m_fileHasher->Begin(filename)) {
+		return LogError(m_fileHasher->Error());
 	}
+	m_metadataFileName = filename;
+
+	// Replay the known processes and connections into every file after the
+	// first, so each file can be read on its own
+	m_replayStatePending = m_replayState && m_rotation.FileCount();
 
-	m_captureFile.flush();
-	m_captureFileCount++;
-	m_captureFileSize = 0;
+	// Delete the oldest file once -b files:NUM are kept
+	HONE_PROBE2(file_open, openFilename.toLocal8Bit().constData(), m_rotation.FileCount());
+	CaptureRotation::RetainedFile expired;
+	if (m_rotation.OpenFile(CaptureMsecs(), openTime, expired) && !RemoveCaptureFile(expired)) {
+		return false;
+	}
+	// Wireshark follows a staged file where it is written.  It has moved on
+	// to the next file by the time the mover deletes it, and FinishCapture
+	// tells it where the last one ends up.
 	if (m_parentPid.isEmpty()) {
-		Log(QString("File: %1").arg(filename));
+		Log(QString("File: %1").arg(openFilename));
 	} else {
-		WriteCommand('F', filename);
+		WriteCommand('F', openFilename);
 	}
 	return true;
 }
@@ -485,12 +945,21 @@ bool HoneDumpcap::OpenCaptureFile(void)
 //-----------------------------------------------------------------------------
 bool HoneDumpcap::OpenDriver(void)
 {
-#ifdef WIN32
-	m_driverHandle = ::CreateFileA(m_driverFileName.toLatin1().data(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, 0);
-	if (m_driverHandle == InvalidFileHandle) {
-		return LogError(QString("Cannot open driver %1").arg(m_driverFileName), true);
+	// Share a running daemon's reader if there is one
+	if (m_operation == OperationCapture) {
+		if (ConnectDaemon()) {
+			return true;
+		}
+		if (m_daemonSocketRequired) {
+			return LogError(QString("Cannot connect to capture daemon on %1").arg(m_daemonSocketName), true);
+		}
 	}
 
+	if (!m_driver.Open(m_driverFileName.toStdString())) {
+		return LogError(QString::fromStdString(m_driver.Error()));
+	}
+
+#ifdef WIN32
 	// On Windows, Wireshark uses a named pipe to signal the child when to exit
 	if (!m_parentPid.isEmpty() && (m_parentPid != "none")) {
 		QString pipename = QString("\\\\.\\pipe\\wireshark.%1.signal").arg(m_parentPid);
@@ -500,14 +969,63 @@ bool HoneDumpcap::OpenDriver(void)
 		}
 	}
 #else // #ifdef WIN32
-	m_driverHandle = ::open(m_driverFileName.toLatin1().data(), O_RDONLY | O_NONBLOCK, 0);
-	if (m_driverHandle == InvalidFileHandle) {
-		return LogError(QString("Cannot open driver %1").arg(m_driverFileName), true);
+	// Start from the driver's ring size, pulled within the bounds
+	if (m_sizeRing) {
+		int ringPages = 0;
+		if (!m_driver.RingPages(ringPages)) {
+			Log(QString("Driver %1 cannot report its ring size, so it will not be resized").arg(m_driverFileName));
+			m_sizeRing = false;
+		} else {
+			m_ringSizer.SetPages(ringPages, ::sysconf(_SC_PAGESIZE));
+			const quint32 boundedPages = qBound(m_ringSizer.MinPages(), static_cast<quint32>(ringPages), m_ringSizer.MaxPages());
+			if (boundedPages != static_cast<quint32>(ringPages)) {
+				ResizeDriverRing(boundedPages);
+			}
+		}
 	}
 #endif // #ifdef WIN32
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::OpenInput(const QString &fileName)
+{
+	m_inputFile.setFileName(fileName);
+	if (!m_inputFile.open(QIODevice::ReadOnly)) {
+		return LogError(QString("Cannot open %1: %2").arg(fileName, m_inputFile.errorString()));
+	}
+	m_inputOffset = 0;
+	m_inputSize   = m_inputFile.size();
+
+	// Pass the file through as is, so it only has to start like a capture
+	quint32 blockType = 0;
+	if (m_inputSize && ((m_inputFile.read(reinterpret_cast<char*>(&blockType), sizeof(blockType)) != sizeof(blockType)) ||
+			(blockType != PCAPNG_SECTION_HEADER_BLOCK))) {
+		return LogError(QString("%1 is not a PCAP-NG file").arg(fileName));
+	}
+
+	// Start the clock with the first packet, which the first capture file is
+	// named for.  A file with no packets near its start leaves it to the
+	// capture loop.
+	if (!m_inputClock && m_inputFile.seek(0)) {
+		QByteArray    start(static_cast<int>(qMin(m_inputSize, Q_INT64_C(64 * 1024))), 0);
+		const qint64  length = m_inputFile.read(start.data(), start.size());
+		quint32       offset = 0;
+		while (!m_inputClock && (offset < length)) {
+			const quint32 blockLength = PcapNgBlockLength(start.constData() + offset, length - offset);
+			if (!blockLength) {
+				break;
+			}
+			ClockBlockStage(m_inputClock).Block(reinterpret_cast<const PcapNgBlockHeader*>(start.constData() + offset));
+			offset += blockLength;
+		}
+		if (m_inputClock) {
+			m_rotation.Start(CaptureMsecs());
+		}
+	}
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 bool HoneDumpcap::ParseArgs(void)
 {
@@ -525,7 +1043,7 @@ bool HoneDumpcap::ParseArgs(void)
 				errors.append(QString("You must supply a condition with the %1 option").arg(m_args.at(index)));
 			}
 			index++;
-			if (!ParseCondition(m_args.at(index), m_autoStopMilliseconds, m_autoStopFileSize, m_autoStopFileCount)) {
+			if (!ParseCondition(m_args.at(index), m_rotation.Stop())) {
 				errors.append(QString("Invalid condition %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
 			}
 		} else if (m_args.at(index) == "-b") {
@@ -533,7 +1051,7 @@ bool HoneDumpcap::ParseArgs(void)
 				errors.append(QString("You must supply a condition with the %1 option").arg(m_args.at(index)));
 			}
 			index++;
-			if (!ParseCondition(m_args.at(index), m_autoRotateMilliseconds, m_autoRotateFileSize, m_autoRotateFileCount)) {
+			if (!ParseCondition(m_args.at(index), m_rotation.Rotate())) {
 				errors.append(QString("Invalid condition %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
 			}
 			m_autoRotateFiles = true;
@@ -542,7 +1060,7 @@ bool HoneDumpcap::ParseArgs(void)
 				errors.append(QString("You must supply a packet count with the %1 option").arg(m_args.at(index)));
 			}
 			index++;
-			m_autoStopPacketCount = m_args.at(index).toUInt(&ok);
+			m_rotation.Stop().packetCount = m_args.at(index).toULongLong(&ok);
 			if (!ok) {
 				errors.append(QString("Invalid packet count %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
 			}
@@ -568,6 +1086,12 @@ bool HoneDumpcap::ParseArgs(void)
 			printLinkLayerTypes = true;
 		} else if (m_args.at(index) == "-M") {
 			m_machineReadable = true;
+		} else if (m_args.at(index) == "-r") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a file name with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_inputFileNames.append(m_args.at(index));
 		} else if (m_args.at(index) == "-s") {
 			if (index+1 >= m_args.size()) {
 				errors.append(QString("You must supply a snap length with the %1 option").arg(m_args.at(index)));
@@ -582,36 +1106,348 @@ bool HoneDumpcap::ParseArgs(void)
 				errors.append(QString("You must supply a file name with the %1 option").arg(m_args.at(index)));
 			}
 			index++;
-			m_captureFileName = m_args.at(index);
+			// A directory gets the default file name, so several disks can be
+			// listed without repeating it
+			if (QFileInfo(m_args.at(index)).isDir()) {
+				m_captureTargets.append(QString("%1/hone_dumpcap.pcapng").arg(m_args.at(index)));
+			} else {
+				m_captureTargets.append(m_args.at(index));
+			}
 		} else if (m_args.at(index) == "-Z") {
 			if (index+1 >= m_args.size()) {
 				errors.append(QString("You must supply a PID or \"none\" with the %1 option").arg(m_args.at(index)));
 			}
 			index++;
 			m_parentPid = m_args.at(index);
-		} else if (m_args.at(index) == "-h") {
-			return Usage(m_args.at(0));
-		} else {
-			// Silently ignore unknown options for now
-			//Log(QString("Ignoring unknown option %1").arg(m_args.at(index)));
-		}
-	}
-
-	if (!haveInterface) {
-		m_haveHoneInterface = true;
-	}
-
-	// Check options
-	if (printInterfaces && printLinkLayerTypes) {
-		errors.append("The '-D' and '-L' options are mutually exclusive");
-	}
-	if (printInterfaces) {
-		m_operation = OperationPrintInterfaces;
-	} else if (printLinkLayerTypes) {
-		m_operation = OperationPrintLinkLayerTypes;
-	}
-
-	if (!errors.isEmpty()) {
+		} else if (m_args.at(index) == "--busy-poll") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a time in microseconds with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_busyPollUsec = m_args.at(index).toUInt(&ok);
+			if (!ok) {
+				errors.append(QString("Invalid busy-poll time %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index-1)));
+#endif
+			m_busyPollSpin = m_busyPollUsec;
+		} else if (m_args.at(index) == "--correlate") {
+			m_correlateFlows = true;
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index)));
+#endif
+		} else if (m_args.at(index) == "--correlate-ttl") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a time in seconds with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			const quint32 timeToLive = m_args.at(index).toUInt(&ok);
+			if (!ok || !timeToLive) {
+				errors.append(QString("Invalid time to live %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+			m_flowCorrelator.SetTimeToLive(timeToLive);
+		} else if (m_args.at(index) == "--daemon") {
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index)));
+#endif
+			m_operation = OperationDaemon;
+		} else if (m_args.at(index) == "--daemon-backlog") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a size with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			const quint64 backlogSize = m_args.at(index).toULongLong(&ok);
+			ok                  = ok && (backlogSize <= Q_INT64_C(0x7FFFFFFFFFFFFFFF) / 1024);
+			m_daemonBacklogSize = static_cast<qint64>(backlogSize) * 1024; // Convert to KB
+			if (!ok) {
+				errors.append(QString("Invalid backlog size %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "--daemon-group") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a group with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_daemonGroup = m_args.at(index);
+		} else if (m_args.at(index) == "--daemon-socket") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a socket name with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_daemonSocketName     = m_args.at(index);
+			m_daemonSocketRequired = true;
+		} else if (m_args.at(index) == "--demux") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply pid or connection with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			if (m_args.at(index) == "pid") {
+				m_demuxMode = CaptureDemux::ModeProcess;
+			} else if (m_args.at(index) == "connection") {
+				m_demuxMode = CaptureDemux::ModeConnection;
+			} else {
+				errors.append(QString("Invalid split %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+			m_demux = true;
+		} else if (m_args.at(index) == "--direct-io") {
+			m_directIo = true;
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index)));
+#endif
+		} else if (m_args.at(index) == "--export") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a collector address with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_exportTarget = m_args.at(index);
+			if (!m_exportTarget.startsWith("unix:") && !m_exportTarget.contains(QRegExp(":\\d+$"))) {
+				errors.append(QString("Invalid collector address %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index-1)));
+#endif
+		} else if (m_args.at(index) == "--export-compress") {
+			m_exportCompress = true;
+		} else if (m_args.at(index) == "--jobs") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a job count with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_jobCount = m_args.at(index).toInt(&ok);
+			if (!ok || (m_jobCount < 1)) {
+				errors.append(QString("Invalid job count %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "--latency") {
+			m_trackLatency = true;
+		} else if (m_args.at(index) == "--manifest") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a file name with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_manifestFileName = m_args.at(index);
+		} else if (m_args.at(index) == "--metadata") {
+			m_metadata = true;
+		} else if (m_args.at(index) == "--metadata-bucket") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a number of seconds with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_metadataBucket = m_args.at(index).toUInt(&ok);
+			if (!ok || !m_metadataBucket) {
+				errors.append(QString("Invalid bucket length %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+			m_metadata = true;
+		} else if (m_args.at(index) == "--replay-state") {
+			m_replayState = true;
+		} else if (m_args.at(index) == "--ring-pages") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply page bounds with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			const QStringList bounds = m_args.at(index).split(':');
+			bool minOk = false, maxOk = false;
+			const quint32 minPages = bounds.first().toUInt(&minOk);
+			const quint32 maxPages = bounds.last().toUInt(&maxOk);
+			if ((bounds.size() != 2) || !minOk || !maxOk || !minPages || (minPages > maxPages)) {
+				errors.append(QString("Invalid page bounds %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index-1)));
+#endif
+			m_ringSizer.SetBounds(minPages, maxPages);
+			m_sizeRing = true;
+		} else if (m_args.at(index) == "--rotate-cut") {
+			m_rotateCut = true;
+		} else if (m_args.at(index) == "--shard") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply day or hour with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			if (m_args.at(index) == "day") {
+				m_shardFormat = "yyyy-MM-dd";
+			} else if (m_args.at(index) == "hour") {
+				m_shardFormat = "yyyy-MM-dd/hh";
+			} else {
+				errors.append(QString("Invalid shard %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "--shed") {
+			m_shedLoad = true;
+		} else if (m_args.at(index) == "--shed-sample") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a sample rate with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			const quint32 sampleRate = m_args.at(index).toUInt(&ok);
+			if (!ok || !sampleRate) {
+				errors.append(QString("Invalid sample rate %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+			m_loadShedder.SetSampleRate(sampleRate);
+			m_shedLoad = true;
+		} else if (m_args.at(index) == "--shed-snaplen") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a snap length with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			const quint32 snapLen = m_args.at(index).toUInt(&ok);
+			if (!ok || !snapLen) {
+				errors.append(QString("Invalid snap length %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+			m_loadShedder.SetSnapLen(snapLen);
+			m_shedLoad = true;
+		} else if (m_args.at(index) == "--shm-ring") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a socket name with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_sharedRingName = m_args.at(index);
+#ifdef WIN32
+			errors.append(QString("The %1 option is not supported on Windows").arg(m_args.at(index-1)));
+#endif
+		} else if (m_args.at(index) == "--shm-ring-size") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a size in MB with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_sharedRingSize = m_args.at(index).toUInt(&ok);
+			if (!ok || (m_sharedRingSize < 4) || (m_sharedRingSize > 4095)) {
+				errors.append(QString("Invalid size %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "--staging") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a directory with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_stagingDir = QFileInfo(m_args.at(index)).absoluteFilePath();
+			if (!QFileInfo(m_stagingDir).isDir()) {
+				errors.append(QString("Staging directory %1 does not exist").arg(m_args.at(index)));
+			}
+		} else if (m_args.at(index) == "--staging-size") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a size with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_stagingBudget = static_cast<qint64>(m_args.at(index).toUInt(&ok)) * 1024 * 1024; // Convert to MB
+			if (!ok || !m_stagingBudget) {
+				errors.append(QString("Invalid staging size %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "--top") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a process count with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_topCount = m_args.at(index).toInt(&ok);
+			if (!ok || (m_topCount <= 0)) {
+				errors.append(QString("Invalid process count %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "--top-interval") {
+			if (index+1 >= m_args.size()) {
+				errors.append(QString("You must supply a time in seconds with the %1 option").arg(m_args.at(index)));
+			}
+			index++;
+			m_topInterval = m_args.at(index).toInt(&ok);
+			if (!ok || (m_topInterval <= 0) || (m_topInterval > 60)) {
+				errors.append(QString("Invalid interval %1 with the %2 option").arg(m_args.at(index), m_args.at(index-1)));
+			}
+		} else if (m_args.at(index) == "-h") {
+			return Usage(m_args.at(0));
+		} else {
+			// Silently ignore unknown options for now
+			//Log(QString("Ignoring unknown option %1").arg(m_args.at(index)));
+		}
+	}
+
+	if (!haveInterface) {
+		m_haveHoneInterface = true;
+	}
+
+	// Check options
+	if ((m_operation == OperationDaemon) && (printInterfaces || printLinkLayerTypes)) {
+		errors.append("The '--daemon' option cannot be used with '-D' or '-L'");
+	}
+	if (!m_daemonGroup.isEmpty() && (m_operation != OperationDaemon)) {
+		errors.append("The '--daemon-group' option requires the '--daemon' option");
+	}
+	if (printInterfaces && printLinkLayerTypes) {
+		errors.append("The '-D' and '-L' options are mutually exclusive");
+	}
+	if (m_autoRotateFiles && m_captureTargets.isEmpty()) {
+		errors.append("The '-b' option requires the '-w' option");
+	}
+	if (m_captureTargets.size() > 1) {
+		if (!m_autoRotateFiles) {
+			errors.append("Writing to more than one '-w' target requires the '-b' option");
+		} else if (m_rotation.Rotate().fileCount && (m_rotation.Rotate().fileCount < static_cast<quint32>(m_captureTargets.size()))) {
+			errors.append("The '-b files:NUM' option must keep at least one file per '-w' target");
+		}
+	}
+	if (m_correlateFlows && (m_haveHoneInterface || m_autoRotateFiles || (m_captureTargets.size() > 1))) {
+		errors.append("The '--correlate' option needs a non-Hone interface, and cannot be used with '-b' or several '-w' targets");
+	}
+	if (m_demux && (!m_haveHoneInterface || m_captureTargets.isEmpty())) {
+		errors.append("The '--demux' option requires the Hone interface and the '-w' option");
+	}
+	if (m_metadata && (!m_haveHoneInterface || m_captureTargets.isEmpty())) {
+		errors.append("The '--metadata' option requires the Hone interface and the '-w' option");
+	}
+	if (m_directIo && (m_captureTargets.size() > 1)) {
+		errors.append("The '--direct-io' option cannot be used with more than one '-w' target");
+	}
+	if (m_topCount && !m_parentPid.isEmpty()) {
+		errors.append("The '--top' option cannot be used with the '-Z' option");
+	}
+	if (!m_sharedRingName.isEmpty() && !m_haveHoneInterface) {
+		errors.append("The '--shm-ring' option requires the Hone interface");
+	}
+	if (!m_shardFormat.isEmpty() && !m_autoRotateFiles) {
+		errors.append("The '--shard' option requires the '-b' option");
+	}
+	if (!m_stagingDir.isEmpty() && (m_captureTargets.isEmpty() || !m_autoRotateFiles)) {
+		errors.append("The '--staging' option requires the '-w' and '-b' options");
+	}
+	if (!m_manifestFileName.isEmpty() && !m_haveHoneInterface && !m_correlateFlows) {
+		errors.append("The '--manifest' option requires the Hone interface or the '--correlate' option");
+	}
+	if (!m_inputFileNames.isEmpty()) {
+		if (haveInterface && !m_haveHoneInterface) {
+			errors.append("The '-r' option reads Hone captures, so it cannot be used with another interface");
+		}
+		if (m_captureTargets.isEmpty()) {
+			errors.append("The '-r' option requires the '-w' option");
+		}
+		if ((m_operation == OperationDaemon) || !m_parentPid.isEmpty() || m_correlateFlows || m_shedLoad || m_sizeRing) {
+			errors.append("The '-r' option cannot be used with '-Z', '--correlate', '--daemon', '--shed' or '--ring-pages'");
+		}
+		if ((m_jobCount > 1) && (m_inputFileNames.size() > 1)) {
+			if (m_captureTargets.size() > 1) {
+				errors.append("The '--jobs' option cannot be used with more than one '-w' target");
+			}
+			m_operation = OperationReprocessJobs;
+		} else if (!m_autoRotateFiles) {
+			// Opening the target truncates it, so it can't be a file being read
+			foreach (const QString &target, m_captureTargets) {
+				if (IsInputFile(target)) {
+					errors.append(QString("The '-w' target %1 is also a '-r' input").arg(target));
+				}
+			}
+		}
+	} else if (m_jobCount > 1) {
+		errors.append("The '--jobs' option requires the '-r' option");
+	}
+	if (m_rotateCut && !m_autoRotateFiles) {
+		errors.append("The '--rotate-cut' option requires the '-b' option");
+	}
+	// Without a driver restart, nothing else describes the processes and
+	// connections that were already running when a rotated file starts
+	if (m_rotateCut) {
+		m_replayState = true;
+	}
+	if (printInterfaces) {
+		m_operation = OperationPrintInterfaces;
+	} else if (printLinkLayerTypes) {
+		m_operation = OperationPrintLinkLayerTypes;
+	}
+
+	if (!errors.isEmpty()) {
 		return Usage(m_args.at(0), errors.join("\n"));
 	}
 
@@ -619,22 +1455,26 @@ bool HoneDumpcap::ParseArgs(void)
 }
 
 //----------------------------------------------------------------------------
-bool HoneDumpcap::ParseCondition(const QString &condition, qint64 &duration, quint32 &fileSize, quint32 &fileCount)
+bool HoneDumpcap::ParseCondition(const QString &condition, CaptureRotation::Conditions &conditions)
 {
 	QStringList tokens = condition.split(':');
 	if (tokens.size() != 2) {
 		return false;
 	}
 
+	// Parse and scale in 64 bits, so large sizes and durations don't wrap
 	bool rc = true;
-	const quint32 val = tokens[1].toUInt(&rc);
+	const quint64 val = tokens[1].toULongLong(&rc);
 	if (rc) {
 		if (tokens[0] == "duration") {
-			duration = val * 1000; // Convert to milliseconds
+			rc                      = (val <= Q_INT64_C(0x7FFFFFFFFFFFFFFF) / 1000);
+			conditions.milliseconds = static_cast<qint64>(val) * 1000; // Convert to milliseconds
 		} else if (tokens[0] == "filesize") {
-			fileSize = val * 1024; // Convert to KB
+			rc                  = (val <= Q_UINT64_C(0xFFFFFFFFFFFFFFFF) / 1024);
+			conditions.fileSize = val * 1024; // Convert to KB
 		} else if (tokens[0] == "files") {
-			fileCount = val;
+			rc                   = (val <= 0xFFFFFFFF);
+			conditions.fileCount = static_cast<quint32>(val);
 		} else {
 			rc = false;
 		}
@@ -743,38 +1583,253 @@ bool HoneDumpcap::Process(void)
 	case OperationCapture:
 		rc = CapturePackets();
 		break;
+	case OperationDaemon:
+		rc = RunDaemon();
+		break;
 	case OperationPrintInterfaces:
 		rc = PrintInterfaces();
 		break;
 	case OperationPrintLinkLayerTypes:
 		rc = PrintLinkTypes();
 		break;
+	case OperationReprocessJobs:
+		rc = RunJobs();
+		break;
 	}
 	return rc;
 }
 
 //-----------------------------------------------------------------------------
 bool HoneDumpcap::ReadDriver(quint32 &bytesRead)
+{
+	if (!m_inputFileNames.isEmpty()) {
+		return ReadInput(bytesRead);
+	}
+
+	HONE_PROBE0(driver_read_start);
+	if (!m_driver.Read(m_captureData.data() + m_captureDataLength, m_captureData.size() - m_captureDataLength, bytesRead)) {
+		return LogError(QString::fromStdString(m_driver.Error()));
+	}
+
+	HONE_PROBE1(driver_read_done, bytesRead);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::ReadInput(quint32 &bytesRead)
 {
 	bytesRead = 0;
-#ifdef WIN32
-	DWORD driverBytesRead;
-	if (!::ReadFile(m_driverHandle, m_captureData.data(), m_captureData.size(), &driverBytesRead, NULL)) {
-		return LogError(QString("Cannot read %L1 bytes from %2").arg(m_captureData.size()).arg(m_driverFileName), true);
+
+	// Move on to the next file at the end of each one, and stop after the last
+	while (m_inputOffset == m_inputSize) {
+		if (m_captureDataLength) {
+			Log(QString("Dropping a partial block of %L1 bytes at the end of %2")
+					.arg(m_captureDataLength).arg(m_inputFile.fileName()));
+			m_captureDataLength = 0;
+		}
+		m_inputFile.close();
+		if (m_inputIndex == m_inputFileNames.size()) {
+			m_captureState = CaptureStateDone;
+			return true;
+		}
+		if (!OpenInput(m_inputFileNames.at(m_inputIndex++))) {
+			return false;
+		}
 	}
-	bytesRead = driverBytesRead;
-#else // #ifdef WIN32
-	const ssize_t driverBytesRead = ::read(m_driverHandle, m_captureData.data(), m_captureData.size());
-	if ((driverBytesRead == -1)) {
-		if ((errno != EINTR) && (errno != EAGAIN)) {
-			return LogError(QString("Cannot read %L1 bytes from %2").arg(m_captureData.size()).arg(m_driverFileName), true);
+
+	const qint64 windowStart = m_inputOffset - (m_inputOffset % m_inputMapSize);
+	const qint64 windowEnd   = qMin(windowStart + m_inputMapSize, m_inputSize);
+	if (!m_inputData) {
+		m_inputData = m_inputFile.map(windowStart, windowEnd - windowStart);
+		if (!m_inputData) {
+			return LogError(QString("Cannot map %1: %2").arg(m_inputFile.fileName(), m_inputFile.errorString()));
 		}
+#ifndef WIN32
+		::madvise(m_inputData, windowEnd - windowStart, MADV_SEQUENTIAL);
+#endif
+	}
+
+	bytesRead = qMin(static_cast<qint64>(m_captureData.size() - m_captureDataLength), windowEnd - m_inputOffset);
+	::memcpy(m_captureData.data() + m_captureDataLength, m_inputData + (m_inputOffset - windowStart), bytesRead);
+	m_inputOffset += bytesRead;
+	if (m_inputOffset == windowEnd) {
+		m_inputFile.unmap(m_inputData);
+		m_inputData = NULL;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::RemoveCaptureFile(const CaptureRotation::RetainedFile &file)
+{
+	const QString filename = CaptureFileName(file.fileIndex, file.openTime);
+	if (!(m_fileMover ? m_fileMover->Remove(filename) : QFile::remove(filename))) {
+		return LogError(QString("Cannot remove %1").arg(filename));
+	}
+
+	// The metadata tables are written next to the final file, never staged
+	if (m_metadata) {
+		foreach (const QString &tableFileName, MetadataSink::TableFileNames(filename)) {
+			if (QFile::exists(tableFileName) && !QFile::remove(tableFileName)) {
+				return LogError(QString("Cannot remove %1").arg(tableFileName));
+			}
+		}
+	}
+
+	// Remove the file's shard directories once they are empty, innermost
+	// first.  Removing a directory that still holds files just fails.
+	if (!m_shardFormat.isEmpty()) {
+		QString dir = QFileInfo(filename).absolutePath();
+		for (int level = m_shardFormat.count('/'); (level >= 0) && QDir().rmdir(dir); level--) {
+			dir = QFileInfo(dir).absolutePath();
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void HoneDumpcap::ReportPackets(const quint32 packetCount)
+{
+	if (!packetCount) {
+		return;
+	}
+
+	// Called from the writer threads when striping, so keep the total atomic
+	const quint64 packetsReported = m_packetsReported.fetchAndAddOrdered(packetCount) + packetCount;
+
+	// Format on the stack, since this runs for every read once the capture
+	// is going and must not allocate
+	char buffer[32];
+	if (m_parentPid.isEmpty()) {
+		const int length = qsnprintf(buffer, sizeof(buffer), "\rPackets: %llu",
+				static_cast<unsigned long long>(packetsReported));
+		QMutexLocker locker(&m_outputMutex);
+		::fwrite(buffer, length, 1, stdout);
+		::fflush(stdout);
+		m_lastLogHadAutoNewline = false;
 	} else {
-		bytesRead = driverBytesRead;
+		WriteCommand('P', buffer, qsnprintf(buffer, sizeof(buffer), "%u", packetCount));
 	}
-#endif // #ifdef WIN32
+}
 
+//-----------------------------------------------------------------------------
+void HoneDumpcap::ResizeDriverRing(const quint32 pages)
+{
+#ifndef WIN32
+	// Keep capturing with the old size if the driver can't resize the ring,
+	// such as when it can't allocate the pages
+	if (!m_driver.SetRingPages(pages)) {
+		Log(QString("Cannot resize driver ring to %L1 pages: %2").arg(pages).arg(strerror(errno)));
+		m_sizeRing = false;
+		return;
+	}
+	m_ringSizer.SetPages(pages, ::sysconf(_SC_PAGESIZE));
+	if (m_parentPid.isEmpty()) {
+		Log(QString("Driver ring resized to %L1 pages").arg(pages));
+	}
+#else // #ifndef WIN32
+	Q_UNUSED(pages);
+#endif // #ifndef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::RunDaemon(void)
+{
+#ifdef WIN32
+	return false;
+#else // #ifdef WIN32
+	while (!m_markCleanup) {
+		quint32       bytesRead;
+		const quint32 readSpace = m_captureData.size() - m_captureDataLength;
+		if (!ReadDriver(bytesRead)) {
+			return false;
+		}
+		if (m_sizeRing) {
+			const quint32 ringPages = m_ringSizer.Update(bytesRead, bytesRead == readSpace, MonotonicMsecs());
+			if (ringPages != m_ringSizer.Pages()) {
+				ResizeDriverRing(ringPages);
+			}
+		}
+
+		if (bytesRead) {
+			const quint32 length = m_captureDataLength + bytesRead;
+			quint32 completeLength;
+			CountPackets(length, completeLength);
+			m_captureDaemon->Publish(m_captureData.constData(), completeLength);
+			m_captureDataLength = length - completeLength;
+			if (m_captureDataLength) {
+				::memmove(m_captureData.data(), m_captureData.constData() + completeLength, m_captureDataLength);
+			}
+		}
+
+		// Only block when the driver has nothing for us
+		if (!m_captureDaemon->Wait(m_driver.Handle(), m_driver.InterruptHandle(), !bytesRead)) {
+			return LogError(m_captureDaemon->Error());
+		}
+	}
 	return true;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::RunJobs(void)
+{
+	// Each input gets its own child and its own file set, named after the
+	// input, so the children share nothing but the manifest
+	const QFileInfo target(m_captureTargets.first());
+	QStringList     baseArgs;
+	QStringList     targets;
+	for (int index = 1; index < m_args.size(); index++) {
+		if ((m_args.at(index) == "-r") || (m_args.at(index) == "-w") || (m_args.at(index) == "--jobs")) {
+			index++;
+		} else {
+			baseArgs.append(m_args.at(index));
+		}
+	}
+	foreach (const QString &input, m_inputFileNames) {
+		const QString inputTarget = QString("%1/%2.%3").arg(target.absolutePath(), QFileInfo(input).completeBaseName(), target.suffix());
+		if (targets.contains(inputTarget)) {
+			return LogError(QString("More than one input would be written to %1").arg(inputTarget));
+		}
+		if (!m_autoRotateFiles && IsInputFile(inputTarget)) {
+			return LogError(QString("Reprocessing %1 would overwrite %2, which is also an input").arg(input, inputTarget));
+		}
+		targets.append(inputTarget);
+	}
+
+	QList<QProcess*> jobs;
+	QStringList      jobInputs;
+	int              next = 0;
+	bool             rc   = true;
+	while (!jobs.isEmpty() || ((next < m_inputFileNames.size()) && !m_markCleanup)) {
+		while ((jobs.size() < m_jobCount) && (next < m_inputFileNames.size()) && !m_markCleanup) {
+			QProcess *job = new QProcess(this);
+			job->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+			job->setStandardOutputFile(QProcess::nullDevice());
+			job->start(QCoreApplication::applicationFilePath(),
+					QStringList(baseArgs) << "-r" << m_inputFileNames.at(next) << "-w" << targets.at(next));
+			jobs.append(job);
+			jobInputs.append(m_inputFileNames.at(next));
+			next++;
+		}
+
+		for (int index = 0; index < jobs.size(); ) {
+			QProcess *job = jobs.at(index);
+			if ((job->state() != QProcess::NotRunning) && !job->waitForFinished(100)) {
+				index++;
+				continue;
+			}
+			if ((job->exitStatus() != QProcess::NormalExit) || job->exitCode()) {
+				LogError(QString("Reprocessing %1 failed").arg(jobInputs.at(index)));
+				rc = false;
+			} else {
+				Log(QString("Reprocessed %1").arg(jobInputs.at(index)));
+			}
+			delete jobs.takeAt(index);
+			jobInputs.removeAt(index);
+		}
+	}
+	return rc;
 }
 
 //-----------------------------------------------------------------------------
@@ -788,6 +1843,27 @@ int HoneDumpcap::RunDumpcap(const QStringList &args, QByteArray &out, QByteArray
 	return process.exitCode();
 }
 
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::SpillCaptureFile(void)
+{
+	if (m_stagedFileName.isEmpty()) {
+		return true;
+	}
+
+	// Finish the staged file before handing it to the mover
+	if (!m_captureSink->Close()) {
+		return LogError(QString::fromStdString(m_captureSink->Error()));
+	}
+	m_fileMover->Move(m_stagedFileName, m_spillFileName);
+	m_stagedFileName.clear();
+	m_spillFileName.clear();
+
+	if (!m_fileMover->Error().isEmpty()) {
+		return LogError(m_fileMover->Error());
+	}
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 bool HoneDumpcap::Usage(const QString progname, const QString &msg)
 {
@@ -806,14 +1882,90 @@ bool HoneDumpcap::Usage(const QString progname, const QString &msg)
 			"  -i <interface>    Capture on interface <interface>\n"
 			"  -L                Print inteface link layer types and exit\n"
 			"  -M                Use machine-readable output\n"
+			"  -r <file>         Reprocess a saved Hone capture instead of capturing, as\n"
+			"                    fast as it can be read; repeat to process several files\n"
+			"                    in order as one capture\n"
 			"  -s <snap len>     Set capture snap length to <snap len>\n"
-			"  -w <file>         Write captured data to <file>\n"
+			"  -w <file>         Write captured data to <file>; repeat with -b to stripe\n"
+			"                    rotated files across several files or directories\n"
 			"  -Z <pid>          Running as child of parent <pid>\n"
+			"  --busy-poll <us>  Busy-poll the driver for up to <us> microseconds before\n"
+			"                    blocking when no data is available (Linux only)\n"
+			"  --correlate       When capturing on a regular interface, add the process\n"
+			"                    that owns each packet's flow as a packet comment,\n"
+			"                    using the Hone capture (Linux only)\n"
+			"  --correlate-ttl <s>\n"
+			"                    Forget flows idle for <s> seconds (default: 120)\n"
+			"  --daemon          Keep the driver open and share it with capture clients\n"
+			"  --daemon-backlog <KB>\n"
+			"                    Recent data to send to new clients (default: 4096 KB)\n"
+			"  --daemon-group <group>\n"
+			"                    Let members of <group> connect to the daemon, which\n"
+			"                    otherwise only takes captures run by its own user\n"
+			"  --daemon-socket <path>\n"
+			"                    Socket for the capture daemon, which captures connect to\n"
+			"                    when it is running (default: %2)\n"
+			"  --demux pid|connection\n"
+			"                    Also split the capture into a file for each process or\n"
+			"                    connection, in a directory next to the -w file\n"
+			"  --direct-io       Write the capture file with O_DIRECT, so long captures\n"
+			"                    don't fill the page cache.  Wireshark sees the packets\n"
+			"                    a megabyte at a time (Linux only)\n"
+			"  --export <host:port|unix:path>\n"
+			"                    Also stream the capture to a collector, resuming where\n"
+			"                    it left off after a lost connection (Linux only)\n"
+			"  --export-compress Compress each batch sent to the collector\n"
+			"  --jobs <N>        With several -r files, reprocess up to <N> at once, each\n"
+			"                    into its own files named after the input\n"
+			"  --latency         Track how long packets take to reach the file, and log\n"
+			"                    and record the p50, p99 and max latency for each file\n"
+			"  --manifest <file> Hash each capture file with SHA-256 as it is written, and\n"
+			"                    append its name, size, block count and digest to <file>\n"
+			"  --metadata        Also write each file's process and connection starts\n"
+			"                    and ends, and per-process traffic, as Arrow files\n"
+			"                    next to it\n"
+			"  --metadata-bucket <s>\n"
+			"                    Count traffic in buckets of <s> seconds (default: 60);\n"
+			"                    implies --metadata\n"
+			"  --replay-state    Start each rotated file with the process and connection\n"
+			"                    blocks seen so far, so each file stands on its own;\n"
+			"                    always on with --rotate-cut\n"
+			"  --ring-pages <min>:<max>\n"
+			"                    Grow the driver's ring during bursts and shrink it\n"
+			"                    after sustained idle, within <min> to <max> pages\n"
+			"                    (Linux only)\n"
+			"  --rotate-cut      Rotate files by cutting the stream between reads, instead\n"
+			"                    of restarting the driver and waiting for it to drain.\n"
+			"                    Implies --replay-state, since the driver only describes\n"
+			"                    what is already running after a restart.\n"
+			"  --shard day|hour  Put rotated files in a subdirectory of the -w target's\n"
+			"                    directory for each day or hour, such as 2014-05-01/13\n"
+			"  --shed            Shed load when the capture falls behind: first truncate\n"
+			"                    packets, then also sample them per connection.  Hone\n"
+			"                    process and connection blocks are always kept.\n"
+			"  --shed-sample <N> Keep 1 in <N> packets of each connection (default: 8)\n"
+			"  --shed-snaplen <bytes>\n"
+			"                    Truncate packets to <bytes> (default: 128)\n"
+			"  --shm-ring <path> Also publish the capture in a shared memory ring, which\n"
+			"                    local readers get from the socket <path> and read in\n"
+			"                    place with hone_ring.h (Linux only)\n"
+			"  --shm-ring-size <MB>\n"
+			"                    Size of the shared memory ring (default: 64 MB)\n"
+			"  --staging <dir>   Write the active file to <dir>, such as /dev/shm, and\n"
+			"                    move it to the -w target in the background on rotation\n"
+			"  --staging-size <MB>\n"
+			"                    Space to use in the staging directory before writing\n"
+			"                    straight to the -w target (default: 256 MB)\n"
+			"  --top <N>         Print the <N> processes sending the most traffic,\n"
+			"                    with their rates over the interval and last minute\n"
+			"  --top-interval <s>\n"
+			"                    Seconds between --top reports (default: 5)\n"
 			"\n"
 			"The -a and -b options take the following condition formats:\n"
 			"  duration:NUM  Stop or rotate after NUM seconds\n"
 			"  filesize:NUM  Stop or rotate after NUM KB\n"
 			"  files:NUM     Stop or rotate after NUM files\n"
+			"With -r, durations follow the packet timestamps.\n"
 			"\n"
 			"The PID for the -Z can be 'none'\n"
 			"\n"
@@ -824,18 +1976,206 @@ bool HoneDumpcap::Usage(const QString progname, const QString &msg)
 			"\n"
 			"This program also intercepts the option to print the list of interfaces\n"
 			"and adds the \"Hone\" interface to the list.\n")
-			.arg(QFileInfo(progname).fileName()));
+			.arg(QFileInfo(progname).fileName(), m_defaultDaemonSocketName));
 	return LogError(usage);
 }
 
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::WaitForDriver(void)
+{
+#ifdef WIN32
+	::Sleep(500);
+#else // #ifdef WIN32
+	QElapsedTimer timer;
+
+	// Busy-poll the driver before paying for a blocking wakeup.  Polling the
+	// read position is cheaper than a read, since nothing is copied.
+	if (m_busyPollSpin) {
+		const qint64 spinNsecs = static_cast<qint64>(m_busyPollSpin) * 1000;
+		timer.start();
+		do {
+			if (m_driver.HasData()) {
+				// Data arrived while spinning, so restore the full budget
+				m_busyPollSpin = m_busyPollUsec;
+				return true;
+			}
+		} while (!m_markCleanup && (timer.nsecsElapsed() < spinNsecs));
+
+		// Nothing arrived, so back off to avoid burning a core while idle
+		m_busyPollSpin /= 2;
+	}
+
+	bool interrupted;
+	timer.start();
+	if (!m_driver.Wait(interrupted)) {
+		return LogError(QString::fromStdString(m_driver.Error()));
+	}
+	if (interrupted) {
+		m_markCleanup = true;
+	}
+
+	// If data showed up shortly after we gave up spinning, spin longer next time
+	if (m_busyPollUsec && (timer.nsecsElapsed() < static_cast<qint64>(m_busyPollUsec) * 1000)) {
+		m_busyPollSpin = m_busyPollSpin ? qMin(m_busyPollSpin * 2, m_busyPollUsec) : qMax(m_busyPollUsec / 8, 1U);
+	}
+#endif // #ifdef WIN32
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::WriteBlocks(const quint32 length, const quint32 packetCount)
+{
+	const char *data   = m_captureData.constData();
+	quint32     offset = 0;
+
+	// Keep the section headers the capture starts with for rotated files.
+	// The interface blocks can arrive in a later read than the section
+	// header, so keep collecting until some other block turns up.
+	if (!m_sectionHeadersComplete) {
+		quint32       headerCount;
+		const quint32 headerLength = PcapNgHeaderLength(data, length, headerCount);
+		m_sectionHeaders.append(data, headerLength);
+		m_sectionHeaderCount    += headerCount;
+		m_sectionHeadersComplete = (headerLength < length);
+	}
+
+	if (m_replayStatePending) {
+		// The replayed blocks go after the section header and interface blocks
+		// that start the new file
+		quint32       headerCount;
+		const quint32 headerLength = PcapNgHeaderLength(data, length, headerCount);
+		if (headerLength < length) {
+			QByteArray    snapshot;
+			const quint32 snapshotCount = m_processTable.Snapshot(snapshot);
+			if (!WriteCaptureData(data, headerLength, 0) ||
+					!WriteCaptureData(snapshot.constData(), snapshot.size(), snapshotCount)) {
+				return false;
+			}
+			m_rotation.AddBytes(snapshot.size());
+			m_packetCount       += snapshotCount;
+			m_replayStatePending = false;
+			offset               = headerLength;
+		}
+	}
+
+	if (!WriteCaptureData(data + offset, length - offset, packetCount, m_blockTimestamps.constData(), m_blockTimestampCount)) {
+		return false;
+	}
+	if (m_replayState) {
+		m_processTable.Update(data, length);
+	}
+	if (m_demux && !m_captureDemux.Write(data, length)) {
+		return LogError(m_captureDemux.Error());
+	}
+	if (m_metadataSink) {
+		m_metadataSink->Write(data, length);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::WriteCaptureData(const char *data, const quint32 length, const quint32 packetCount,
+		const quint64 *timestamps, const int timestampCount)
+{
+	if (!length) {
+		return true;
+	}
+
+#ifndef WIN32
+	if (m_exportSink) {
+		m_exportSink->Write(data, length);
+	}
+	if (m_sharedRing) {
+		m_sharedRing->Publish(data, length);
+	}
+#endif
+	if (m_fileHasher && !m_fileHasher->Add(data, length, packetCount)) {
+		return LogError(m_fileHasher->Error());
+	}
+
+	if (m_captureWriter) {
+		// The writer reports the packets and measures latency once they reach
+		// the disk
+		if (!m_captureWriter->Write(data, length, packetCount, timestamps, timestampCount)) {
+			return LogError(QString::fromStdString(m_captureWriter->Error()));
+		}
+		return true;
+	}
+
+	HONE_PROBE1(file_write_start, length);
+	const bool written = m_captureSink->Write(data, length, packetCount);
+	HONE_PROBE1(file_write_done, length);
+	if (!written) {
+		return LogError(QString::fromStdString(m_captureSink->Error()));
+	}
+	if (timestampCount) {
+		m_latency.Record(timestamps, timestampCount, LatencyHistogram::Now());
+	}
+
+	// The direct writer reports the packets as each aligned buffer reaches
+	// the disk, so latency is only measured up to the hand-off
+	if (m_captureSink == &m_fileSink) {
+		ReportPackets(packetCount);
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::WriteSectionHeaders(void)
+{
+	if (!WriteCaptureData(m_sectionHeaders.constData(), m_sectionHeaders.size(), m_sectionHeaderCount)) {
+		return false;
+	}
+	m_rotation.AddBytes(m_sectionHeaders.size());
+	m_packetCount += m_sectionHeaderCount;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::WriteLatencyStatistics(void)
+{
+	// Record how stale the file was while it was being written
+	if (!m_trackLatency) {
+		return true;
+	}
+	const LatencyHistogram::Summary summary = m_latency.TakeSummary();
+	if (!summary.count) {
+		return true;
+	}
+
+	const QString comment = QString("Hone capture latency: %1 packets, p50 %2 us, p99 %3 us, max %4 us")
+			.arg(summary.count).arg(summary.p50).arg(summary.p99).arg(summary.max);
+	if (m_parentPid.isEmpty()) {
+		Log(comment);
+	}
+	const QByteArray block = PcapNgStatisticsBlock(LatencyHistogram::Now(), comment.toUtf8());
+	m_rotation.AddBytes(block.size());
+	return WriteCaptureData(block.constData(), block.size(), 0);
+}
+
+//-----------------------------------------------------------------------------
+bool HoneDumpcap::WriteShedStatistics(void)
+{
+	// Record what was shed so the loss can be accounted for
+	if (!m_shedLoad || !m_loadShedder.Changed()) {
+		return true;
+	}
+	const QByteArray block = m_loadShedder.StatisticsBlock();
+	m_rotation.AddBytes(block.size());
+	return WriteCaptureData(block.constData(), block.size(), 0);
+}
+
 //--------------------------------------------------------------------------
 void HoneDumpcap::WriteCommand(const char command, const QString &msg)
 {
+	QMutexLocker locker(&m_outputMutex);
 	const int len       = msg.length() + 1;
 	char      header[4] = { 0 };
 
 	header[0] = command;
 	if (command == 'E') {
+		HONE_PROBE2(control_message, command, msg.length());
+
 		// Error messages have the following format:
 		//  E
 		//  4 + primary message length + 1 + 4 + secondary message length + 1
@@ -865,17 +2205,32 @@ void HoneDumpcap::WriteCommand(const char command, const QString &msg)
 		header[3] = 1;
 		::fwrite(header, sizeof(header), 1, stderr);
 		::fputc('\0', stderr);
+		::fflush(stderr);
 	} else {
-		if (len > 1) {
-			header[1] = (len >> 16) & 0xFF;
-			header[2] = (len >>  8) & 0xFF;
-			header[3] = (len >>  0) & 0xFF;
-		}
-		::fwrite(header, sizeof(header), 1, stderr);
-		if (len > 1) {
-			::fwrite(msg.toLatin1().data(), len, 1, stderr);
-		}
+		locker.unlock();
+		const QByteArray latin1 = msg.toLatin1();
+		WriteCommand(command, latin1.constData(), latin1.size());
 	}
+}
 
+//-----------------------------------------------------------------------------
+void HoneDumpcap::WriteCommand(const char command, const char *msg, const int length)
+{
+	// Message must be nul terminated, and the terminator is sent as well
+	HONE_PROBE2(control_message, command, length);
+	QMutexLocker locker(&m_outputMutex);
+	const int len       = length + 1;
+	char      header[4] = { 0 };
+
+	header[0] = command;
+	if (len > 1) {
+		header[1] = (len >> 16) & 0xFF;
+		header[2] = (len >>  8) & 0xFF;
+		header[3] = (len >>  0) & 0xFF;
+	}
+	::fwrite(header, sizeof(header), 1, stderr);
+	if (len > 1) {
+		::fwrite(msg, len, 1, stderr);
+	}
 	::fflush(stderr);
 }
@@ -12,44 +12,56 @@
 #ifndef HONE_DUMPCAP_H
 #define HONE_DUMPCAP_H
 
+#include <QAtomicInt>
+#include <QAtomicInteger>
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QMutex>
 #include <QProcess>
-#include <QQueue>
+#include <QSocketNotifier>
 #include <QStringList>
 #include <QTemporaryFile>
-#include <QTextStream>
+#include <QVector>
+
+#include "capture_demux.h"
+#include "capture_driver.h"
+#include "capture_rotation.h"
+#include "capture_sink.h"
+#include "capture_writer.h"
+#ifndef WIN32
+#include "capture_daemon.h"
+#include "direct_writer.h"
+#include "export_sink.h"
+#include "shared_ring.h"
+#endif
+#include "file_hasher.h"
+#include "file_mover.h"
+#include "flow_correlator.h"
+#include "latency_histogram.h"
+#include "load_shedder.h"
+#include "metadata_sink.h"
+#include "process_table.h"
+#include "ring_sizer.h"
+#include "traffic_top.h"
+
+#include <signal.h>
 
 #ifdef WIN32
 #include <Windows.h>
-
-#define IOCTL_HONE_MARK_RESTART CTL_CODE(FILE_DEVICE_UNKNOWN, 2048, \
-	METHOD_NEITHER, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
-
-typedef HANDLE FileHandle;
-#define InvalidFileHandle INVALID_HANDLE_VALUE
-
 #else // #ifdef WIN32
 
 #include <errno.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
-#define HEIO_RESTART        _IO(0xE0, 0x01)
-#define HEIO_GET_AT_HEAD    _IO(0xE0, 0x03)
-#define HEIO_GET_SNAPLEN    _IOR(0xE0, 0x04, int)
-#define HEIO_SET_SNAPLEN    _IOW(0xE0, 0x05, int)
-#define HEIO_GET_RING_PAGES _IOR(0xE0, 0x06, int)
-#define HEIO_SET_RING_PAGES _IOW(0xE0, 0x07, int)
-
-typedef int FileHandle;
-#define InvalidFileHandle -1
-
 #endif // #ifdef WIN32
 
 //----------------------------------------------------------------------------
@@ -67,16 +79,20 @@ public:
 	bool Process(void);
 
 private slots:
+	void OnDriverReadyRead(void);
 	void OnError(QProcess::ProcessError error);
 	void OnFinished(int exitCode, QProcess::ExitStatus exitStatus);
 	void OnReadyReadStandardError(void);
 	void OnReadyReadStandardOutput(void);
+	void OnWritten(quint32 packetCount);
 
 private:
 	enum Operation {
 		OperationCapture,              // Capture packets
+		OperationDaemon,               // Share the driver with local capture clients
 		OperationPrintInterfaces,      // Print network interfaces
 		OperationPrintLinkLayerTypes,  // Print link layer types for an interface
+		OperationReprocessJobs,        // Reprocess input files in parallel child processes
 	};
 
 	enum CaptureState {
@@ -86,59 +102,151 @@ private:
 		CaptureStateDone,     // Done capturing
 	};
 
+	QString CaptureFileName(const quint32 fileIndex, const qint64 openTime) const;
+	qint64 CaptureMsecs(void);
 	bool CapturePackets(void);
-	quint32 CountPackets(const quint32 length);
+	bool ConnectDaemon(void);
+	quint32 CountPackets(const quint32 length, quint32 &completeLength);
+	bool FinishCapture(void);
 	QString FormatError(void);
+	bool IsInputFile(const QString &fileName) const;
 	void Log(const QString &msg, const bool autoNewLine = true);
 	bool LogError(QString msg, const bool useErrorCode = false, const bool autoNewLine = true);
 	bool MarkRestart(void);
+	static qint64 MonotonicMsecs(void);
 	bool OpenCaptureFile(void);
 	bool OpenDriver(void);
+	bool OpenInput(const QString &fileName);
 	bool ParseArgs(void);
-	bool ParseCondition(const QString &condition, qint64 &duration, quint32 &fileSize, quint32 &fileCount);
+	bool ParseCondition(const QString &condition, CaptureRotation::Conditions &conditions);
 	bool PrintInterfaces(void);
 	bool PrintLinkTypes(void);
 	bool ReadDriver(quint32 &bytesRead);
+	bool ReadInput(quint32 &bytesRead);
+	bool RemoveCaptureFile(const CaptureRotation::RetainedFile &file);
+	void ReportPackets(const quint32 packetCount);
+	void ResizeDriverRing(const quint32 pages);
+	bool RunDaemon(void);
+	bool RunJobs(void);
+	bool SpillCaptureFile(void);
 	int  RunDumpcap(const QStringList &args, QByteArray &out, QByteArray &err);
 	bool Usage(const QString progname, const QString &msg = QString());
+	bool WaitForDriver(void);
+	bool WriteBlocks(const quint32 length, const quint32 packetCount);
+	bool WriteCaptureData(const char *data, const quint32 length, const quint32 packetCount,
+			const quint64 *timestamps = 0, const int timestampCount = 0);
+	bool WriteLatencyStatistics(void);
+	bool WriteSectionHeaders(void);
+	bool WriteShedStatistics(void);
 	void WriteCommand(const char command, const QString &msg = QString());
+	void WriteCommand(const char command, const char *msg, const int length);
 
 	QStringList           m_args;
 	bool                  m_autoRotateFiles;
-	quint32               m_autoRotateFileCount;
-	quint32               m_autoRotateFileSize;
-	qint64                m_autoRotateMilliseconds;
-	quint32               m_autoStopFileCount;
-	quint32               m_autoStopFileSize;
-	qint64                m_autoStopMilliseconds;
-	quint32               m_autoStopPacketCount;
+	int                   m_blockTimestampCount;
+	QVector<quint64>      m_blockTimestamps;
+	quint32               m_busyPollSpin;
+	quint32               m_busyPollUsec;
 	QByteArray            m_captureData;
+	quint32               m_captureDataLength;
 	static const int      m_captureDataSize;
-	QFile                 m_captureFile;
-	quint32               m_captureFileCount;
-	QString               m_captureFileName;
-	QQueue<QString>       m_captureFileNames;
-	quint32               m_captureFileSize;
-	qint64                m_captureStart;
+	CaptureDemux          m_captureDemux;
+	CaptureSink          *m_captureSink;  // One of the writers, or m_fileSink
 	CaptureState          m_captureState;
-	QTextStream           m_cout;
+	QStringList           m_captureTargets;
+	CaptureWriter        *m_captureWriter;
+	QList<CaptureWriter*> m_captureWriters;
+	bool                  m_correlateFlows;
+#ifndef WIN32
+	CaptureDaemon        *m_captureDaemon;
+#endif
+	qint64                m_daemonBacklogSize;
+	bool                  m_daemonClient;
+	QString               m_daemonGroup;
+	QString               m_daemonSocketName;
+	bool                  m_daemonSocketRequired;
+	static const QString  m_defaultDaemonSocketName;
+	bool                  m_demux;
+	CaptureDemux::Mode    m_demuxMode;
+	bool                  m_directIo;
+#ifndef WIN32
+	DirectWriter         *m_directWriter;
+#endif
+	CaptureDriver         m_driver;
 	static const QString  m_driverFileName;
-	FileHandle            m_driverHandle;
+	QByteArray            m_driverData;
+#ifndef WIN32
+	QSocketNotifier      *m_driverNotifier;
+#endif
 	QString               m_dumpcapFileName;
-	QProcess              m_dumpcapProcess;
+	QByteArray            m_dumpcapErrors;
+	QProcess             *m_dumpcapProcess;
+	bool                  m_exportCompress;
+#ifndef WIN32
+	ExportSink           *m_exportSink;
+#endif
+	QString               m_exportTarget;
+	FileHasher           *m_fileHasher;
+	FileMover            *m_fileMover;
+	FileSink              m_fileSink;
+	QByteArray            m_flowBlocks;
+	FlowCorrelator        m_flowCorrelator;
 	bool                  m_haveHoneInterface;
+	quint64               m_inputClock;
+	uchar                *m_inputData;
+	QFile                 m_inputFile;
+	QStringList           m_inputFileNames;
+	int                   m_inputIndex;
+	static const qint64   m_inputMapSize;
+	qint64                m_inputOffset;
+	static const int      m_inputReadSize;
+	qint64                m_inputSize;
+	int                   m_jobCount;
 	bool                  m_lastLogHadAutoNewline;
+	LatencyHistogram      m_latency;
+	LoadShedder           m_loadShedder;
 	bool                  m_machineReadable;
-	bool                  m_markCleanup;
+	QString               m_manifestFileName;
+	volatile sig_atomic_t m_markCleanup;  // Set from signal handlers
 	bool                  m_markRotate;
+	bool                  m_metadata;
+	quint32               m_metadataBucket;
+	QString               m_metadataFileName;  // Capture file the metadata is for
+	MetadataSink         *m_metadataSink;
 	bool                  m_needEventLoop;
 	static const QRegExp  m_newlineRegex;
 	Operation             m_operation;
-	quint32               m_packetCount;
+	QMutex                m_outputMutex;
+	quint64               m_packetCount;
+	QAtomicInteger<quint64> m_packetsReported;
 	QString               m_parentPid;
-	bool                  m_partialPacketHeader;
-	quint32               m_partialPacketOffset;
+	ProcessTable          m_processTable;
+	bool                  m_replayState;
+	bool                  m_replayStatePending;
+	bool                  m_rotateCut;
+	CaptureRotation       m_rotation;
+	quint32               m_sectionHeaderCount;
+	QByteArray            m_sectionHeaders;
+	bool                  m_sectionHeadersComplete;
+	RingSizer             m_ringSizer;
+	QString               m_shardFormat;
+#ifndef WIN32
+	SharedRing           *m_sharedRing;
+#endif
+	QString               m_sharedRingName;
+	quint32               m_sharedRingSize;   // MB
+	bool                  m_shedLoad;
+	bool                  m_sizeRing;
 	quint32               m_snapLen;
+	QString               m_spillFileName;
+	qint64                m_stagingBudget;
+	QString               m_stagedFileName;
+	QString               m_stagingDir;
+	int                   m_topCount;
+	int                   m_topInterval;
+	qint64                m_topReportTime;
+	bool                  m_trackLatency;
+	TrafficTop            m_trafficTop;
 #ifdef WIN32
 	FileHandle            m_signalPipeHandle;
 #endif
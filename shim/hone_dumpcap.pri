@@ -0,0 +1,57 @@
+# Sources of hone-dumpcap other than main.cpp, shared with the tests
+INCLUDEPATH += $$PWD
+
+# The Qt-free capture core, shared with programs that embed it
+include($$PWD/../libhonecapture/honecapture.pri)
+
+unix {
+	# Static tracing probes, when the SystemTap SDT header is available
+	exists(/usr/include/sys/sdt.h) {
+		DEFINES += HAVE_SYS_SDT_H
+	}
+
+	SOURCES += \
+		$$PWD/capture_daemon.cpp \
+		$$PWD/direct_writer.cpp \
+		$$PWD/export_sink.cpp \
+		$$PWD/shared_ring.cpp
+
+	HEADERS += \
+		$$PWD/capture_daemon.h \
+		$$PWD/direct_writer.h \
+		$$PWD/export_sink.h \
+		$$PWD/shared_ring.h
+}
+
+SOURCES += \
+	$$PWD/arrow_table.cpp \
+	$$PWD/capture_demux.cpp \
+	$$PWD/capture_writer.cpp \
+	$$PWD/file_hasher.cpp \
+	$$PWD/file_mover.cpp \
+	$$PWD/flow_correlator.cpp \
+	$$PWD/hone_dumpcap.cpp \
+	$$PWD/latency_histogram.cpp \
+	$$PWD/load_shedder.cpp \
+	$$PWD/metadata_sink.cpp \
+	$$PWD/process_table.cpp \
+	$$PWD/ring_sizer.cpp \
+	$$PWD/traffic_top.cpp
+
+HEADERS += \
+	$$PWD/arrow_table.h \
+	$$PWD/block_scanner.h \
+	$$PWD/capture_demux.h \
+	$$PWD/capture_writer.h \
+	$$PWD/file_hasher.h \
+	$$PWD/file_mover.h \
+	$$PWD/flow_correlator.h \
+	$$PWD/hone_dumpcap.h \
+	$$PWD/hone_pcapng.h \
+	$$PWD/hone_probes.h \
+	$$PWD/latency_histogram.h \
+	$$PWD/load_shedder.h \
+	$$PWD/metadata_sink.h \
+	$$PWD/process_table.h \
+	$$PWD/ring_sizer.h \
+	$$PWD/traffic_top.h
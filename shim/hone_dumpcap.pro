@@ -22,9 +22,7 @@ win32 {
 	OTHER_FILES += hone_dumpcap.rc
 }
 
-SOURCES += \
-	main.cpp \
-	hone_dumpcap.cpp
+include(hone_dumpcap.pri)
 
-HEADERS += \
-	hone_dumpcap.h
+SOURCES += \
+	main.cpp
@@ -0,0 +1,62 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef HONE_PCAPNG_H
+#define HONE_PCAPNG_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <string.h>
+
+// The block layouts are shared with the capture library
+#include "pcapng_blocks.h"
+
+//----------------------------------------------------------------------------
+// Build an interface statistics block for the Hone interface, with a comment
+// and an optional count of dropped packets.  Timestamp is in microseconds.
+inline QByteArray PcapNgStatisticsBlock(const quint64 timestamp, const QByteArray &comment, const quint64 *dropCount = 0)
+{
+	const quint32 commentLength = (comment.size() + 3) & ~3;
+	const quint32 blockLength   = sizeof(PcapNgBlockHeader) + 3 * sizeof(quint32) +
+			sizeof(PcapNgOptionHeader) + commentLength +
+			(dropCount ? sizeof(PcapNgOptionHeader) + sizeof(quint64) : 0) +
+			sizeof(PcapNgOptionHeader) + sizeof(quint32);
+
+	QByteArray block(blockLength, 0);
+	quint32   *words  = reinterpret_cast<quint32*>(block.data());
+	quint32    offset = 0;
+	words[offset++] = PCAPNG_INTERFACE_STATS_BLOCK;
+	words[offset++] = blockLength;
+	words[offset++] = 0; // Interface ID
+	words[offset++] = static_cast<quint32>(timestamp >> 32);
+	words[offset++] = static_cast<quint32>(timestamp);
+
+	PcapNgOptionHeader *option = reinterpret_cast<PcapNgOptionHeader*>(words + offset++);
+	option->code   = PCAPNG_OPT_COMMENT;
+	option->length = comment.size();
+	::memcpy(words + offset, comment.constData(), comment.size());
+	offset += commentLength / sizeof(quint32);
+
+	if (dropCount) {
+		option = reinterpret_cast<PcapNgOptionHeader*>(words + offset++);
+		option->code   = PCAPNG_ISB_OPT_IFDROP;
+		option->length = sizeof(quint64);
+		::memcpy(words + offset, dropCount, sizeof(quint64));
+		offset += sizeof(quint64) / sizeof(quint32);
+	}
+
+	offset++; // End of options
+	words[offset] = blockLength;
+	return block;
+}
+
+#endif // HONE_PCAPNG_H
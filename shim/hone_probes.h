@@ -0,0 +1,49 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef HONE_PROBES_H
+#define HONE_PROBES_H
+
+//----------------------------------------------------------------------------
+// Static USDT probes for bpftrace, perf and SystemTap, under the provider
+// name hone_dumpcap.  Each probe is a single nop in the binary until a tracer
+// attaches, and the probes compile away entirely without <sys/sdt.h>.
+//
+//   driver_read_start                         Before each driver read
+//   driver_read_done      (bytes)             After each driver read
+//   blocks_scanned        (length, complete, blocks)
+//                                             After scanning for complete blocks
+//   file_write_start      (bytes)             Before writing to the capture file
+//   file_write_done       (bytes)
+//   file_flush_start                          Before flushing the capture file
+//   file_flush_done
+//   mark_restart                              Driver asked to restart the log
+//   file_rotate           (file count)        Rotation started
+//   file_open             (file name, file count)
+//   control_message       (command, length)   Message sent to Wireshark
+//
+// Example:
+//   bpftrace -e 'usdt:/usr/bin/hone-dumpcap:hone_dumpcap:driver_read_done { @ = hist(arg0); }'
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define HONE_PROBE0(name)              DTRACE_PROBE(hone_dumpcap, name)
+#define HONE_PROBE1(name, a)           DTRACE_PROBE1(hone_dumpcap, name, a)
+#define HONE_PROBE2(name, a, b)        DTRACE_PROBE2(hone_dumpcap, name, a, b)
+#define HONE_PROBE3(name, a, b, c)     DTRACE_PROBE3(hone_dumpcap, name, a, b, c)
+#else
+#define HONE_PROBE0(name)              do {} while (0)
+#define HONE_PROBE1(name, a)           do {} while (0)
+#define HONE_PROBE2(name, a, b)        do {} while (0)
+#define HONE_PROBE3(name, a, b, c)     do {} while (0)
+#endif
+
+#endif // HONE_PROBES_H
@@ -0,0 +1,114 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <string.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "latency_histogram.h"
+
+//-----------------------------------------------------------------------------
+LatencyHistogram::LatencyHistogram(void)
+	: m_count(0)
+	, m_max(0)
+{
+	::memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+//-----------------------------------------------------------------------------
+int LatencyHistogram::Bucket(const quint64 value)
+{
+	// Small values get a bucket each, and larger ones get 16 buckets for each
+	// power of two
+	if (value < SubBuckets) {
+		return static_cast<int>(value);
+	}
+	int exponent = 63;
+	while (!(value & (Q_UINT64_C(1) << exponent))) {
+		exponent--;
+	}
+	return (exponent - 3) * SubBuckets + static_cast<int>((value >> (exponent - 4)) & (SubBuckets - 1));
+}
+
+//-----------------------------------------------------------------------------
+quint64 LatencyHistogram::BucketValue(const int bucket)
+{
+	// Report the top of the bucket, so percentiles never understate latency
+	if (bucket < SubBuckets) {
+		return bucket;
+	}
+	const int exponent = bucket / SubBuckets + 3;
+	const quint64 low  = static_cast<quint64>(SubBuckets + bucket % SubBuckets) << (exponent - 4);
+	return low + (Q_UINT64_C(1) << (exponent - 4)) - 1;
+}
+
+//-----------------------------------------------------------------------------
+quint64 LatencyHistogram::Now(void)
+{
+	// Wall clock time in microseconds, to compare with block timestamps
+#ifdef WIN32
+	FILETIME now;
+	::GetSystemTimeAsFileTime(&now);
+	const quint64 ticks = (static_cast<quint64>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+	return ticks / 10 - Q_UINT64_C(11644473600000000); // 100 ns ticks since 1601
+#else // #ifdef WIN32
+	struct timespec now;
+	::clock_gettime(CLOCK_REALTIME, &now);
+	return static_cast<quint64>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#endif // #ifdef WIN32
+}
+
+//-----------------------------------------------------------------------------
+quint64 LatencyHistogram::Percentile(const quint64 percent) const
+{
+	const quint64 target = (m_count * percent + 99) / 100;
+	quint64       seen   = 0;
+	for (int bucket = 0; bucket < BucketCount; bucket++) {
+		seen += m_buckets[bucket];
+		if (seen >= target) {
+			return qMin(BucketValue(bucket), m_max);
+		}
+	}
+	return m_max;
+}
+
+//-----------------------------------------------------------------------------
+void LatencyHistogram::Record(const quint64 *timestamps, const int count, const quint64 now)
+{
+	QMutexLocker locker(&m_mutex);
+	for (int index = 0; index < count; index++) {
+		// Clock skew can put a timestamp in the future
+		const quint64 latency = (now > timestamps[index]) ? (now - timestamps[index]) : 0;
+		m_buckets[Bucket(latency)]++;
+		m_max = qMax(m_max, latency);
+	}
+	m_count += count;
+}
+
+//-----------------------------------------------------------------------------
+LatencyHistogram::Summary LatencyHistogram::TakeSummary(void)
+{
+	QMutexLocker locker(&m_mutex);
+	Summary summary;
+	summary.count = m_count;
+	summary.max   = m_max;
+	summary.p50   = m_count ? Percentile(50) : 0;
+	summary.p99   = m_count ? Percentile(99) : 0;
+
+	::memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_max   = 0;
+	return summary;
+}
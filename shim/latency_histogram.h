@@ -0,0 +1,51 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <QMutex>
+
+//----------------------------------------------------------------------------
+// Tracks how long blocks take to get from the kernel to the capture file.
+// Buckets are log-linear like an HDR histogram: 16 per power of two, so
+// every reported value is within about 6% of the real one.  Recording never
+// allocates, and it is safe to record from the writer threads.
+class LatencyHistogram
+{
+public:
+	struct Summary {
+		quint64 count;
+		quint64 max;
+		quint64 p50;
+		quint64 p99;
+	};
+
+	LatencyHistogram(void);
+
+	static quint64 Now(void);
+	void           Record(const quint64 *timestamps, const int count, const quint64 now);
+	Summary        TakeSummary(void);
+
+private:
+	static int     Bucket(const quint64 value);
+	static quint64 BucketValue(const int bucket);
+	quint64        Percentile(const quint64 percent) const;
+
+	enum { SubBuckets = 16, BucketCount = 61 * SubBuckets };
+
+	quint64 m_buckets[BucketCount];
+	quint64 m_count;
+	quint64 m_max;
+	QMutex  m_mutex;
+};
+
+#endif // LATENCY_HISTOGRAM_H
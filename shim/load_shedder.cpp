@@ -0,0 +1,170 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QDateTime>
+
+#include <string.h>
+
+#include "hone_pcapng.h"
+#include "load_shedder.h"
+
+// Forget the per-connection counts when there are more connections than this
+const int LoadShedder::m_maxFlows = 65536;
+
+//-----------------------------------------------------------------------------
+LoadShedder::LoadShedder(void)
+	: m_bytesShed(0)
+	, m_level(0)
+	, m_packetsSampled(0)
+	, m_packetsTruncated(0)
+	, m_pressure(0)
+	, m_recordedLevel(0)
+	, m_recordedSampled(0)
+	, m_recordedTruncated(0)
+	, m_sampleRate(8)
+	, m_snapLen(128)
+{
+}
+
+//-----------------------------------------------------------------------------
+bool LoadShedder::Changed(void) const
+{
+	return (m_level != m_recordedLevel) || (m_packetsSampled != m_recordedSampled) ||
+			(m_packetsTruncated != m_recordedTruncated);
+}
+
+//-----------------------------------------------------------------------------
+bool LoadShedder::Sample(const char *block, const quint32 blockLength)
+{
+	// Packets without a connection ID all share one count
+	const char *options;
+	quint32     optionsLength;
+	quint32     connectionId = 0;
+	PcapNgPacketOptions(block, blockLength, options, optionsLength);
+	PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_CONNECTION_ID, connectionId);
+
+	if (m_flowCounts.size() >= m_maxFlows) {
+		m_flowCounts.clear();
+	}
+	quint32 &count = m_flowCounts[connectionId];
+	return (count++ % m_sampleRate) == 0;
+}
+
+//-----------------------------------------------------------------------------
+quint32 LoadShedder::Shed(char *data, const quint32 length, quint32 &packetCount)
+{
+	if (!m_level) {
+		return length;
+	}
+
+	// Compact the kept blocks toward the start of the buffer
+	quint32 in  = 0;
+	quint32 out = 0;
+	while (in < length) {
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + in);
+		const quint32 blockLength = PcapNgBlockLength(data + in, length - in);
+		if (!blockLength) {
+			break;
+		}
+
+		quint32 keptLength = blockLength;
+		if ((header->blockType == PCAPNG_ENHANCED_PACKET_BLOCK) &&
+				(blockLength >= sizeof(PcapNgBlockHeader) + sizeof(PcapNgEnhancedPacketBody) + sizeof(quint32))) {
+			if ((m_level >= 2) && (m_sampleRate > 1) && !Sample(data + in, blockLength)) {
+				keptLength = 0;
+				m_packetsSampled++;
+				packetCount--;
+			} else {
+				::memmove(data + out, data + in, blockLength);
+				keptLength = Truncate(data + out, blockLength);
+			}
+		} else if (out != in) {
+			::memmove(data + out, data + in, blockLength);
+		}
+		m_bytesShed += blockLength - keptLength;
+		in          += blockLength;
+		out         += keptLength;
+	}
+
+	// Pass anything left over through untouched
+	if (in < length) {
+		::memmove(data + out, data + in, length - in);
+		out += length - in;
+	}
+	return out;
+}
+
+//-----------------------------------------------------------------------------
+QByteArray LoadShedder::StatisticsBlock(void)
+{
+	// Interface statistics block with the dropped packet count and a comment
+	// describing everything that was shed so far
+	const QByteArray comment = QString("Hone load shedding level %1: %2 packets truncated to %3 bytes, "
+			"%4 packets dropped by 1 in %5 sampling, %6 bytes shed").arg(m_level).arg(m_packetsTruncated)
+			.arg(m_snapLen).arg(m_packetsSampled).arg(m_sampleRate).arg(m_bytesShed).toUtf8();
+	const QByteArray block = PcapNgStatisticsBlock(QDateTime::currentMSecsSinceEpoch() * 1000, comment, &m_packetsSampled);
+
+	m_recordedLevel     = m_level;
+	m_recordedSampled   = m_packetsSampled;
+	m_recordedTruncated = m_packetsTruncated;
+	return block;
+}
+
+//-----------------------------------------------------------------------------
+quint32 LoadShedder::Truncate(char *block, const quint32 blockLength)
+{
+	PcapNgEnhancedPacketBody *packet = reinterpret_cast<PcapNgEnhancedPacketBody*>(block + sizeof(PcapNgBlockHeader));
+	const quint32 dataStart     = sizeof(PcapNgBlockHeader) + sizeof(PcapNgEnhancedPacketBody);
+	const quint32 paddedLength  = (packet->capturedLength + 3) & ~3;
+	if ((packet->capturedLength <= m_snapLen) || (dataStart + paddedLength + sizeof(quint32) > blockLength)) {
+		return blockLength;
+	}
+
+	// Move the options up behind the shortened packet data
+	const quint32 snapLength    = (m_snapLen + 3) & ~3;
+	const quint32 optionsLength = blockLength - dataStart - paddedLength - sizeof(quint32);
+	::memset(block + dataStart + m_snapLen, 0, snapLength - m_snapLen);
+	::memmove(block + dataStart + snapLength, block + dataStart + paddedLength, optionsLength);
+
+	const quint32 newLength = dataStart + snapLength + optionsLength + sizeof(quint32);
+	packet->capturedLength = m_snapLen;
+	reinterpret_cast<PcapNgBlockHeader*>(block)->blockLength = newLength;
+	::memcpy(block + newLength - sizeof(quint32), &newLength, sizeof(quint32));
+	m_packetsTruncated++;
+	return newLength;
+}
+
+//-----------------------------------------------------------------------------
+bool LoadShedder::Update(const quint32 fillPercent)
+{
+	// Smooth the fill level so a single burst doesn't start shedding.  The
+	// pressure is kept as 16 times the moving average.
+	m_pressure = m_pressure - (m_pressure / 16) + qMin(fillPercent, 100U);
+	const quint32 pressure = m_pressure / 16;
+
+	// Step down at lower levels than we step up to avoid flapping
+	quint32 level;
+	if (pressure >= 95) {
+		level = 2;
+	} else if (pressure >= 75) {
+		level = ((m_level == 2) && (pressure >= 85)) ? 2 : 1;
+	} else if (pressure >= 50) {
+		level = m_level ? 1 : 0;
+	} else {
+		level = 0;
+	}
+
+	if (level == m_level) {
+		return false;
+	}
+	m_level = level;
+	return true;
+}
@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef LOAD_SHEDDER_H
+#define LOAD_SHEDDER_H
+
+#include <QByteArray>
+#include <QHash>
+
+//----------------------------------------------------------------------------
+// Sheds packet data in graduated steps when the capture falls behind, so the
+// driver doesn't drop events at random.  The first level truncates packets
+// to a short snap length, and the second also keeps only one in every N
+// packets of each connection.  Hone process and connection blocks are always
+// kept.
+class LoadShedder
+{
+public:
+	LoadShedder(void);
+
+	bool       Changed(void) const;
+	quint32    Level(void) const { return m_level; }
+	void       SetSampleRate(const quint32 sampleRate) { m_sampleRate = sampleRate; }
+	void       SetSnapLen(const quint32 snapLen) { m_snapLen = snapLen; }
+	quint32    Shed(char *data, const quint32 length, quint32 &packetCount);
+	QByteArray StatisticsBlock(void);
+	bool       Update(const quint32 fillPercent);
+
+private:
+	bool    Sample(const char *block, const quint32 blockLength);
+	quint32 Truncate(char *block, const quint32 blockLength);
+
+	quint64                 m_bytesShed;
+	QHash<quint32, quint32> m_flowCounts;
+	quint32                 m_level;
+	static const int        m_maxFlows;
+	quint64                 m_packetsSampled;
+	quint64                 m_packetsTruncated;
+	quint32                 m_pressure;
+	quint32                 m_recordedLevel;
+	quint64                 m_recordedSampled;
+	quint64                 m_recordedTruncated;
+	quint32                 m_sampleRate;
+	quint32                 m_snapLen;
+};
+
+#endif // LOAD_SHEDDER_H
@@ -0,0 +1,228 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QFileInfo>
+
+#include "hone_pcapng.h"
+#include "metadata_sink.h"
+
+//-----------------------------------------------------------------------------
+MetadataSink::MetadataSink(const quint32 bucketSeconds)
+	: m_bucketMicroseconds(static_cast<quint64>(bucketSeconds) * 1000000)
+{
+	// Columns are added in the order of the column enums
+	m_connections.AddColumn("timestamp",     ArrowTable::ColumnTimestamp);
+	m_connections.AddColumn("connection_id", ArrowTable::ColumnUInt32);
+	m_connections.AddColumn("process_id",    ArrowTable::ColumnUInt32);
+	m_connections.AddColumn("event",         ArrowTable::ColumnDictionary);
+
+	m_packets.AddColumn("bucket_start",  ArrowTable::ColumnTimestamp);
+	m_packets.AddColumn("process_id",    ArrowTable::ColumnUInt32);
+	m_packets.AddColumn("connection_id", ArrowTable::ColumnUInt32);
+	m_packets.AddColumn("packets",       ArrowTable::ColumnUInt64);
+	m_packets.AddColumn("bytes",         ArrowTable::ColumnUInt64);
+
+	m_processes.AddColumn("timestamp",  ArrowTable::ColumnTimestamp);
+	m_processes.AddColumn("process_id", ArrowTable::ColumnUInt32);
+	m_processes.AddColumn("path",       ArrowTable::ColumnDictionary);
+	m_processes.AddColumn("argv",       ArrowTable::ColumnString);
+	m_processes.AddColumn("event",      ArrowTable::ColumnDictionary);
+}
+
+//-----------------------------------------------------------------------------
+void MetadataSink::AddConnection(const char *block, const quint32 length)
+{
+	if (length < PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneConnectionEventBody)) {
+		return;
+	}
+	const HoneConnectionEventBody *connection   = reinterpret_cast<const HoneConnectionEventBody*>(block + sizeof(PcapNgBlockHeader));
+	const quint32                  connectionId = HoneEventId(connection->connectionId);
+	const quint32                  processId    = HoneEventId(connection->processId);
+	const bool                     ends         = HoneEventEnds(connection->connectionId);
+
+	// An end event is a row of its own under the real ID, after the start
+	// if this file hasn't described the connection yet
+	if (ends) {
+		Describe(processId, connectionId);
+	}
+	m_connections.Append(ConnectionTimestamp, (static_cast<quint64>(connection->timestampHigh) << 32) | connection->timestampLow);
+	m_connections.Append(ConnectionId, connectionId);
+	m_connections.Append(ConnectionProcessId, processId);
+	m_connections.Append(ConnectionEvent, ends ? QByteArray("end") : QByteArray("start"));
+	if (!ends) {
+		m_describedConnections.insert(connectionId);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void MetadataSink::AddPacket(const char *block, const quint32 length)
+{
+	const char *options;
+	quint32     optionsLength;
+	quint32     connectionId = 0;
+	quint32     processId    = 0;
+	PcapNgPacketOptions(block, length, options, optionsLength);
+	PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_CONNECTION_ID, connectionId);
+	PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_PROCESS_ID, processId);
+
+	// A connection's packets belong to the process that opened it
+	if (!processId && connectionId) {
+		const QByteArray connection = m_processTable.Connection(connectionId);
+		if (connection.size() >= static_cast<int>(PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneConnectionEventBody))) {
+			processId = reinterpret_cast<const HoneConnectionEventBody*>(connection.constData() + sizeof(PcapNgBlockHeader))->processId;
+		}
+	}
+	Describe(processId, connectionId);
+
+	const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(block + sizeof(PcapNgBlockHeader));
+	const quint64 timestamp = (static_cast<quint64>(packet->timestampHigh) << 32) | packet->timestampLow;
+	Totals &totals = m_totals[qMakePair(timestamp - (timestamp % m_bucketMicroseconds),
+			(static_cast<quint64>(processId) << 32) | connectionId)];
+	totals.bytes += packet->packetLength;
+	totals.packets++;
+}
+
+//-----------------------------------------------------------------------------
+void MetadataSink::AddProcess(const char *block, const quint32 length)
+{
+	if (length < PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneProcessEventBody)) {
+		return;
+	}
+	const HoneProcessEventBody *process   = reinterpret_cast<const HoneProcessEventBody*>(block + sizeof(PcapNgBlockHeader));
+	const quint32               processId = HoneEventId(process->processId);
+	const bool                  ends      = HoneEventEnds(process->processId);
+	if (ends) {
+		Describe(processId, 0);
+	}
+
+	const char   *options       = block + sizeof(PcapNgBlockHeader) + sizeof(HoneProcessEventBody);
+	const quint32 optionsLength = length - PCAPNG_MIN_BLOCK_LENGTH - sizeof(HoneProcessEventBody);
+	const char   *value;
+	quint16       valueLength;
+	QByteArray    path;
+	QByteArray    argv;
+	if (PcapNgFindOption(options, optionsLength, HONE_PROCESS_OPT_PATH, value, valueLength)) {
+		path = QByteArray(value, valueLength);
+	}
+
+	// The arguments are separated by nulls
+	if (PcapNgFindOption(options, optionsLength, HONE_PROCESS_OPT_ARGV, value, valueLength)) {
+		argv = QByteArray(value, valueLength);
+		while (argv.endsWith('\0')) {
+			argv.chop(1);
+		}
+		argv.replace('\0', ' ');
+	}
+
+	m_processes.Append(ProcessTimestamp, (static_cast<quint64>(process->timestampHigh) << 32) | process->timestampLow);
+	m_processes.Append(ProcessId, processId);
+	m_processes.Append(ProcessPath, path);
+	m_processes.Append(ProcessArgv, argv);
+	m_processes.Append(ProcessEvent, ends ? QByteArray("end") : QByteArray("start"));
+	if (!ends) {
+		m_describedProcesses.insert(processId);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void MetadataSink::Describe(const quint32 processId, const quint32 connectionId)
+{
+	// Repeat what an earlier file described, as far as it is still known
+	if (processId && !m_describedProcesses.contains(processId)) {
+		const QByteArray process = m_processTable.Process(processId);
+		if (!process.isEmpty()) {
+			AddProcess(process.constData(), process.size());
+		}
+	}
+	if (connectionId && !m_describedConnections.contains(connectionId)) {
+		const QByteArray connection = m_processTable.Connection(connectionId);
+		if (!connection.isEmpty()) {
+			AddConnection(connection.constData(), connection.size());
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool MetadataSink::Flush(const QString &captureFileName)
+{
+	// Sorted by bucket, process and connection
+	for (QMap<TotalsKey, Totals>::const_iterator iter = m_totals.constBegin(); iter != m_totals.constEnd(); ++iter) {
+		m_packets.Append(PacketBucketStart, iter.key().first);
+		m_packets.Append(PacketProcessId, iter.key().second >> 32);
+		m_packets.Append(PacketConnectionId, iter.key().second & 0xFFFFFFFF);
+		m_packets.Append(PacketCount, iter->packets);
+		m_packets.Append(PacketBytes, iter->bytes);
+	}
+
+	const QStringList fileNames = TableFileNames(captureFileName);
+	bool rc = true;
+	if (!m_processes.Write(fileNames.at(0))) {
+		m_error = m_processes.Error();
+		rc      = false;
+	} else if (!m_connections.Write(fileNames.at(1))) {
+		m_error = m_connections.Error();
+		rc      = false;
+	} else if (!m_packets.Write(fileNames.at(2))) {
+		m_error = m_packets.Error();
+		rc      = false;
+	}
+
+	m_connections.Clear();
+	m_describedConnections.clear();
+	m_describedProcesses.clear();
+	m_packets.Clear();
+	m_processes.Clear();
+	m_totals.clear();
+	return rc;
+}
+
+//-----------------------------------------------------------------------------
+QStringList MetadataSink::TableFileNames(const QString &captureFileName)
+{
+	// The processes, connections and packets tables, in that order
+	const QFileInfo fileInfo(captureFileName);
+	const QString   baseName = QString("%1/%2").arg(fileInfo.absolutePath(), fileInfo.completeBaseName());
+	return QStringList() << baseName + ".processes.arrow" << baseName + ".connections.arrow" << baseName + ".packets.arrow";
+}
+
+//-----------------------------------------------------------------------------
+void MetadataSink::Write(const char *data, const quint32 length)
+{
+	// The data must hold only complete blocks
+	quint32 offset = 0;
+	while (offset < length) {
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + offset);
+		if (!PcapNgBlockLength(data + offset, length - offset)) {
+			break;
+		}
+
+		// Add events before the table forgets what an end event ended
+		const char *block = data + offset;
+		switch (header->blockType) {
+		case HONE_PROCESS_EVENT_BLOCK:
+			AddProcess(block, header->blockLength);
+			m_processTable.Update(block, header->blockLength);
+			break;
+		case HONE_CONNECTION_EVENT_BLOCK:
+			AddConnection(block, header->blockLength);
+			m_processTable.Update(block, header->blockLength);
+			break;
+		case PCAPNG_ENHANCED_PACKET_BLOCK:
+			if (header->blockLength >= PCAPNG_MIN_PACKET_BLOCK_LENGTH) {
+				AddPacket(block, header->blockLength);
+			}
+			break;
+		default:
+			break;
+		}
+		offset += header->blockLength;
+	}
+}
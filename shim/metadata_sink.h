@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef METADATA_SINK_H
+#define METADATA_SINK_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include "arrow_table.h"
+#include "process_table.h"
+
+//----------------------------------------------------------------------------
+// Writes the Hone metadata of each capture file as Arrow tables next to it,
+// so the processes, connections and traffic can be queried without parsing
+// the capture.  Each file gets a table of the starts and ends of its
+// processes, one of its connections, and one of its packet and byte counts
+// for each process and connection in buckets of a fixed number of seconds.  Processes and
+// connections described in an earlier file are repeated in every later file
+// with packets from them, so each file's tables stand on their own.
+class MetadataSink
+{
+public:
+	explicit MetadataSink(const quint32 bucketSeconds);
+
+	QString Error(void) const { return m_error; }
+	bool    Flush(const QString &captureFileName);
+	void    Write(const char *data, const quint32 length);
+
+	static QStringList TableFileNames(const QString &captureFileName);
+
+private:
+	enum ConnectionColumn {
+		ConnectionTimestamp,
+		ConnectionId,
+		ConnectionProcessId,
+		ConnectionEvent,
+	};
+	enum PacketColumn {
+		PacketBucketStart,
+		PacketProcessId,
+		PacketConnectionId,
+		PacketCount,
+		PacketBytes,
+	};
+	enum ProcessColumn {
+		ProcessTimestamp,
+		ProcessId,
+		ProcessPath,
+		ProcessArgv,
+		ProcessEvent,
+	};
+	struct Totals {
+		quint64 bytes;
+		quint64 packets;
+	};
+	typedef QPair<quint64, quint64> TotalsKey;  // Bucket, then process and connection
+
+	void AddConnection(const char *block, const quint32 length);
+	void AddPacket(const char *block, const quint32 length);
+	void AddProcess(const char *block, const quint32 length);
+	void Describe(const quint32 processId, const quint32 connectionId);
+
+	quint64                  m_bucketMicroseconds;
+	ArrowTable               m_connections;
+	QSet<quint32>            m_describedConnections;  // In the current file
+	QSet<quint32>            m_describedProcesses;
+	QString                  m_error;
+	ArrowTable               m_packets;
+	ProcessTable             m_processTable;
+	ArrowTable               m_processes;
+	QMap<TotalsKey, Totals>  m_totals;
+};
+
+#endif // METADATA_SINK_H
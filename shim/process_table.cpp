@@ -0,0 +1,137 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QMap>
+
+#include "hone_pcapng.h"
+#include "process_table.h"
+
+// Limit for each of the process and connection tables
+const int ProcessTable::m_maxEntries = 32768;
+
+//-----------------------------------------------------------------------------
+ProcessTable::ProcessTable(void)
+	: m_sequence(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+quint32 ProcessTable::Append(const EntryHash &entries, QByteArray &blocks) const
+{
+	// Replay the blocks in the order they were first seen
+	QMap<quint64, const Entry*> ordered;
+	for (EntryHash::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+		ordered.insert(iter->sequence, &(*iter));
+	}
+	for (QMap<quint64, const Entry*>::const_iterator iter = ordered.begin(); iter != ordered.end(); ++iter) {
+		blocks.append((*iter)->block);
+	}
+	return ordered.size();
+}
+
+//-----------------------------------------------------------------------------
+void ProcessTable::Clear(void)
+{
+	m_connections.clear();
+	m_processes.clear();
+}
+
+//-----------------------------------------------------------------------------
+QByteArray ProcessTable::Connection(const quint32 connectionId) const
+{
+	// Block that opened the connection, or an empty array if unknown
+	const EntryHash::const_iterator iter = m_connections.find(connectionId);
+	return (iter != m_connections.end()) ? iter->block : QByteArray();
+}
+
+//-----------------------------------------------------------------------------
+void ProcessTable::Evict(EntryHash &entries)
+{
+	// Drop the oldest eighth of the table, so the scan for the oldest entries
+	// happens rarely
+	QMap<quint64, quint32> ordered;
+	for (EntryHash::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+		ordered.insert(iter->sequence, iter.key());
+	}
+	int evictCount = m_maxEntries / 8;
+	for (QMap<quint64, quint32>::const_iterator iter = ordered.begin(); (iter != ordered.end()) && evictCount; ++iter, evictCount--) {
+		entries.remove(*iter);
+	}
+}
+
+//-----------------------------------------------------------------------------
+QByteArray ProcessTable::Process(const quint32 processId) const
+{
+	// Block that started the process, or an empty array if unknown
+	const EntryHash::const_iterator iter = m_processes.find(processId);
+	return (iter != m_processes.end()) ? iter->block : QByteArray();
+}
+
+//-----------------------------------------------------------------------------
+quint32 ProcessTable::Snapshot(QByteArray &blocks) const
+{
+	// Processes go first, since the connections refer to them
+	blocks.clear();
+	const quint32 blockCount = Append(m_processes, blocks);
+	return blockCount + Append(m_connections, blocks);
+}
+
+//-----------------------------------------------------------------------------
+void ProcessTable::Store(EntryHash &entries, const quint32 key, const char *block, const quint32 length)
+{
+	// An end block retires the entry, and any later block for a live entry
+	// would only repeat or finish what its first block described
+	if (HoneEventEnds(key)) {
+		entries.remove(HoneEventId(key));
+		return;
+	}
+	if (entries.contains(key)) {
+		return;
+	}
+	if (entries.size() >= m_maxEntries) {
+		Evict(entries);
+	}
+	Entry &entry   = entries[key];
+	entry.block    = QByteArray(block, length);
+	entry.sequence = m_sequence++;
+}
+
+//-----------------------------------------------------------------------------
+void ProcessTable::Update(const char *data, const quint32 length)
+{
+	// The data must hold only complete blocks
+	quint32 offset = 0;
+	while (offset < length) {
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + offset);
+		if (!PcapNgBlockLength(data + offset, length - offset)) {
+			break;
+		}
+
+		const char *body = data + offset + sizeof(PcapNgBlockHeader);
+		switch (header->blockType) {
+		case HONE_PROCESS_EVENT_BLOCK:
+			if (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneProcessEventBody)) {
+				const HoneProcessEventBody *process = reinterpret_cast<const HoneProcessEventBody*>(body);
+				Store(m_processes, process->processId, data + offset, header->blockLength);
+			}
+			break;
+		case HONE_CONNECTION_EVENT_BLOCK:
+			if (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneConnectionEventBody)) {
+				const HoneConnectionEventBody *connection = reinterpret_cast<const HoneConnectionEventBody*>(body);
+				Store(m_connections, connection->connectionId, data + offset, header->blockLength);
+			}
+			break;
+		default:
+			break;
+		}
+		offset += header->blockLength;
+	}
+}
@@ -0,0 +1,50 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef PROCESS_TABLE_H
+#define PROCESS_TABLE_H
+
+#include <QByteArray>
+#include <QHash>
+
+//----------------------------------------------------------------------------
+// Keeps the block that started each live Hone process and opened each live
+// connection, so a new capture file can start with a description of
+// everything that is still running.  Entries go when their end block does.
+class ProcessTable
+{
+public:
+	ProcessTable(void);
+
+	void       Clear(void);
+	QByteArray Connection(const quint32 connectionId) const;
+	QByteArray Process(const quint32 processId) const;
+	quint32    Snapshot(QByteArray &blocks) const;
+	void       Update(const char *data, const quint32 length);
+
+private:
+	struct Entry {
+		QByteArray block;
+		quint64    sequence;
+	};
+	typedef QHash<quint32, Entry> EntryHash;
+
+	void    Evict(EntryHash &entries);
+	void    Store(EntryHash &entries, const quint32 key, const char *block, const quint32 length);
+	quint32 Append(const EntryHash &entries, QByteArray &blocks) const;
+
+	EntryHash            m_connections;
+	static const int     m_maxEntries;
+	EntryHash            m_processes;
+	quint64              m_sequence;
+};
+
+#endif // PROCESS_TABLE_H
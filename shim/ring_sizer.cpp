@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include "ring_sizer.h"
+
+// Growing takes effect at once, but give each change a moment to show
+// before growing again, and shrink only after a long quiet spell
+const qint64 RingSizer::m_growIntervalMsecs   = 1000;
+const qint64 RingSizer::m_shrinkIntervalMsecs = 60 * 1000;
+
+//-----------------------------------------------------------------------------
+RingSizer::RingSizer(void)
+	: m_lastChange(0)
+	, m_maxPages(0)
+	, m_minPages(0)
+	, m_pageSize(4096)
+	, m_pages(0)
+	, m_peakPercent(0)
+	, m_runBytes(0)
+	, m_windowStart(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+quint32 RingSizer::Resize(const quint32 pages, const qint64 now)
+{
+	m_lastChange  = now;
+	m_peakPercent = 0;
+	m_windowStart = now;
+	return pages;
+}
+
+//-----------------------------------------------------------------------------
+void RingSizer::SetBounds(const quint32 minPages, const quint32 maxPages)
+{
+	m_minPages = minPages;
+	m_maxPages = maxPages;
+}
+
+//-----------------------------------------------------------------------------
+void RingSizer::SetPages(const quint32 pages, const quint32 pageSize)
+{
+	m_pages    = pages;
+	m_pageSize = pageSize;
+}
+
+//-----------------------------------------------------------------------------
+quint32 RingSizer::Update(const quint32 bytesRead, const bool fullRead, const qint64 now)
+{
+	if (!m_pages) {
+		return m_pages;
+	}
+	if (!m_windowStart) {
+		m_windowStart = now;
+	}
+
+	// The read that ends a run drains what was left, so it counts too
+	m_runBytes += bytesRead;
+	const quint64 ringBytes = static_cast<quint64>(m_pages) * m_pageSize;
+	const quint32 percent   = static_cast<quint32>(qMin(m_runBytes * 100 / ringBytes, static_cast<quint64>(1000)));
+	m_peakPercent = qMax(m_peakPercent, percent);
+	if (!fullRead) {
+		m_runBytes = 0;
+	}
+
+	if ((percent >= 75) && (m_pages < m_maxPages) && ((now - m_lastChange) >= m_growIntervalMsecs)) {
+		return Resize(qMin(m_pages * 2, m_maxPages), now);
+	}
+	if ((now - m_windowStart) >= m_shrinkIntervalMsecs) {
+		if ((m_peakPercent < 25) && (m_pages > m_minPages)) {
+			return Resize(qMax(m_pages / 2, m_minPages), now);
+		}
+		m_peakPercent = 0;
+		m_windowStart = now;
+	}
+	return m_pages;
+}
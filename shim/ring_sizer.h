@@ -0,0 +1,51 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef RING_SIZER_H
+#define RING_SIZER_H
+
+#include <QtGlobal>
+
+//----------------------------------------------------------------------------
+// Chooses the size of the driver's ring buffer from what the reads return.
+// A run of reads that fill the read buffer means the ring had at least that
+// much data queued when the run began, so the bytes read during the run give
+// a lower bound on how full the ring got.  The ring is doubled when it gets
+// three quarters full, and halved again after a minute in which it never
+// got a quarter full, always staying within the configured bounds.
+class RingSizer
+{
+public:
+	RingSizer(void);
+
+	quint32 MaxPages(void) const { return m_maxPages; }
+	quint32 MinPages(void) const { return m_minPages; }
+	quint32 Pages(void) const { return m_pages; }
+	void    SetBounds(const quint32 minPages, const quint32 maxPages);
+	void    SetPages(const quint32 pages, const quint32 pageSize);
+	quint32 Update(const quint32 bytesRead, const bool fullRead, const qint64 now);
+
+private:
+	quint32 Resize(const quint32 pages, const qint64 now);
+
+	static const qint64 m_growIntervalMsecs;
+	qint64              m_lastChange;
+	quint32             m_maxPages;
+	quint32             m_minPages;
+	quint32             m_pageSize;
+	quint32             m_pages;
+	quint32             m_peakPercent;
+	quint64             m_runBytes;
+	static const qint64 m_shrinkIntervalMsecs;
+	qint64              m_windowStart;
+};
+
+#endif // RING_SIZER_H
@@ -0,0 +1,306 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "hone_pcapng.h"
+#include "shared_ring.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+//-----------------------------------------------------------------------------
+SharedRing::SharedRing(QObject *parent)
+	: QThread(parent)
+	, m_data(NULL)
+	, m_dataSize(0)
+	, m_header(NULL)
+	, m_listenHandle(-1)
+	, m_maxRecordLength(0)
+	, m_readOnlyHandle(-1)
+	, m_ringHandle(-1)
+{
+}
+
+//-----------------------------------------------------------------------------
+SharedRing::~SharedRing(void)
+{
+	Stop();
+	if (m_header) {
+		::munmap(m_header, HONE_RING_HEADER_SIZE + m_dataSize);
+	}
+	if (m_readOnlyHandle != -1) {
+		::close(m_readOnlyHandle);
+	}
+	if (m_ringHandle != -1) {
+		::close(m_ringHandle);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::Drop(const quint32 length)
+{
+	// Readers can't tell what never reached the ring, so count it for them
+	__atomic_add_fetch(&m_header->droppedBlocks, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m_header->droppedBytes, length, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+bool SharedRing::Listen(const QString &socketName)
+{
+	struct sockaddr_un address;
+	const QByteArray   path = socketName.toLocal8Bit();
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= static_cast<int>(sizeof(address.sun_path))) {
+		m_error = QString("Socket name %1 is too long").arg(socketName);
+		return false;
+	}
+	strcpy(address.sun_path, path.data());
+
+	m_listenHandle = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listenHandle == -1) {
+		m_error = QString("Cannot create socket: %1").arg(strerror(errno));
+		return false;
+	}
+	::unlink(path.data()); // Remove a stale socket from an earlier capture
+
+	// Anyone who can connect gets the whole capture, so only our own user may,
+	// and the socket's mode is set before it accepts anything
+	if ((::bind(m_listenHandle, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) ||
+			(::chmod(path.data(), S_IRUSR | S_IWUSR) == -1) ||
+			(::listen(m_listenHandle, 16) == -1)) {
+		m_error = QString("Cannot listen on %1: %2").arg(socketName, strerror(errno));
+		::close(m_listenHandle);
+		m_listenHandle = -1;
+		return false;
+	}
+	m_socketName = socketName;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool SharedRing::Open(const QString &socketName, const quint32 dataSize)
+{
+#ifdef SYS_memfd_create
+	m_ringHandle = ::syscall(SYS_memfd_create, "hone-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	errno = ENOSYS;
+#endif
+	if (m_ringHandle == -1) {
+		m_error = QString("Cannot create the shared ring: %1").arg(strerror(errno));
+		return false;
+	}
+
+	// Readers get their own descriptor opened read-only, so they can map the
+	// ring but never write to it
+	m_dataSize = dataSize & ~7;
+	const QByteArray procName = QString("/proc/self/fd/%1").arg(m_ringHandle).toLocal8Bit();
+	m_readOnlyHandle = ::open(procName.data(), O_RDONLY | O_CLOEXEC);
+	if ((m_readOnlyHandle == -1) || (::ftruncate(m_ringHandle, HONE_RING_HEADER_SIZE + m_dataSize) == -1)) {
+		m_error = QString("Cannot size the shared ring: %1").arg(strerror(errno));
+		return false;
+	}
+
+	// Fault the whole ring in now rather than on the capture's time
+	void *map = ::mmap(NULL, HONE_RING_HEADER_SIZE + m_dataSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, m_ringHandle, 0);
+	if (map == MAP_FAILED) {
+		m_error = QString("Cannot map the shared ring: %1").arg(strerror(errno));
+		return false;
+	}
+	m_header = static_cast<HoneRingHeader*>(map);
+
+	// A reader could reopen its descriptor read-write through /proc, so seal
+	// the ring against any write but through the mapping above, and against
+	// resizing
+	if (::fcntl(m_ringHandle, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) == -1) {
+		m_error = QString("Cannot seal the shared ring: %1").arg(strerror(errno));
+		return false;
+	}
+
+	m_data   = static_cast<char*>(map) + HONE_RING_HEADER_SIZE;
+	m_header->magic    = HONE_RING_MAGIC;
+	m_header->version  = HONE_RING_VERSION;
+	m_header->dataSize = m_dataSize;
+
+	// Keep records to a quarter of the ring, so a reader always has several
+	// to catch up on before it is lapped
+	m_maxRecordLength = m_dataSize / 4;
+	return Listen(socketName);
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::Publish(const char *data, const quint32 length)
+{
+	// The data must hold only complete blocks.  Keep the headers of each new
+	// section for readers that attach later.
+	if ((length >= sizeof(PcapNgBlockHeader)) &&
+			(reinterpret_cast<const PcapNgBlockHeader*>(data)->blockType == PCAPNG_SECTION_HEADER_BLOCK)) {
+		WriteSectionHeaders(data, length);
+	}
+
+	// Split large writes between blocks
+	quint32 offset = 0;
+	while (offset < length) {
+		quint32 blockLength  = 0;
+		quint32 recordLength = 0;
+		while (offset + recordLength < length) {
+			blockLength = PcapNgBlockLength(data + offset + recordLength, length - offset - recordLength);
+			if (!blockLength || (recordLength + blockLength + sizeof(HoneRingRecord) > m_maxRecordLength)) {
+				break;
+			}
+			recordLength += blockLength;
+		}
+		if (recordLength) {
+			WriteRecord(data + offset, recordLength);
+			offset += recordLength;
+		} else if (blockLength) {
+			// A block too large for the ring, so skip just that one
+			Drop(blockLength);
+			offset += blockLength;
+		} else {
+			// A corrupt block, so there is no telling where the next one starts
+			Drop(length - offset);
+			break;
+		}
+	}
+
+	// Wake the readers waiting for data
+	__atomic_add_fetch(&m_header->wakeCount, 1, __ATOMIC_RELEASE);
+	::syscall(SYS_futex, &m_header->wakeCount, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::Reserve(const quint64 end)
+{
+	// Move the tail past the records about to be overwritten, and make sure
+	// readers can see that before any of them are touched
+	quint64 tail = m_header->tail;
+	if (tail + m_dataSize >= end) {
+		return;
+	}
+	do {
+		tail += reinterpret_cast<const HoneRingRecord*>(m_data + (tail % m_dataSize))->recordLength;
+	} while (tail + m_dataSize < end);
+	__atomic_store_n(&m_header->tail, tail, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::run(void)
+{
+	// Hand each reader the ring and hang up.  Stop ends the wait by shutting
+	// the socket down.
+	for (;;) {
+		const int handle = ::accept(m_listenHandle, NULL, NULL);
+		if (handle == -1) {
+			if ((errno == EINTR) || (errno == ECONNABORTED)) {
+				continue;
+			}
+			break;
+		}
+
+		char           byte = 0;
+		struct iovec   iov  = { &byte, sizeof(byte) };
+		char           control[CMSG_SPACE(sizeof(int))];
+		struct msghdr  message;
+		memset(&message, 0, sizeof(message));
+		memset(control, 0, sizeof(control));
+		message.msg_iov        = &iov;
+		message.msg_iovlen     = 1;
+		message.msg_control    = control;
+		message.msg_controllen = sizeof(control);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &m_readOnlyHandle, sizeof(int));
+		::sendmsg(handle, &message, MSG_NOSIGNAL);
+		::close(handle);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::Stop(void)
+{
+	if (m_listenHandle == -1) {
+		return;
+	}
+	::shutdown(m_listenHandle, SHUT_RDWR);
+	wait();
+	::close(m_listenHandle);
+	::unlink(m_socketName.toLocal8Bit().data());
+	m_listenHandle = -1;
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::WriteRecord(const char *data, const quint32 length)
+{
+	// Records never wrap, so pad out the end of the ring when one won't fit
+	const quint32 recordLength = (sizeof(HoneRingRecord) + length + 7) & ~7;
+	quint64       head         = m_header->head;
+	quint64       offset       = head % m_dataSize;
+	if (offset + recordLength > m_dataSize) {
+		const quint32 padding = m_dataSize - offset;
+		Reserve(head + padding);
+		HoneRingRecord *record = reinterpret_cast<HoneRingRecord*>(m_data + offset);
+		record->recordLength = padding;
+		record->dataLength   = 0;
+		head  += padding;
+		offset = 0;
+	}
+
+	Reserve(head + recordLength);
+	HoneRingRecord *record = reinterpret_cast<HoneRingRecord*>(m_data + offset);
+	record->recordLength = recordLength;
+	record->dataLength   = length;
+	memcpy(record + 1, data, length);
+	__atomic_store_n(&m_header->head, head + recordLength, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------
+void SharedRing::WriteSectionHeaders(const char *data, const quint32 length)
+{
+	quint32       blockCount;
+	const quint32 headerLength = PcapNgHeaderLength(data, length, blockCount);
+	if (!headerLength || (headerLength > HONE_RING_MAX_SECTION_LENGTH)) {
+		return;
+	}
+	__atomic_add_fetch(&m_header->sectionGeneration, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memcpy(m_header + 1, data, headerLength);
+	m_header->sectionLength = headerLength;
+	__atomic_add_fetch(&m_header->sectionGeneration, 1, __ATOMIC_RELEASE);
+}
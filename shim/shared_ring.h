@@ -0,0 +1,61 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <QString>
+#include <QThread>
+
+#include "hone_ring.h"
+
+//----------------------------------------------------------------------------
+// Publishes the capture into a ring in shared memory, so local analysers can
+// read it in place instead of through a file or a pipe.  The ring lives in a
+// memfd, which is handed out read-only over a Unix socket by a thread that
+// does nothing else, and read with HoneRingReader from hone_ring.h.  The
+// capture never waits for the readers: it overwrites the oldest records,
+// and readers that fall behind find out from the ring's tail.
+class SharedRing : public QThread
+{
+	Q_OBJECT
+
+public:
+	explicit SharedRing(QObject *parent = 0);
+	~SharedRing(void);
+
+	QString Error(void) const { return m_error; }
+	bool    Open(const QString &socketName, const quint32 dataSize);
+	void    Publish(const char *data, const quint32 length);
+	void    Stop(void);
+
+protected:
+	void run(void);
+
+private:
+	void Drop(const quint32 length);
+	bool Listen(const QString &socketName);
+	void Reserve(const quint64 end);
+	void WriteRecord(const char *data, const quint32 length);
+	void WriteSectionHeaders(const char *data, const quint32 length);
+
+	char           *m_data;
+	quint64         m_dataSize;
+	QString         m_error;
+	HoneRingHeader *m_header;
+	int             m_listenHandle;
+	quint32         m_maxRecordLength;
+	int             m_readOnlyHandle;  // Handed to readers
+	int             m_ringHandle;
+	QString         m_socketName;
+};
+
+#endif // SHARED_RING_H
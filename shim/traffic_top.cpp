@@ -0,0 +1,181 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include <QDateTime>
+#include <QMap>
+#include <QStringList>
+
+#include <string.h>
+
+#include "hone_pcapng.h"
+#include "traffic_top.h"
+
+// Processes and executable paths to track before dropping idle processes
+const int TrafficTop::m_maxEntries = 32768;
+const int TrafficTop::m_slotCount;
+
+//-----------------------------------------------------------------------------
+TrafficTop::TrafficTop(void)
+	: m_lastEntry(NULL)
+	, m_lastProcessId(0)
+	, m_slot(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTop::Add(const char *block, const quint32 blockLength)
+{
+	const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(block);
+	if (header->blockType == PCAPNG_ENHANCED_PACKET_BLOCK) {
+		if (blockLength < PCAPNG_MIN_PACKET_BLOCK_LENGTH) {
+			return;
+		}
+		const char *options;
+		quint32     optionsLength;
+		quint32     processId;
+		PcapNgPacketOptions(block, blockLength, options, optionsLength);
+		if (!PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_PROCESS_ID, processId)) {
+			return;
+		}
+		const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(header + 1);
+		Entry        &entry = Touch(processId);
+		const quint32 slot  = m_slot % m_slotCount;
+		entry.bytes[slot]  += packet->packetLength;
+		entry.packets[slot]++;
+	} else if (header->blockType == HONE_PROCESS_EVENT_BLOCK) {
+		if (blockLength < PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneProcessEventBody)) {
+			return;
+		}
+		const HoneProcessEventBody *process = reinterpret_cast<const HoneProcessEventBody*>(header + 1);
+		const char *options       = block + sizeof(PcapNgBlockHeader) + sizeof(HoneProcessEventBody);
+		const quint32 optionsLength = blockLength - PCAPNG_MIN_BLOCK_LENGTH - sizeof(HoneProcessEventBody);
+		const char *path;
+		quint16     pathLength;
+		if (PcapNgFindOption(options, optionsLength, HONE_PROCESS_OPT_PATH, path, pathLength)) {
+			if ((m_paths.size() >= m_maxEntries) && !m_paths.contains(process->processId)) {
+				Expire();
+			}
+			m_paths.insert(process->processId, QByteArray(path, pathLength));
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTop::Advance(const qint64 nowMsecs)
+{
+	m_slot = nowMsecs / 1000;
+}
+
+//-----------------------------------------------------------------------------
+void TrafficTop::Expire(void)
+{
+	// Forget processes that sent nothing for a whole minute, along with the
+	// paths of processes that never sent anything
+	for (EntryHash::iterator iter = m_entries.begin(); iter != m_entries.end();) {
+		if (iter->lastSlot + m_slotCount <= m_slot) {
+			iter = m_entries.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+	for (QHash<quint32, QByteArray>::iterator iter = m_paths.begin(); iter != m_paths.end();) {
+		if (!m_entries.contains(iter.key())) {
+			iter = m_paths.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+	m_lastEntry = NULL;
+}
+
+//-----------------------------------------------------------------------------
+QString TrafficTop::Report(const int count, const int intervalSeconds)
+{
+	// Both windows end with the current slot.  The ring only holds a minute,
+	// so a slot a minute old is the current one again, and counting it twice
+	// would overstate the minute.
+	QMultiMap<quint64, Totals> ranked;
+	for (EntryHash::const_iterator iter = m_entries.begin(); iter != m_entries.end(); ++iter) {
+		Totals totals = { 0, 0, 0, 0, iter.key() };
+		for (int age = 0; age < m_slotCount; age++) {
+			if (m_slot < static_cast<quint64>(age)) {
+				break;
+			}
+			const quint64 slot = m_slot - age;
+			if (slot > iter->lastSlot) {
+				continue;
+			}
+			totals.minuteBytes   += iter->bytes[slot % m_slotCount];
+			totals.minutePackets += iter->packets[slot % m_slotCount];
+			if (age < intervalSeconds) {
+				totals.bytes   += iter->bytes[slot % m_slotCount];
+				totals.packets += iter->packets[slot % m_slotCount];
+			}
+		}
+		if (totals.minutePackets) {
+			ranked.insert(totals.bytes, totals);
+		}
+	}
+
+	QStringList report;
+	report.append(QString("Top processes at %1, over the last %2 s and minute")
+			.arg(QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss")).arg(intervalSeconds));
+	report.append("       PID  Packets/s       KB/s  Packets/min     MB/min  Executable");
+	int rank = 0;
+	QMultiMap<quint64, Totals>::const_iterator iter = ranked.constEnd();
+	while ((iter != ranked.constBegin()) && (rank < count)) {
+		--iter;
+		const Totals &totals = *iter;
+		report.append(QString("%1 %2 %3 %4 %5  %6")
+				.arg(totals.processId, 10)
+				.arg(totals.packets / intervalSeconds, 10)
+				.arg(totals.bytes / intervalSeconds / 1024, 10)
+				.arg(totals.minutePackets, 12)
+				.arg(totals.minuteBytes / (1024 * 1024), 10)
+				.arg(QString::fromLocal8Bit(m_paths.value(totals.processId, "?"))));
+		rank++;
+	}
+	if (!rank) {
+		report.append("(no traffic)");
+	}
+	return report.join("\n");
+}
+
+//-----------------------------------------------------------------------------
+TrafficTop::Entry &TrafficTop::Touch(const quint32 processId)
+{
+	// Packets tend to come in runs from the same process
+	if (!m_lastEntry || (m_lastProcessId != processId)) {
+		if ((m_entries.size() >= m_maxEntries) && !m_entries.contains(processId)) {
+			Expire();
+		}
+		EntryHash::iterator iter = m_entries.find(processId);
+		if (iter == m_entries.end()) {
+			iter = m_entries.insert(processId, Entry());
+			::memset(&(*iter), 0, sizeof(Entry));
+			iter->lastSlot = m_slot;
+		}
+		m_lastEntry     = &(*iter);
+		m_lastProcessId = processId;
+	}
+
+	// Clear the slots skipped since the process was last seen
+	Entry &entry = *m_lastEntry;
+	if (entry.lastSlot != m_slot) {
+		const quint64 skipped = qMin(m_slot - entry.lastSlot, static_cast<quint64>(m_slotCount));
+		for (quint64 slot = m_slot - skipped + 1; slot <= m_slot; slot++) {
+			entry.bytes[slot % m_slotCount]   = 0;
+			entry.packets[slot % m_slotCount] = 0;
+		}
+		entry.lastSlot = m_slot;
+	}
+	return entry;
+}
@@ -0,0 +1,62 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef TRAFFIC_TOP_H
+#define TRAFFIC_TOP_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+//----------------------------------------------------------------------------
+// Totals packets and bytes for each process over one-second slots, so the
+// capture can report which processes are busiest right now.  Each process
+// keeps a minute of slots, and slots are only cleared when the process is
+// next seen, so counting a packet costs one hash lookup at most.
+class TrafficTop
+{
+public:
+	TrafficTop(void);
+
+	void    Add(const char *block, const quint32 blockLength);
+	void    Advance(const qint64 nowMsecs);
+	QString Report(const int count, const int intervalSeconds);
+
+private:
+	static const int m_slotCount = 60;
+
+	struct Entry {
+		quint32 bytes[m_slotCount];
+		quint64 lastSlot;
+		quint32 packets[m_slotCount];
+	};
+	typedef QHash<quint32, Entry> EntryHash;
+
+	struct Totals {
+		quint64 bytes;
+		quint64 minuteBytes;
+		quint64 minutePackets;
+		quint64 packets;
+		quint32 processId;
+	};
+
+	void   Expire(void);
+	Entry &Touch(const quint32 processId);
+
+	EntryHash                  m_entries;
+	Entry                     *m_lastEntry;
+	quint32                    m_lastProcessId;
+	static const int           m_maxEntries;
+	QHash<quint32, QByteArray> m_paths;
+	quint64                    m_slot;
+};
+
+#endif // TRAFFIC_TOP_H
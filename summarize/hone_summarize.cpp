@@ -0,0 +1,387 @@
+//----------------------------------------------------------------------------
+// Hone capture summarizer
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#include "hone_summarize.h"
+#include "hone_pcapng.h"
+
+#include <QtConcurrentMap>
+#include <QThreadPool>
+
+//----------------------------------------------------------------------------
+static QString JsonString(const QString &value)
+{
+	QString escaped;
+	for (int index = 0; index < value.length(); index++) {
+		const ushort c = value.at(index).unicode();
+		switch (c) {
+		case '"':  escaped.append("\\\""); break;
+		case '\\': escaped.append("\\\\"); break;
+		case '\n': escaped.append("\\n");  break;
+		case '\r': escaped.append("\\r");  break;
+		case '\t': escaped.append("\\t");  break;
+		default:
+			if (c < 0x20) {
+				escaped.append(QString("\\u%1").arg(static_cast<uint>(c), 4, 16, QChar('0')));
+			} else {
+				escaped.append(value.at(index));
+			}
+			break;
+		}
+	}
+	return QString("\"%1\"").arg(escaped);
+}
+
+//-----------------------------------------------------------------------------
+HoneSummarize::HoneSummarize(QObject *parent)
+	: QObject(parent)
+	, m_bucketSeconds(60)
+	, m_cerr(stderr, QIODevice::WriteOnly)
+	, m_format(OutputFormatCsv)
+	, m_jobs(QThread::idealThreadCount())
+{
+}
+
+//-----------------------------------------------------------------------------
+bool HoneSummarize::ParseArgs(const QStringList &args)
+{
+	QStringList errors;
+	QStringList inputs;
+	bool        ok;
+
+	int index;
+	for (index = 1; index < args.size(); index++) {
+		if (args.at(index) == "-f") {
+			if (index+1 >= args.size()) {
+				errors.append(QString("You must supply a format with the %1 option").arg(args.at(index)));
+				break;
+			}
+			index++;
+			if (args.at(index) == "csv") {
+				m_format = OutputFormatCsv;
+			} else if (args.at(index) == "json") {
+				m_format = OutputFormatJson;
+			} else {
+				errors.append(QString("Invalid format %1 with the %2 option").arg(args.at(index), args.at(index-1)));
+			}
+		} else if (args.at(index) == "-j") {
+			if (index+1 >= args.size()) {
+				errors.append(QString("You must supply a job count with the %1 option").arg(args.at(index)));
+				break;
+			}
+			index++;
+			m_jobs = args.at(index).toUInt(&ok);
+			if (!ok || !m_jobs) {
+				errors.append(QString("Invalid job count %1 with the %2 option").arg(args.at(index), args.at(index-1)));
+			}
+		} else if (args.at(index) == "-o") {
+			if (index+1 >= args.size()) {
+				errors.append(QString("You must supply a file name with the %1 option").arg(args.at(index)));
+				break;
+			}
+			index++;
+			m_outputFileName = args.at(index);
+		} else if (args.at(index) == "-t") {
+			if (index+1 >= args.size()) {
+				errors.append(QString("You must supply a bucket size with the %1 option").arg(args.at(index)));
+				break;
+			}
+			index++;
+			m_bucketSeconds = args.at(index).toUInt(&ok);
+			if (!ok || !m_bucketSeconds) {
+				errors.append(QString("Invalid bucket size %1 with the %2 option").arg(args.at(index), args.at(index-1)));
+			}
+		} else if (args.at(index) == "-h") {
+			return Usage(args.at(0));
+		} else {
+			inputs.append(args.at(index));
+		}
+	}
+
+	// Expand directories to the capture files in them
+	foreach (const QString &input, inputs) {
+		const QFileInfo info(input);
+		if (info.isDir()) {
+			const QDir dir(input);
+			foreach (const QString &fileName, dir.entryList(QStringList() << "*.pcapng", QDir::Files, QDir::Name)) {
+				m_fileNames.append(dir.filePath(fileName));
+			}
+		} else if (info.exists()) {
+			m_fileNames.append(input);
+		} else {
+			errors.append(QString("Cannot find %1").arg(input));
+		}
+	}
+	if (inputs.isEmpty()) {
+		errors.append("You must supply at least one capture file or directory");
+	}
+
+	if (!errors.isEmpty()) {
+		return Usage(args.at(0), errors.join("\n"));
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool HoneSummarize::Process(QStringList args)
+{
+	if (!ParseArgs(args)) {
+		return false;
+	}
+
+	// Summarize each file on its own, then merge the results
+	QList<FileSummary> summaries;
+	foreach (const QString &fileName, m_fileNames) {
+		FileSummary summary;
+		summary.bucketMicroseconds = static_cast<quint64>(m_bucketSeconds) * 1000000;
+		summary.fileName           = fileName;
+		summaries.append(summary);
+	}
+
+	QThreadPool::globalInstance()->setMaxThreadCount(m_jobs);
+	QtConcurrent::blockingMap(summaries, &HoneSummarize::SummarizeFile);
+
+	bool        rc = true;
+	FileSummary total;
+	foreach (const FileSummary &summary, summaries) {
+		if (!summary.error.isEmpty()) {
+			m_cerr << summary.error << '\n';
+			rc = false;
+		}
+		for (QHash<quint32, ProcessTotals>::const_iterator iter = summary.processes.begin(); iter != summary.processes.end(); ++iter) {
+			ProcessTotals &process = total.processes[iter.key()];
+			process.Add(*iter);
+			if (!iter->path.isEmpty()) {
+				process.path = iter->path;
+			}
+		}
+		for (QHash<quint32, ConnectionTotals>::const_iterator iter = summary.connections.begin(); iter != summary.connections.end(); ++iter) {
+			ConnectionTotals &connection = total.connections[iter.key()];
+			connection.Add(*iter);
+			if (iter->processId) {
+				connection.processId = iter->processId;
+			}
+		}
+		for (QMap<quint64, Totals>::const_iterator iter = summary.buckets.begin(); iter != summary.buckets.end(); ++iter) {
+			total.buckets[iter.key()].Add(*iter);
+		}
+	}
+	m_cerr.flush();
+
+	QFile output;
+	if (m_outputFileName.isEmpty()) {
+		output.open(stdout, QIODevice::WriteOnly);
+	} else {
+		output.setFileName(m_outputFileName);
+		if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			m_cerr << QString("Cannot open %1 for writing: %2\n").arg(m_outputFileName, output.errorString());
+			m_cerr.flush();
+			return false;
+		}
+	}
+
+	QTextStream out(&output);
+	if (m_format == OutputFormatJson) {
+		WriteJson(out, total);
+	} else {
+		WriteCsv(out, total);
+	}
+	out.flush();
+	return rc;
+}
+
+//-----------------------------------------------------------------------------
+void HoneSummarize::SummarizeBlocks(FileSummary &summary, const char *data, const quint64 length)
+{
+	// Same block walk as the shim's CountPackets, but the whole file is mapped
+	quint64 offset = 0;
+	while (offset + sizeof(PcapNgBlockHeader) <= length) {
+		const PcapNgBlockHeader *header = reinterpret_cast<const PcapNgBlockHeader*>(data + offset);
+		if (!PcapNgBlockLength(data + offset, static_cast<quint32>(qMin<quint64>(length - offset, 0xFFFFFFFF)))) {
+			summary.error = QString("%1: Truncated or corrupt block at offset %2").arg(summary.fileName, QString("%L1").arg(offset));
+			return;
+		}
+
+		const char *block = data + offset;
+		const char *body  = block + sizeof(PcapNgBlockHeader);
+		switch (header->blockType) {
+		case PCAPNG_SECTION_HEADER_BLOCK:
+			if ((header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(quint32)) &&
+					(*reinterpret_cast<const quint32*>(body) != 0x1A2B3C4D)) {
+				summary.error = QString("%1: Byte-swapped sections are not supported").arg(summary.fileName);
+				return;
+			}
+			break;
+		case HONE_PROCESS_EVENT_BLOCK:
+			if (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneProcessEventBody)) {
+				const HoneProcessEventBody *event = reinterpret_cast<const HoneProcessEventBody*>(body);
+				const quint32 optionsOffset = sizeof(PcapNgBlockHeader) + sizeof(HoneProcessEventBody);
+				const char   *path;
+				quint16       pathLength;
+				ProcessTotals &process = summary.processes[event->processId];
+				if (PcapNgFindOption(block + optionsOffset, header->blockLength - optionsOffset - sizeof(quint32),
+						HONE_PROCESS_OPT_PATH, path, pathLength)) {
+					process.path = QString::fromUtf8(path, pathLength);
+				}
+			}
+			break;
+		case HONE_CONNECTION_EVENT_BLOCK:
+			if (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(HoneConnectionEventBody)) {
+				const HoneConnectionEventBody *event = reinterpret_cast<const HoneConnectionEventBody*>(body);
+				summary.connections[event->connectionId].processId = event->processId;
+			}
+			break;
+		case PCAPNG_ENHANCED_PACKET_BLOCK:
+			if (header->blockLength >= PCAPNG_MIN_BLOCK_LENGTH + sizeof(PcapNgEnhancedPacketBody)) {
+				const PcapNgEnhancedPacketBody *packet = reinterpret_cast<const PcapNgEnhancedPacketBody*>(body);
+				const char *options;
+				quint32     optionsLength;
+				quint32     connectionId = 0;
+				quint32     processId    = 0;
+				PcapNgPacketOptions(block, header->blockLength, options, optionsLength);
+				const bool haveConnection = PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_CONNECTION_ID, connectionId);
+				if (!PcapNgFindOption32(options, optionsLength, HONE_PACKET_OPT_PROCESS_ID, processId) && haveConnection) {
+					processId = summary.connections.value(connectionId).processId;
+				}
+
+				// Hone timestamps are in microseconds
+				Totals packetTotals;
+				packetTotals.packets = 1;
+				packetTotals.bytes   = packet->packetLength;
+				const quint64 timestamp = (static_cast<quint64>(packet->timestampHigh) << 32) | packet->timestampLow;
+				summary.buckets[timestamp - (timestamp % summary.bucketMicroseconds)].Add(packetTotals);
+				summary.processes[processId].Add(packetTotals);
+				if (haveConnection) {
+					ConnectionTotals &connection = summary.connections[connectionId];
+					connection.Add(packetTotals);
+					if (!connection.processId) {
+						connection.processId = processId;
+					}
+				}
+			}
+			break;
+		default:
+			break;
+		}
+		offset += header->blockLength;
+	}
+
+	if (offset != length) {
+		summary.error = QString("%1: Truncated block at offset %2").arg(summary.fileName, QString("%L1").arg(offset));
+	}
+}
+
+//-----------------------------------------------------------------------------
+void HoneSummarize::SummarizeFile(FileSummary &summary)
+{
+	QFile file(summary.fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		summary.error = QString("Cannot open %1: %2").arg(summary.fileName, file.errorString());
+		return;
+	}
+
+	const qint64 length = file.size();
+	if (!length) {
+		return;
+	}
+	const uchar *data = file.map(0, length);
+	if (!data) {
+		summary.error = QString("Cannot map %1: %2").arg(summary.fileName, file.errorString());
+		return;
+	}
+	SummarizeBlocks(summary, reinterpret_cast<const char*>(data), length);
+	file.unmap(const_cast<uchar*>(data));
+}
+
+//-----------------------------------------------------------------------------
+bool HoneSummarize::Usage(const QString &progname, const QString &msg)
+{
+	if (!msg.isEmpty()) {
+		m_cerr << msg << "\n\n";
+	}
+
+	m_cerr << QString(
+			"Usage: %1 [options] <file or directory>...\n"
+			"  -f <format>       Output format: csv (default) or json\n"
+			"  -j <jobs>         Summarize up to <jobs> files at once (default: %2)\n"
+			"  -o <file>         Write the summary to <file> instead of stdout\n"
+			"  -t <seconds>      Time bucket size in seconds (default: 60)\n"
+			"\n"
+			"Summarizes packet and byte totals per process, per connection, and per\n"
+			"time bucket across a set of capture files written by hone-dumpcap.\n"
+			"Directories are expanded to the *.pcapng files they contain.\n")
+			.arg(QFileInfo(progname).fileName(), QString::number(QThread::idealThreadCount()));
+	m_cerr.flush();
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+void HoneSummarize::WriteCsv(QTextStream &out, const FileSummary &total)
+{
+	out << "record,process_id,connection_id,bucket_start_us,path,packets,bytes\n";
+
+	QMap<quint32, ProcessTotals> processes;
+	for (QHash<quint32, ProcessTotals>::const_iterator iter = total.processes.begin(); iter != total.processes.end(); ++iter) {
+		processes.insert(iter.key(), *iter);
+	}
+	for (QMap<quint32, ProcessTotals>::const_iterator iter = processes.begin(); iter != processes.end(); ++iter) {
+		QString path = iter->path;
+		path.replace('"', "\"\"");
+		out << QString("process,%1,,,\"%2\",%3,%4\n").arg(QString::number(iter.key()), path,
+				QString::number(iter->packets), QString::number(iter->bytes));
+	}
+
+	QMap<quint32, ConnectionTotals> connections;
+	for (QHash<quint32, ConnectionTotals>::const_iterator iter = total.connections.begin(); iter != total.connections.end(); ++iter) {
+		connections.insert(iter.key(), *iter);
+	}
+	for (QMap<quint32, ConnectionTotals>::const_iterator iter = connections.begin(); iter != connections.end(); ++iter) {
+		out << QString("connection,%1,%2,,,%3,%4\n").arg(iter->processId).arg(iter.key()).arg(iter->packets).arg(iter->bytes);
+	}
+
+	for (QMap<quint64, Totals>::const_iterator iter = total.buckets.begin(); iter != total.buckets.end(); ++iter) {
+		out << QString("bucket,,,%1,,%2,%3\n").arg(iter.key()).arg(iter->packets).arg(iter->bytes);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void HoneSummarize::WriteJson(QTextStream &out, const FileSummary &total)
+{
+	QStringList records;
+
+	QMap<quint32, ProcessTotals> processes;
+	for (QHash<quint32, ProcessTotals>::const_iterator iter = total.processes.begin(); iter != total.processes.end(); ++iter) {
+		processes.insert(iter.key(), *iter);
+	}
+	for (QMap<quint32, ProcessTotals>::const_iterator iter = processes.begin(); iter != processes.end(); ++iter) {
+		records.append(QString("    {\"process_id\": %1, \"path\": %2, \"packets\": %3, \"bytes\": %4}")
+				.arg(QString::number(iter.key()), JsonString(iter->path),
+				QString::number(iter->packets), QString::number(iter->bytes)));
+	}
+	out << "{\n  \"processes\": [\n" << records.join(",\n") << "\n  ],\n";
+
+	records.clear();
+	QMap<quint32, ConnectionTotals> connections;
+	for (QHash<quint32, ConnectionTotals>::const_iterator iter = total.connections.begin(); iter != total.connections.end(); ++iter) {
+		connections.insert(iter.key(), *iter);
+	}
+	for (QMap<quint32, ConnectionTotals>::const_iterator iter = connections.begin(); iter != connections.end(); ++iter) {
+		records.append(QString("    {\"connection_id\": %1, \"process_id\": %2, \"packets\": %3, \"bytes\": %4}")
+				.arg(iter.key()).arg(iter->processId).arg(iter->packets).arg(iter->bytes));
+	}
+	out << "  \"connections\": [\n" << records.join(",\n") << "\n  ],\n";
+
+	records.clear();
+	for (QMap<quint64, Totals>::const_iterator iter = total.buckets.begin(); iter != total.buckets.end(); ++iter) {
+		records.append(QString("    {\"bucket_start_us\": %1, \"packets\": %2, \"bytes\": %3}")
+				.arg(iter.key()).arg(iter->packets).arg(iter->bytes));
+	}
+	out << "  \"buckets\": [\n" << records.join(",\n") << "\n  ]\n}\n";
+}
@@ -0,0 +1,79 @@
+//----------------------------------------------------------------------------
+// Hone capture summarizer
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef HONE_SUMMARIZE_H
+#define HONE_SUMMARIZE_H
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QStringList>
+#include <QTextStream>
+
+//----------------------------------------------------------------------------
+class HoneSummarize : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit HoneSummarize(QObject *parent = 0);
+
+	bool Process(QStringList args);
+
+private:
+	enum OutputFormat {
+		OutputFormatCsv,   // Comma-separated values
+		OutputFormatJson,  // JSON document
+	};
+
+	struct Totals {
+		Totals(void) : packets(0), bytes(0) {}
+		void Add(const Totals &other) { packets += other.packets; bytes += other.bytes; }
+		quint64 packets;
+		quint64 bytes;
+	};
+
+	struct ProcessTotals : public Totals {
+		QString path;
+	};
+
+	struct ConnectionTotals : public Totals {
+		ConnectionTotals(void) : processId(0) {}
+		quint32 processId;
+	};
+
+	struct FileSummary {
+		quint64                           bucketMicroseconds;
+		QMap<quint64, Totals>             buckets;
+		QHash<quint32, ConnectionTotals>  connections;
+		QString                           error;
+		QString                           fileName;
+		QHash<quint32, ProcessTotals>     processes;
+	};
+
+	bool ParseArgs(const QStringList &args);
+	static void SummarizeFile(FileSummary &summary);
+	static void SummarizeBlocks(FileSummary &summary, const char *data, const quint64 length);
+	bool Usage(const QString &progname, const QString &msg = QString());
+	void WriteCsv(QTextStream &out, const FileSummary &total);
+	void WriteJson(QTextStream &out, const FileSummary &total);
+
+	quint32        m_bucketSeconds;
+	QTextStream    m_cerr;
+	QStringList    m_fileNames;
+	OutputFormat   m_format;
+	int            m_jobs;
+	QString        m_outputFileName;
+};
+
+#endif // HONE_SUMMARIZE_H
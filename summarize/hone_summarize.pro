@@ -0,0 +1,33 @@
+QT += core concurrent
+QT -= gui
+
+TARGET = hone-summarize
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../shim ../libhonecapture
+
+win32 {
+	QMAKE_CFLAGS_RELEASE += /Zi
+	QMAKE_LFLAGS_RELEASE += /MAP /debug /opt:ref
+
+	RC_FILE = hone_summarize.rc
+
+	HEADERS += \
+		../version.h \
+		../version_info.h \
+		hone_summarize_info.h
+
+	OTHER_FILES += hone_summarize.rc
+}
+
+SOURCES += \
+	main.cpp \
+	hone_summarize.cpp
+
+HEADERS += \
+	../libhonecapture/pcapng_blocks.h \
+	../shim/hone_pcapng.h \
+	hone_summarize.h
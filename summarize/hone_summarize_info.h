@@ -0,0 +1,22 @@
+//----------------------------------------------------------------------------
+// Hone capture summarizer
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+#ifndef HONE_SUMMARIZE_INFO_H
+#define HONE_SUMMARIZE_INFO_H
+
+#include "../version_info.h"
+
+#define HONE_SUMMARIZE_DESCRIPTION_STR  "Hone Capture Summarizer"
+#define HONE_SUMMARIZE_NAME_STR         "HONE-SUMMARIZE.EXE"
+#define HONE_SUMMARIZE_VERSION          HONE_WS_PRODUCTVERSION
+#define HONE_SUMMARIZE_VERSION_STR      HONE_WS_PRODUCTVERSION_STR
+
+#endif // HONE_SUMMARIZE_INFO_H
@@ -0,0 +1,331 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+// Runs the capture loop against a synthetic block source, counting every
+// heap allocation the capture thread makes, and fails if the loop allocates
+// once it has warmed up.  The source plays a capture daemon, so the loop is
+// the one hone-dumpcap runs, reading through CaptureDriver.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QThread>
+
+#include <errno.h>
+#include <linux/sockios.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "hone_dumpcap.h"
+#include "hone_pcapng.h"
+
+extern "C" {
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_malloc(size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+// Allocations made by the capture thread while the source has armed the
+// count.  The default operator new goes through malloc, so it counts too.
+static int          g_allocationCount = 0;
+static int          g_armed           = 0;
+static size_t       g_firstSize       = 0;
+static __thread int t_captureThread   = 0;
+
+static const quint32 g_batchPackets    = 64;
+static const quint32 g_measuredBatches = 400;
+static const quint32 g_tailBatches     = 16;
+static const quint32 g_warmBatches     = 64;
+
+//----------------------------------------------------------------------------
+static void CountAllocation(const size_t size)
+{
+	if (t_captureThread && __atomic_load_n(&g_armed, __ATOMIC_ACQUIRE)) {
+		if (__atomic_fetch_add(&g_allocationCount, 1, __ATOMIC_RELAXED) == 0) {
+			g_firstSize = size;
+		}
+	}
+}
+
+extern "C" void *malloc(size_t size)
+{
+	CountAllocation(size);
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	CountAllocation(count * size);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	CountAllocation(size);
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+	CountAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+	CountAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	CountAllocation(size);
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr ? 0 : ENOMEM;
+}
+
+//----------------------------------------------------------------------------
+// Serves the capture client the way a capture daemon would: the section
+// headers, a process and a connection, then batches of packets.  The count
+// is armed once the warm-up batches have been read, and disarmed before the
+// last few, so the end of the capture can allocate as it likes.  Each batch
+// waits for the one before it to be read, so the writer threads keep up and
+// their queues stay as deep as they were while warming up.
+class BlockSource : public QThread
+{
+public:
+	explicit BlockSource(const QString &socketName)
+		: m_handle(-1)
+		, m_listenHandle(-1)
+		, m_ok(false)
+		, m_socketName(socketName)
+	{
+	}
+
+	~BlockSource(void)
+	{
+		if (m_listenHandle != -1) {
+			::close(m_listenHandle);
+			::unlink(m_socketName.toLocal8Bit().data());
+		}
+	}
+
+	bool Listen(void)
+	{
+		struct sockaddr_un address;
+		const QByteArray   path = m_socketName.toLocal8Bit();
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= static_cast<int>(sizeof(address.sun_path))) {
+			return false;
+		}
+		strcpy(address.sun_path, path.data());
+		m_listenHandle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		return (m_listenHandle != -1) &&
+				(::bind(m_listenHandle, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0) &&
+				(::listen(m_listenHandle, 1) == 0);
+	}
+
+	bool Ok(void) const { return m_ok; }
+
+	// Give up on a capture that never connected
+	void Stop(void)
+	{
+		::shutdown(m_listenHandle, SHUT_RDWR);
+		wait();
+	}
+
+	static quint32 PacketCount(void)
+	{
+		return (g_warmBatches + g_measuredBatches + g_tailBatches) * g_batchPackets;
+	}
+
+protected:
+	void run(void)
+	{
+		m_handle = ::accept(m_listenHandle, NULL, NULL);
+		if (m_handle == -1) {
+			return;
+		}
+
+		QByteArray batch;
+		for (quint32 index = 0; index < g_batchPackets; index++) {
+			batch.append(PacketBlock(index));
+		}
+		m_ok = Send(SectionHeaders() + ProcessBlock() + ConnectionBlock()) &&
+				SendBatches(batch, g_warmBatches) && Drain();
+		__atomic_store_n(&g_armed, 1, __ATOMIC_RELEASE);
+		m_ok = m_ok && SendBatches(batch, g_measuredBatches) && Drain();
+		__atomic_store_n(&g_armed, 0, __ATOMIC_RELEASE);
+		m_ok = m_ok && SendBatches(batch, g_tailBatches);
+
+		// Hold the connection until the capture is done with it
+		char byte;
+		while (::recv(m_handle, &byte, sizeof(byte), 0) > 0) {
+		}
+		::close(m_handle);
+	}
+
+private:
+	static QByteArray Block(const quint32 type, const QByteArray &body)
+	{
+		const quint32 blockLength = PCAPNG_MIN_BLOCK_LENGTH + ((body.size() + 3) & ~3);
+		QByteArray    block(blockLength, 0);
+		quint32      *words = reinterpret_cast<quint32*>(block.data());
+		words[0] = type;
+		words[1] = blockLength;
+		memcpy(block.data() + sizeof(PcapNgBlockHeader), body.constData(), body.size());
+		words[blockLength / sizeof(quint32) - 1] = blockLength;
+		return block;
+	}
+
+	static QByteArray ConnectionBlock(void)
+	{
+		const quint32 body[] = { 7, 42, 0, 1 };
+		return Block(HONE_CONNECTION_EVENT_BLOCK, QByteArray(reinterpret_cast<const char*>(body), sizeof(body)));
+	}
+
+	static QByteArray PacketBlock(const quint32 index)
+	{
+		// 60 bytes of packet, then the connection ID option
+		const quint32 words[] = { 0, 0, 1000 + index, 60, 60 };
+		const quint32 option[] = { HONE_PACKET_OPT_CONNECTION_ID | (sizeof(quint32) << 16), 7, PCAPNG_OPT_END_OF_OPTIONS };
+		QByteArray    body(reinterpret_cast<const char*>(words), sizeof(words));
+		body.append(QByteArray(60, '\x55'));
+		body.append(reinterpret_cast<const char*>(option), sizeof(option));
+		return Block(PCAPNG_ENHANCED_PACKET_BLOCK, body);
+	}
+
+	static QByteArray ProcessBlock(void)
+	{
+		const quint32 body[] = { 42, 0, 1 };
+		return Block(HONE_PROCESS_EVENT_BLOCK, QByteArray(reinterpret_cast<const char*>(body), sizeof(body)));
+	}
+
+	static QByteArray SectionHeaders(void)
+	{
+		const quint32 section[]   = { 0x1A2B3C4D, 1, 0xFFFFFFFF, 0xFFFFFFFF };  // Version 1.0, unknown length
+		const quint32 interface[] = { 1, 65535 };                             // Ethernet
+		return Block(PCAPNG_SECTION_HEADER_BLOCK, QByteArray(reinterpret_cast<const char*>(section), sizeof(section))) +
+				Block(PCAPNG_INTERFACE_DESC_BLOCK, QByteArray(reinterpret_cast<const char*>(interface), sizeof(interface)));
+	}
+
+	// Wait for the capture to read everything sent so far, then give it a
+	// moment to write it out
+	bool Drain(const int settleMsecs = 100)
+	{
+		for (int tries = 0; tries < 10000; tries++) {
+			int pending = 0;
+			if (::ioctl(m_handle, SIOCOUTQ, &pending) == -1) {
+				return false;
+			}
+			if (!pending) {
+				QThread::msleep(settleMsecs);
+				return true;
+			}
+			QThread::msleep(1);
+		}
+		return false;
+	}
+
+	bool Send(const QByteArray &data)
+	{
+		quint32 offset = 0;
+		while (offset < static_cast<quint32>(data.size())) {
+			const ssize_t bytesSent = ::send(m_handle, data.constData() + offset, data.size() - offset, MSG_NOSIGNAL);
+			if (bytesSent <= 0) {
+				return false;
+			}
+			offset += bytesSent;
+		}
+		return true;
+	}
+
+	bool SendBatches(const QByteArray &batch, const quint32 batchCount)
+	{
+		for (quint32 index = 0; index < batchCount; index++) {
+			if (!Send(batch) || !Drain(1)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int     m_handle;
+	int     m_listenHandle;
+	bool    m_ok;
+	QString m_socketName;
+};
+
+//----------------------------------------------------------------------------
+static bool RunCapture(const QString &name, const QStringList &extraArgs, const QString &dirName)
+{
+	BlockSource source(QString("%1/source.sock").arg(dirName));
+	if (!source.Listen()) {
+		printf("%s: cannot listen for the capture: %s\n", qPrintable(name), strerror(errno));
+		return false;
+	}
+	source.start();
+
+	QStringList args;
+	args << QCoreApplication::applicationFilePath() << "-i" << "Hone"
+			<< "--daemon-socket" << QString("%1/source.sock").arg(dirName)
+			<< "-c" << QString::number(BlockSource::PacketCount())
+			<< "-w" << QString("%1/capture.pcapng").arg(dirName) << extraArgs;
+
+	__atomic_store_n(&g_allocationCount, 0, __ATOMIC_RELAXED);
+	bool rc;
+	{
+		HoneDumpcap honeDumpcap;
+		t_captureThread = 1;
+		rc = honeDumpcap.Initialize(args, QCoreApplication::applicationDirPath()) && honeDumpcap.Process();
+		t_captureThread = 0;
+	}
+	source.Stop();
+
+	const int allocationCount = __atomic_load_n(&g_allocationCount, __ATOMIC_RELAXED);
+	if (!rc || !source.Ok()) {
+		printf("%s: the capture did not run to the end\n", qPrintable(name));
+		return false;
+	}
+	if (allocationCount) {
+		printf("%s: FAIL, %d allocations in the steady state, the first of %lu bytes\n", qPrintable(name),
+				allocationCount, static_cast<unsigned long>(g_firstSize));
+		return false;
+	}
+	printf("%s: ok\n", qPrintable(name));
+	return true;
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	const QString    dirName = QString("%1/hone_alloc_test_%2").arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+	QDir             dir(dirName);
+	if (!dir.mkpath(".") || !dir.mkpath("striped")) {
+		printf("Cannot create %s\n", qPrintable(dirName));
+		return 1;
+	}
+
+	bool rc = RunCapture("Single file", QStringList(), dirName);
+	rc = RunCapture("Striped with latency", QStringList() << "-w" << QString("%1/striped/capture.pcapng").arg(dirName)
+			<< "-b" << "filesize:1000000" << "--latency", dirName) && rc;
+	rc = RunCapture("Hashed", QStringList() << "--manifest" << QString("%1/manifest.txt").arg(dirName), dirName) && rc;
+
+	dir.removeRecursively();
+	return rc ? 0 : 1;
+}
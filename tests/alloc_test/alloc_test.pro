@@ -0,0 +1,14 @@
+QT += core
+QT -= gui
+
+TARGET = alloc_test
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+# Stands in for glibc's malloc, so this test only builds on Linux
+include(../../shim/hone_dumpcap.pri)
+
+SOURCES += \
+	alloc_test.cpp
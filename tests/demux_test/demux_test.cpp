@@ -0,0 +1,119 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+// Splits a short capture by process and by connection, and checks that the
+// end events, which carry negated IDs, land in the same files as the starts.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "capture_demux.h"
+#include "hone_pcapng.h"
+
+static const quint32 g_connectionId = 7;
+static const quint32 g_processId    = 42;
+
+//----------------------------------------------------------------------------
+static QByteArray Block(const quint32 type, const QByteArray &body)
+{
+	const quint32 blockLength = PCAPNG_MIN_BLOCK_LENGTH + ((body.size() + 3) & ~3);
+	QByteArray    block(blockLength, 0);
+	quint32      *words = reinterpret_cast<quint32*>(block.data());
+	words[0] = type;
+	words[1] = blockLength;
+	memcpy(block.data() + sizeof(PcapNgBlockHeader), body.constData(), body.size());
+	words[blockLength / sizeof(quint32) - 1] = blockLength;
+	return block;
+}
+
+//----------------------------------------------------------------------------
+static QByteArray ConnectionBlock(const quint32 connectionId)
+{
+	const quint32 body[] = { connectionId, g_processId, 0, 1 };
+	return Block(HONE_CONNECTION_EVENT_BLOCK, QByteArray(reinterpret_cast<const char*>(body), sizeof(body)));
+}
+
+//----------------------------------------------------------------------------
+static QByteArray PacketBlock(void)
+{
+	// 60 bytes of packet, then the connection ID option
+	const quint32 words[]  = { 0, 0, 1000, 60, 60 };
+	const quint32 option[] = { HONE_PACKET_OPT_CONNECTION_ID | (sizeof(quint32) << 16), g_connectionId,
+			PCAPNG_OPT_END_OF_OPTIONS };
+	QByteArray    body(reinterpret_cast<const char*>(words), sizeof(words));
+	body.append(QByteArray(60, '\x55'));
+	body.append(reinterpret_cast<const char*>(option), sizeof(option));
+	return Block(PCAPNG_ENHANCED_PACKET_BLOCK, body);
+}
+
+//----------------------------------------------------------------------------
+static QByteArray ProcessBlock(const quint32 processId)
+{
+	const quint32 body[] = { processId, 0, 1 };
+	return Block(HONE_PROCESS_EVENT_BLOCK, QByteArray(reinterpret_cast<const char*>(body), sizeof(body)));
+}
+
+//----------------------------------------------------------------------------
+static QByteArray SectionHeaders(void)
+{
+	const quint32 section[]   = { 0x1A2B3C4D, 1, 0xFFFFFFFF, 0xFFFFFFFF };  // Version 1.0, unknown length
+	const quint32 interface[] = { 1, 65535 };                             // Ethernet
+	return Block(PCAPNG_SECTION_HEADER_BLOCK, QByteArray(reinterpret_cast<const char*>(section), sizeof(section))) +
+			Block(PCAPNG_INTERFACE_DESC_BLOCK, QByteArray(reinterpret_cast<const char*>(interface), sizeof(interface)));
+}
+
+//----------------------------------------------------------------------------
+static bool RunDemux(const QString &name, const CaptureDemux::Mode mode, const QString &fileName,
+		const QByteArray &expected, const QString &dirName)
+{
+	// The capture writer hands the demux one read at a time, so the end
+	// events come in a later write than the packet
+	CaptureDemux demux;
+	const QByteArray start = SectionHeaders() + ProcessBlock(g_processId) + ConnectionBlock(g_connectionId) + PacketBlock();
+	const QByteArray end   = ConnectionBlock(0U - g_connectionId) + ProcessBlock(0U - g_processId);
+	if (!demux.Open(mode, dirName) || !demux.Write(start.constData(), start.size()) ||
+			!demux.Write(end.constData(), end.size()) || !demux.Close()) {
+		printf("%s: %s\n", qPrintable(name), qPrintable(demux.Error()));
+		return false;
+	}
+
+	QFile file(QString("%1/%2").arg(dirName, fileName));
+	if (!file.open(QIODevice::ReadOnly)) {
+		printf("%s: cannot open %s\n", qPrintable(name), qPrintable(file.fileName()));
+		return false;
+	}
+	const QByteArray contents = file.readAll();
+	if (!contents.endsWith(expected)) {
+		printf("%s: FAIL, %s does not end with the end events\n", qPrintable(name), qPrintable(file.fileName()));
+		return false;
+	}
+	printf("%s: ok\n", qPrintable(name));
+	return true;
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	const QString    dirName = QString("%1/hone_demux_test_%2").arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+
+	bool rc = RunDemux("By process", CaptureDemux::ModeProcess, QString("pid_%1.pcapng").arg(g_processId),
+			ConnectionBlock(0U - g_connectionId) + ProcessBlock(0U - g_processId), QString("%1/pid").arg(dirName));
+	rc = RunDemux("By connection", CaptureDemux::ModeConnection, QString("connection_%1.pcapng").arg(g_connectionId),
+			ConnectionBlock(0U - g_connectionId), QString("%1/connection").arg(dirName)) && rc;
+
+	QDir(dirName).removeRecursively();
+	return rc ? 0 : 1;
+}
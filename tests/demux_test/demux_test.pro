@@ -0,0 +1,13 @@
+QT += core
+QT -= gui
+
+TARGET = demux_test
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+include(../../shim/hone_dumpcap.pri)
+
+SOURCES += \
+	demux_test.cpp
@@ -0,0 +1,107 @@
+//----------------------------------------------------------------------------
+// Hone dumpcap replacement
+//
+// Copyright (c) 2014 Battelle Memorial Institute
+// Licensed under a modification of the 3-clause BSD license
+// See License.txt for the full text of the license and additional disclaimers
+//
+// Authors
+//   Richard L. Griswold <richard.griswold@pnnl.gov>
+//----------------------------------------------------------------------------
+
+// Times how long hone-dumpcap takes from being started to its first output
+// for the calls Wireshark's UI waits on: listing the interfaces, listing the
+// Hone link types, and starting a capture.  A capture counts as started once
+// it names its file.  Run it where the Hone driver is loaded, since the
+// capture needs it.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QStringList>
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Start hone-dumpcap and return the nanoseconds until its output holds the
+// marker, or -1 if it never does
+static qint64 TimeToOutput(const QString &program, const QStringList &args, const QByteArray &marker,
+		QByteArray &output)
+{
+	QProcess      process;
+	QElapsedTimer timer;
+	process.setProcessChannelMode(QProcess::MergedChannels);
+	output.clear();
+	timer.start();
+	process.start(program, args);
+	while (!output.contains(marker) && process.waitForReadyRead(10000)) {
+		output += process.readAll();
+	}
+	const qint64 nsecs = output.contains(marker) ? timer.nsecsElapsed() : -1;
+
+	// A capture runs until it is told to stop
+	process.terminate();
+	if (!process.waitForFinished(5000)) {
+		process.kill();
+		process.waitForFinished();
+	}
+	return nsecs;
+}
+
+//----------------------------------------------------------------------------
+static bool Bench(const QString &name, const QString &program, const QStringList &args, const QByteArray &marker,
+		const int runCount)
+{
+	std::vector<qint64> times;
+	for (int run = 0; run < runCount; run++) {
+		QByteArray   output;
+		const qint64 nsecs = TimeToOutput(program, args, marker, output);
+		if (nsecs == -1) {
+			printf("%-15s no '%s' in the output:\n%s\n", qPrintable(name), marker.constData(), output.constData());
+			return false;
+		}
+		times.push_back(nsecs);
+	}
+
+	std::sort(times.begin(), times.end());
+	printf("%-15s %6d %10.2f %10.2f %10.2f\n", qPrintable(name), runCount, times.front() / 1e6,
+			times[times.size() / 2] / 1e6, times.back() / 1e6);
+	return true;
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	QCoreApplication  app(argc, argv);
+	const QStringList args     = app.arguments();
+	bool              ok       = (args.size() == 2);
+	int               runCount = 20;
+	if (args.size() == 3) {
+		runCount = args.at(2).toInt(&ok);
+		ok       = ok && (runCount > 0);
+	}
+	if (!ok) {
+		printf("Usage: startup_bench <path to hone-dumpcap> [runs]\n");
+		return 1;
+	}
+
+	const QString program = args.at(1);
+	const QString dirName = QString("%1/hone_startup_bench_%2").arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+	QDir          dir(dirName);
+	if (!dir.mkpath(".")) {
+		printf("Cannot create %s\n", qPrintable(dirName));
+		return 1;
+	}
+
+	printf("%-15s %6s %10s %10s %10s\n", "Operation", "Runs", "Min ms", "Median ms", "Max ms");
+	bool rc = Bench("-D", program, QStringList() << "-D", "\n", runCount);
+	rc = Bench("-L -i Hone", program, QStringList() << "-L" << "-i" << "Hone", "\n", runCount) && rc;
+	rc = Bench("Capture start", program, QStringList() << "-i" << "Hone" << "-w" << QString("%1/capture.pcapng").arg(dirName),
+			"File: ", runCount) && rc;
+
+	dir.removeRecursively();
+	return rc ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+QT += core
+QT -= gui
+
+TARGET = startup_bench
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+# Runs a built hone-dumpcap, so it needs none of the shim's sources
+SOURCES += \
+	startup_bench.cpp